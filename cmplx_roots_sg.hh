@@ -0,0 +1,911 @@
+//Complex polynomial root solver of Skowron & Gould (2012)
+//C++ port of cmplx_roots_sg.f90, templated on the real scalar type.
+//
+//  Copyright 2012 Jan Skowron & Andrew Gould
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+// The authors also release this code under the GNU Lesser General
+// Public License version 2 or any later version, as well as under
+// a "customary scientific license", which implies that if this code
+// was important in the scientific process or for the results of your
+// scientific work, we ask for the appropriate citation of the Paper:
+//   Skowron & Gould 2012
+//   "General Complex Polynomial Root Solver and Its Further Optimization for Binary Microlenses"
+// see also NOTICE.txt
+//
+// This port replaces the gfortran-compiled cmplx_roots_sg.f90 and its
+// quad-precision copy cmplx_roots_sg_quad.f90.
+
+#ifndef CMPLX_ROOTS_SG_HH
+#define CMPLX_ROOTS_SG_HH
+#include <complex>
+#include <cmath>
+#include <vector>
+///__float128 instances (through libquadmath) are available with GCC, where the type is supported.
+#if defined(USE_KIND_16) || ( defined(__SIZEOF_FLOAT128__) && !defined(__clang__) && !defined(__INTEL_COMPILER) )
+#define CMPLX_ROOTS_SG_FLOAT128
+#include <quadmath.h>
+#endif
+using namespace std;
+
+///Header-only port of the Skowron & Gould complex polynomial solver.
+///
+///The routines follow the Fortran original step-by-step so that, for double
+///precision (and with the -fcx-fortran-rules complex arithmetic we build with)
+///the roots are the same as from the Fortran code.  The templates can be
+///instantiated for double, long double and, where supported, __float128.
+///Polynomial coefficients are ordered as in the Fortran version:
+///  poly[0] x^0 + poly[1] x^1 + ... + poly[degree] x^degree
+///but arrays are 0-indexed.
+///
+///The public entry points are cmplx_roots_5 (tailored for the binary lens
+///quintic, with failsafes for polishing) and cmplx_roots_gen (general degree).
+///The remaining routines are building blocks, as in the Fortran file:
+///  sort_5_points_by_separation   - sorting of an array of 5 points, 1st most isolated, 4th and 5th - closest
+///  find_2_closest_from_5         - finds closest pair of 5 points
+///  cmplx_laguerre                - Laguerre's method with simplified Adams' stopping criterion
+///  cmplx_newton_spec             - Newton's method with stopping criterion calculated every 10 steps
+///  cmplx_laguerre2newton         - three regime method: Laguerre's, Second-order General method and Newton's
+///  solve_quadratic_eq            - quadratic equation solver
+///  solve_cubic_eq                - cubic equation solver based on Lagrange's method
+///  divide_poly_1                 - division of the polynomial by (x-p)
+
+///Precision dependent constants.
+///FRAC_ERR is the fractional error used in the Adams (1967) stopping criterion.
+template<typename T> struct cmplx_roots_sg_traits;
+template<> struct cmplx_roots_sg_traits<double>{
+  static double FRAC_ERR(){return 2.0e-15;};
+  static double pi(){return 3.141592653589793;};
+  static double third(){return 0.3333333333333333;};
+  static double half_sqrt3(){return 0.8660254037844386;};
+};
+template<> struct cmplx_roots_sg_traits<long double>{
+  static long double FRAC_ERR(){return 1.0e-18L;};
+  static long double pi(){return 3.14159265358979323846264338327950288L;};
+  static long double third(){return 0.33333333333333333333333333333333333L;};
+  static long double half_sqrt3(){return 0.86602540378443864676372317075293618L;};
+};
+#ifdef CMPLX_ROOTS_SG_FLOAT128
+template<> struct cmplx_roots_sg_traits<__float128>{
+  static __float128 FRAC_ERR(){return 2.0e-30;};//as in cmplx_roots_sg_quad.f90 (a guess for quad prec.)
+  static __float128 pi(){return 4*atanq(1);};
+  static __float128 third(){return __float128(1)/3;};
+  static __float128 half_sqrt3(){return sqrtq(3)/2;};
+};
+#endif
+
+///Elementary complex functions.
+///These defer to the standard library, except for __float128 where we go through libquadmath.
+template<typename T> inline T cmplx_roots_sg_abs(const complex<T> &z){return abs(z);};
+template<typename T> inline complex<T> cmplx_roots_sg_sqrt(const complex<T> &z){return sqrt(z);};
+///z**y computed as exp(y*log(z)), which is how cpow evaluates the Fortran z**third.
+template<typename T> inline complex<T> cmplx_roots_sg_pow(const complex<T> &z, T y){
+  complex<T> lz=log(z);
+  return exp(complex<T>(y*real(lz),y*imag(lz)));
+};
+template<typename T> inline complex<T> cmplx_roots_sg_expi(T phi){return complex<T>(cos(phi),sin(phi));};
+#ifdef CMPLX_ROOTS_SG_FLOAT128
+inline __complex128 cmplx_roots_sg_q(const complex<__float128> &z){__complex128 c;__real__ c=real(z);__imag__ c=imag(z);return c;};
+inline __float128 cmplx_roots_sg_abs(const complex<__float128> &z){return cabsq(cmplx_roots_sg_q(z));};
+inline complex<__float128> cmplx_roots_sg_sqrt(const complex<__float128> &z){
+  __complex128 c=csqrtq(cmplx_roots_sg_q(z));
+  return complex<__float128>(crealq(c),cimagq(c));
+};
+inline complex<__float128> cmplx_roots_sg_pow(const complex<__float128> &z, __float128 y){
+  __complex128 lz=clogq(cmplx_roots_sg_q(z)),c;
+  __real__ lz=y*crealq(lz);
+  __imag__ lz=y*cimagq(lz);
+  c=cexpq(lz);
+  return complex<__float128>(crealq(c),cimagq(c));
+};
+inline complex<__float128> cmplx_roots_sg_expi(__float128 phi){return complex<__float128>(cosq(phi),sinq(phi));};
+#endif
+///|z|^2 computed as real(conjg(z)*z)
+template<typename T> inline T cmplx_roots_sg_abs2(const complex<T> &z){return real(z)*real(z)+imag(z)*imag(z);};
+
+///Constants needed to break cycles in the iterative schemes.
+const int cmplx_roots_sg_FRAC_JUMP_EVERY=10;
+const int cmplx_roots_sg_FRAC_JUMP_LEN=10;
+const double cmplx_roots_sg_FRAC_JUMPS[cmplx_roots_sg_FRAC_JUMP_LEN]={0.64109297,
+								     0.91577881, 0.25921289,  0.50487203,
+								     0.08177045, 0.13653241,  0.306162  ,
+								     0.37794326, 0.04618805,  0.75132137}; // some random numbers
+
+///Random jump of size ~|root|+1 used when the denominator vanishes.
+template<typename T> inline complex<T> cmplx_roots_sg_jump(const complex<T> &root, int i){
+  T phi=T(cmplx_roots_sg_FRAC_JUMPS[i%cmplx_roots_sg_FRAC_JUMP_LEN])*2*cmplx_roots_sg_traits<T>::pi();
+  return (cmplx_roots_sg_abs(root)+T(1))*cmplx_roots_sg_expi(phi);
+};
+
+///Sort array of five points.
+///Return index array that sorts array of five points.
+///Index of the most isolated point will appear on the first place
+///of the output array.
+///The indices of the closest 2 points will be at the last two
+///places in the 'sorted_points' array
+template<typename T>
+void sort_5_points_by_separation_i(int sorted_points[5], const complex<T> points[5]){
+  const int n=5;
+  T dmin, d1, d2, d;
+  T distances2[n][n];
+  T neigh1st[n],neigh2nd[n];
+  for(int kj=0;kj<n;kj++)for(int ki=0;ki<n;ki++)distances2[kj][ki]=T(1e100);
+  dmin=T(1e100);
+
+  for(int kj=0;kj<n;kj++){
+    for(int ki=0;ki<kj;ki++){
+      d=cmplx_roots_sg_abs2(complex<T>(points[ki]-points[kj]));
+      distances2[ki][kj]=d;
+      distances2[kj][ki]=d;
+    }
+  }
+
+  // find neighbours
+  for(int kj=0;kj<n;kj++){
+    neigh1st[kj]=T(1e100);
+    neigh2nd[kj]=T(1e100);
+  }
+  for(int kj=0;kj<n;kj++){
+    for(int ki=0;ki<n;ki++){
+      d=distances2[kj][ki];
+      if(d<neigh2nd[kj]){
+	if(d<neigh1st[kj]){
+	  neigh2nd[kj]=neigh1st[kj];
+	  neigh1st[kj]=d;
+	} else {
+	  neigh2nd[kj]=d;
+	}
+      }
+    }
+  }
+
+  // initialize sorted_points
+  for(int ki=0;ki<n;ki++)sorted_points[ki]=ki;
+
+  // sort the rest 1..n-2
+  for(int kj=1;kj<n;kj++){
+    d1=neigh1st[kj];
+    d2=neigh2nd[kj];
+    int put=0;
+    for(int ki=kj-1;ki>=0;ki--){
+      int ind2=sorted_points[ki];
+      d=neigh1st[ind2];
+      if(d>=d1){
+	if(d==d1){
+	  if(neigh2nd[ind2]>d2){
+	    put=ki+1;
+	    break;
+	  }
+	} else {
+	  put=ki+1;
+	  break;
+	}
+      }
+      sorted_points[ki+1]=sorted_points[ki];
+    }
+    sorted_points[put]=kj;
+  }
+  (void)dmin;
+};
+
+///Sort array of five points
+///Most isolated point will become the first point in the array
+///The closest points will be the last two points in the array
+template<typename T>
+void sort_5_points_by_separation(complex<T> points[5]){
+  int sorted_points[5];
+  complex<T> savepoints[5];
+  sort_5_points_by_separation_i(sorted_points, points);
+  for(int i=0;i<5;i++)savepoints[i]=points[i];
+  for(int i=0;i<5;i++)points[i]=savepoints[sorted_points[i]];
+};
+
+///Returns indices of the two closest points out of array of 5
+template<typename T>
+void find_2_closest_from_5(int &i1, int &i2, T &d2min, const complex<T> points[5]){
+  const int n=5;
+  T d2min1=T(1e100);
+  for(int j=0;j<n;j++){
+    for(int i=0;i<j;i++){
+      T d2=cmplx_roots_sg_abs2(complex<T>(points[i]-points[j]));
+      if(d2<=d2min1){
+	i1=i;
+	i2=j;
+	d2min1=d2;
+      }
+    }
+  }
+  d2min=d2min1;
+};
+
+///Finds one root of a complex polynomial using Laguerre's method.
+///In every loop it calculates simplified Adams' stopping criterion for the value of the polynomial.
+///
+///Uses 'root' value as a starting point.  Remember to initialize 'root' to some initial guess or to
+///point (0,0) if you have no prior knowledge.
+///  - degree  a degree of the polynomial
+///  - root    input: guess for the value of a root, output: a root of the polynomial
+///  - iter    number of iterations performed (the number of polynomial evaluations and stopping criterion evaluation)
+///  - success is false if routine reaches maximum number of iterations
+///For a summary of the method go to: http://en.wikipedia.org/wiki/Laguerre's_method
+template<typename T>
+void cmplx_laguerre(const complex<T> poly[], int degree, complex<T> &root, int &iter, bool &success){
+  const int MAX_ITERS=200;   // Laguerre is used as a failsafe
+  const T FRAC_ERR=cmplx_roots_sg_traits<T>::FRAC_ERR();
+  const complex<T> c_one=T(1),zero=T(0);
+  complex<T> p,dp,d2p_half; //value of polynomial, 1st derivative, 2nd derivative/2
+  complex<T> denom, denom_sqrt, dx, newroot;
+  complex<T> fac_netwon, fac_extra, F_half, c_one_nth;
+  T ek, absroot, abs2p, faq, stopping_crit2;
+  T one_nth, n_1_nth, two_n_div_n_1;
+  bool good_to_go=false;
+
+  iter=0;
+  success=true;
+  one_nth=T(1)/degree;
+  n_1_nth=(degree-T(1))*one_nth;
+  two_n_div_n_1=T(2)/n_1_nth;
+  c_one_nth=complex<T>(one_nth,0);
+
+  for(int i=1;i<=MAX_ITERS;i++){
+    // prepare stoping criterion
+    ek=cmplx_roots_sg_abs(poly[degree]);
+    absroot=cmplx_roots_sg_abs(root);
+    // calculate value of polynomial and its first two derivatives
+    p=poly[degree];
+    dp=zero;
+    d2p_half=zero;
+    for(int k=degree-1;k>=0;k--){ // Horner Scheme, see for eg.  Numerical Recipes Sec. 5.3
+      d2p_half=dp + d2p_half*root;
+      dp=p + dp*root;
+      p=poly[k]+p*root;    // b_k
+      // Adams, Duane A., 1967, "A stopping criterion for polynomial root finding",
+      // Communications of the ACM, Volume 10 Issue 10, Oct. 1967, p. 655
+      // Eq 8.
+      ek=absroot*ek+cmplx_roots_sg_abs(p);
+    }
+    iter++;
+
+    abs2p=cmplx_roots_sg_abs2(p);
+    if(abs2p==0)return;
+    stopping_crit2=(FRAC_ERR*ek)*(FRAC_ERR*ek);
+    if(abs2p<stopping_crit2){ // (simplified a little Eq. 10 of Adams 1967)
+      // do additional iteration if we are less than 10x from stopping criterion
+      if(abs2p<T(0.01)*stopping_crit2) return; // return immediately, because we are at very good place
+      else good_to_go=true; // do one iteration more
+    } else good_to_go=false;  // reset if we are outside the zone of the root
+
+    faq=1;
+    fac_netwon=p/dp;
+    fac_extra=d2p_half/dp;
+    F_half=fac_netwon*fac_extra;
+
+    denom_sqrt=cmplx_roots_sg_sqrt(complex<T>(c_one-two_n_div_n_1*F_half));
+
+    // real part of a square root is positive for probably all compilers, but we check
+    if(real(denom_sqrt)>=0) denom=c_one_nth+n_1_nth*denom_sqrt;
+    else denom=c_one_nth-n_1_nth*denom_sqrt;
+    if(denom==zero) dx=cmplx_roots_sg_jump(root,i); // test if demoninators are > 0.0 not to divide by zero
+    else dx=fac_netwon/denom;
+
+    newroot=root-dx;
+    if(newroot==root)return; // nothing changes -> return
+    if(good_to_go){ // this was jump already after stopping criterion was met
+      root=newroot;
+      return;
+    }
+
+    if(i%cmplx_roots_sg_FRAC_JUMP_EVERY==0){ // decide whether to do a jump of modified length (to break cycles)
+      faq=cmplx_roots_sg_FRAC_JUMPS[(i/cmplx_roots_sg_FRAC_JUMP_EVERY-1)%cmplx_roots_sg_FRAC_JUMP_LEN];
+      newroot=root-faq*dx; // do jump of some semi-random length (0<faq<1)
+    }
+    root=newroot;
+  }
+  success=false;
+  // too many iterations here
+};
+
+///Finds one root of a complex polynomial using Newton's method.
+///It calculates simplified Adams' stopping criterion for the value of the polynomial once per 10
+///iterations, after initial iteration. This is done to speed up calculations when polishing roots
+///that are known pretty well, and stopping criterion does not significantly change in their neighborhood.
+///
+///Uses 'root' value as a starting point.  Do not initialize 'root' to point (0,0) if the polynomial
+///coefficients are strictly real, because it will make going to imaginary roots impossible.
+///Arguments as for cmplx_laguerre.
+///For a summary of the method go to: http://en.wikipedia.org/wiki/Newton's_method
+template<typename T>
+void cmplx_newton_spec(const complex<T> poly[], int degree, complex<T> &root, int &iter, bool &success){
+  const int MAX_ITERS=50;
+  const T FRAC_ERR=cmplx_roots_sg_traits<T>::FRAC_ERR();
+  const complex<T> zero=T(0);
+  complex<T> p,dp,dx,newroot;
+  T ek, absroot, abs2p, faq, stopping_crit2=0;
+  bool good_to_go=false;
+
+  iter=0;
+  success=true;
+
+  for(int i=1;i<=MAX_ITERS;i++){
+    faq=1;
+    // calculate value of polynomial and its first derivative
+    p=poly[degree];
+    dp=zero;
+    if(i%10==1){ // calculate stopping criterion every tenth iteration
+      ek=cmplx_roots_sg_abs(poly[degree]);
+      absroot=cmplx_roots_sg_abs(root);
+      for(int k=degree-1;k>=0;k--){ // Horner Scheme
+	dp=p + dp*root;
+	p=poly[k]+p*root;    // b_k
+	ek=absroot*ek+cmplx_roots_sg_abs(p); // Adams (1967) Eq 8.
+      }
+      stopping_crit2=(FRAC_ERR*ek)*(FRAC_ERR*ek);
+    } else {  // calculate just the value and derivative
+      for(int k=degree-1;k>=0;k--){ // Horner Scheme
+	dp=p + dp*root;
+	p=poly[k]+p*root;    // b_k
+      }
+    }
+    iter++;
+
+    abs2p=cmplx_roots_sg_abs2(p);
+    if(abs2p==0)return;
+
+    if(abs2p<stopping_crit2){ // (simplified a little Eq. 10 of Adams 1967)
+      if(dp==zero)return; // if we have problem with zero, but we are close to the root, just accept
+      // do additional iteration if we are less than 10x from stopping criterion
+      if(abs2p<T(0.01)*stopping_crit2) return; // return immediately, because we are at very good place
+      else good_to_go=true; // do one iteration more
+    } else good_to_go=false; // reset if we are outside the zone of the root
+
+    if(dp==zero) dx=cmplx_roots_sg_jump(root,i); // problem with zero
+    else dx=p/dp;  // Newton method
+
+    newroot=root-dx;
+    if(newroot==root)return; // nothing changes -> return
+    if(good_to_go){ // this was jump already after stopping criterion was met
+      root=newroot;
+      return;
+    }
+
+    if(i%cmplx_roots_sg_FRAC_JUMP_EVERY==0){ // decide whether to do a jump of modified length (to break cycles)
+      faq=cmplx_roots_sg_FRAC_JUMPS[(i/cmplx_roots_sg_FRAC_JUMP_EVERY-1)%cmplx_roots_sg_FRAC_JUMP_LEN];
+      newroot=root-faq*dx; // do jump of some semi-random length (0<faq<1)
+    }
+    root=newroot;
+  }
+  success=false;
+  // too many iterations here
+};
+
+///Finds one root of a complex polynomial using Laguerre's method, Second-order General method
+///and Newton's method - depending on the value of function F, which is a combination of second
+///derivative, first derivative and value of polynomial [F=-(p"*p)/(p'p')].
+///
+///The routine has 3 modes of operation. It starts with mode=2 which is the Laguerre's method, and
+///continues until F becomes F<0.50, at which point, it switches to mode=1, i.e., SG method (see paper).
+///While in the first two modes, routine calculates stopping criterion once per every iteration.
+///Switch to the last mode, Newton's method, (mode=0) happens when becomes F<0.05. In this mode,
+///routine calculates stopping criterion only once, at the beginning, under an assumption that we
+///are already very close to the root.  If there are more than 10 iterations in Newton's mode,
+///it means that in fact we were far from the root, and routine goes back to Laguerre's method (mode=2).
+///
+///Uses 'root' value as a starting point.  Arguments as for cmplx_laguerre, plus:
+///  - starting_mode  this should be by default = 2. However if you choose to start with SG method
+///                   put 1 instead.  Zero will cause the routine to start with Newton for first
+///                   10 iterations, and then go back to mode 2.
+///For a summary of the method see the paper: Skowron & Gould (2012)
+template<typename T>
+void cmplx_laguerre2newton(const complex<T> poly[], int degree, complex<T> &root, int &iter, bool &success, int starting_mode){
+  const int MAX_ITERS=50;
+  const T FRAC_ERR=cmplx_roots_sg_traits<T>::FRAC_ERR();
+  const complex<T> c_one=T(1),zero=T(0);
+  complex<T> p,dp,d2p_half; //value of polynomial, 1st derivative, 2nd derivative/2
+  complex<T> denom, denom_sqrt, dx, newroot;
+  complex<T> fac_netwon, fac_extra, F_half, c_one_nth;
+  T ek, absroot, abs2p, abs2_F_half, faq, stopping_crit2=0;
+  T one_nth, n_1_nth, two_n_div_n_1;
+  int i, j=1;
+  bool good_to_go=false;
+  int mode=starting_mode;  // mode=2 full laguerre, mode=1 SG, mode=0 newton
+
+  iter=0;
+  success=true;
+
+  while(true){ // infinite loop, just to be able to come back from newton, if more than 10 iteration there
+
+    //------------------------------------------------------------- mode 2
+    if(mode>=2){  // LAGUERRE'S METHOD
+      one_nth=T(1)/degree;
+      n_1_nth=(degree-T(1))*one_nth;
+      two_n_div_n_1=T(2)/n_1_nth;
+      c_one_nth=complex<T>(one_nth,0);
+
+      for(i=1;i<=MAX_ITERS;i++){
+	faq=1;
+	// prepare stoping criterion
+	ek=cmplx_roots_sg_abs(poly[degree]);
+	absroot=cmplx_roots_sg_abs(root);
+	// calculate value of polynomial and its first two derivatives
+	p=poly[degree];
+	dp=zero;
+	d2p_half=zero;
+	for(int k=degree-1;k>=0;k--){ // Horner Scheme
+	  d2p_half=dp + d2p_half*root;
+	  dp=p + dp*root;
+	  p=poly[k]+p*root;    // b_k
+	  ek=absroot*ek+cmplx_roots_sg_abs(p); // Adams (1967) Eq 8.
+	}
+	abs2p=cmplx_roots_sg_abs2(p);
+	iter++;
+	if(abs2p==0)return;
+
+	stopping_crit2=(FRAC_ERR*ek)*(FRAC_ERR*ek);
+	if(abs2p<stopping_crit2){ // (simplified a little Eq. 10 of Adams 1967)
+	  // do additional iteration if we are less than 10x from stopping criterion
+	  if(abs2p<T(0.01)*stopping_crit2) return; // ten times better than stopping criterion
+	  else good_to_go=true; // do one iteration more
+	} else good_to_go=false; // reset if we are outside the zone of the root
+
+	fac_netwon=p/dp;
+	fac_extra=d2p_half/dp;
+	F_half=fac_netwon*fac_extra;
+
+	abs2_F_half=cmplx_roots_sg_abs2(F_half);
+	if(abs2_F_half<=T(0.0625)){     // F<0.50, F/2<0.25
+	  // go to SG method
+	  if(abs2_F_half<=T(0.000625)) mode=0; // F<0.05, F/2<0.025, go to Newton's
+	  else mode=1; // go to SG
+	}
+
+	denom_sqrt=cmplx_roots_sg_sqrt(complex<T>(c_one-two_n_div_n_1*F_half));
+
+	// real part of a square root is positive for probably all compilers, but we check
+	if(real(denom_sqrt)>=0) denom=c_one_nth+n_1_nth*denom_sqrt;
+	else denom=c_one_nth-n_1_nth*denom_sqrt;
+	if(denom==zero) dx=cmplx_roots_sg_jump(root,i); // test if demoninators are > 0.0 not to divide by zero
+	else dx=fac_netwon/denom;
+
+	newroot=root-dx;
+	if(newroot==root)return; // nothing changes -> return
+	if(good_to_go){ // this was jump already after stopping criterion was met
+	  root=newroot;
+	  return;
+	}
+
+	if(mode!=2){
+	  root=newroot;
+	  j=i+1;    // remember iteration index
+	  break;    // go to Newton's or SG
+	}
+
+	if(i%cmplx_roots_sg_FRAC_JUMP_EVERY==0){ // decide whether to do a jump of modified length (to break cycles)
+	  faq=cmplx_roots_sg_FRAC_JUMPS[(i/cmplx_roots_sg_FRAC_JUMP_EVERY-1)%cmplx_roots_sg_FRAC_JUMP_LEN];
+	  newroot=root-faq*dx; // do jump of some semi-random length (0<faq<1)
+	}
+	root=newroot;
+      } // do mode 2
+
+      if(i>=MAX_ITERS){
+	success=false;
+	return;
+      }
+    } // if mode 2
+
+    //------------------------------------------------------------- mode 1
+    if(mode==1){  // SECOND-ORDER GENERAL METHOD (SG)
+
+      for(i=j;i<=MAX_ITERS;i++){
+	faq=1;
+	// calculate value of polynomial and its first two derivatives
+	p=poly[degree];
+	dp=zero;
+	d2p_half=zero;
+	if((i-j)%10==0){
+	  // prepare stoping criterion
+	  ek=cmplx_roots_sg_abs(poly[degree]);
+	  absroot=cmplx_roots_sg_abs(root);
+	  for(int k=degree-1;k>=0;k--){ // Horner Scheme
+	    d2p_half=dp + d2p_half*root;
+	    dp=p + dp*root;
+	    p=poly[k]+p*root;    // b_k
+	    ek=absroot*ek+cmplx_roots_sg_abs(p); // Adams (1967) Eq 8.
+	  }
+	  stopping_crit2=(FRAC_ERR*ek)*(FRAC_ERR*ek);
+	} else {
+	  for(int k=degree-1;k>=0;k--){ // Horner Scheme
+	    d2p_half=dp + d2p_half*root;
+	    dp=p + dp*root;
+	    p=poly[k]+p*root;    // b_k
+	  }
+	}
+
+	abs2p=cmplx_roots_sg_abs2(p);
+	iter++;
+	if(abs2p==0)return;
+
+	if(abs2p<stopping_crit2){ // (simplified a little Eq. 10 of Adams 1967)
+	  if(dp==zero)return;
+	  // do additional iteration if we are less than 10x from stopping criterion
+	  if(abs2p<T(0.01)*stopping_crit2) return; // ten times better than stopping criterion
+	  else good_to_go=true; // do one iteration more
+	} else good_to_go=false; // reset if we are outside the zone of the root
+
+	if(dp==zero) dx=cmplx_roots_sg_jump(root,i); // test if demoninators are > 0.0 not to divide by zero
+	else {
+	  fac_netwon=p/dp;
+	  fac_extra=d2p_half/dp;
+	  F_half=fac_netwon*fac_extra;
+
+	  abs2_F_half=cmplx_roots_sg_abs2(F_half);
+	  if(abs2_F_half<=T(0.000625)) mode=0; // F<0.05, F/2<0.025, set Newton's, go there after jump
+
+	  dx=fac_netwon*(c_one+F_half);  // SG
+	}
+
+	newroot=root-dx;
+	if(newroot==root)return; // nothing changes -> return
+	if(good_to_go){ // this was jump already after stopping criterion was met
+	  root=newroot;
+	  return;
+	}
+
+	if(mode!=1){
+	  root=newroot;
+	  j=i+1;    // remember iteration number
+	  break;    // go to Newton's
+	}
+
+	if(i%cmplx_roots_sg_FRAC_JUMP_EVERY==0){ // decide whether to do a jump of modified length (to break cycles)
+	  faq=cmplx_roots_sg_FRAC_JUMPS[(i/cmplx_roots_sg_FRAC_JUMP_EVERY-1)%cmplx_roots_sg_FRAC_JUMP_LEN];
+	  newroot=root-faq*dx; // do jump of some semi-random length (0<faq<1)
+	}
+	root=newroot;
+      } // do mode 1
+
+      if(i>=MAX_ITERS){
+	success=false;
+	return;
+      }
+    } // if mode 1
+
+    //------------------------------------------------------------- mode 0
+    if(mode==0){  // NEWTON'S METHOD
+
+      for(i=j;i<=j+10;i++){  // do only 10 iterations the most, then go back to full Laguerre's
+	faq=1;
+	// calculate value of polynomial and its first derivative
+	p=poly[degree];
+	dp=zero;
+	if(i==j){ // calculate stopping crit only once at the begining
+	  ek=cmplx_roots_sg_abs(poly[degree]);
+	  absroot=cmplx_roots_sg_abs(root);
+	  for(int k=degree-1;k>=0;k--){ // Horner Scheme
+	    dp=p + dp*root;
+	    p=poly[k]+p*root;    // b_k
+	    ek=absroot*ek+cmplx_roots_sg_abs(p); // Adams (1967) Eq 8.
+	  }
+	  stopping_crit2=(FRAC_ERR*ek)*(FRAC_ERR*ek);
+	} else {
+	  for(int k=degree-1;k>=0;k--){ // Horner Scheme
+	    dp=p + dp*root;
+	    p=poly[k]+p*root;    // b_k
+	  }
+	}
+	abs2p=cmplx_roots_sg_abs2(p);
+	iter++;
+	if(abs2p==0)return;
+
+	if(abs2p<stopping_crit2){ // (simplified a little Eq. 10 of Adams 1967)
+	  if(dp==zero)return;
+	  // do additional iteration if we are less than 10x from stopping criterion
+	  if(abs2p<T(0.01)*stopping_crit2) return; // ten times better than stopping criterion
+	  else good_to_go=true; // do one iteration more
+	} else good_to_go=false; // reset if we are outside the zone of the root
+
+	if(dp==zero) dx=cmplx_roots_sg_jump(root,i); // test if demoninators are > 0.0 not to divide by zero
+	else dx=p/dp;
+
+	newroot=root-dx;
+	if(newroot==root)return; // nothing changes -> return
+	if(good_to_go){
+	  root=newroot;
+	  return;
+	}
+	// this loop is done only 10 times. So we skip the FRAC_JUMP check
+	root=newroot;
+      } // do mode 0 10 times
+
+      if(iter>=MAX_ITERS){
+	// too many iterations here
+	success=false;
+	return;
+      }
+      mode=2; // go back to Laguerre's. This happens when we were unable to converge in 10 iterations with Newton's
+    } // if mode 0
+    (void)faq;
+  } // end of infinite loop
+};
+
+///Quadratic equation solver for complex polynomial (degree=2)
+template<typename T>
+void solve_quadratic_eq(complex<T> &x0, complex<T> &x1, const complex<T> poly[]){
+  complex<T> a, b, c, b2, delta;
+  a=poly[2];
+  b=poly[1];
+  c=poly[0];
+  // quadratic equation: a z^2 + b z + c = 0
+  b2=b*b;
+  delta=cmplx_roots_sg_sqrt(complex<T>(b2-T(4)*(a*c)));
+  if(real(conj(b)*delta)>=0)  // scalar product to decide the sign yielding bigger magnitude
+    x0=T(-0.5)*(b+delta);
+  else
+    x0=T(-0.5)*(b-delta);
+  if(x0==complex<T>(0)) x1=complex<T>(0);
+  else { // Viete's formula
+    x1=c/x0;
+    x0=x0/a;
+  }
+};
+
+///Cubic equation solver for complex polynomial (degree=3)
+/// http://en.wikipedia.org/wiki/Cubic_function   Lagrange's method
+template<typename T>
+void solve_cubic_eq(complex<T> &x0, complex<T> &x1, complex<T> &x2, const complex<T> poly[]){
+  const T third=cmplx_roots_sg_traits<T>::third();                               // 1/3
+  const complex<T> zeta =complex<T>(T(-0.5), cmplx_roots_sg_traits<T>::half_sqrt3());  // sqrt3(1)
+  const complex<T> zeta2=complex<T>(T(-0.5),-cmplx_roots_sg_traits<T>::half_sqrt3());  // sqrt3(1)**2
+  complex<T> s0, s1, s2;
+  complex<T> E1; // x0+x1+x2
+  complex<T> E2; // x0x1+x1x2+x2x0
+  complex<T> E3; // x0x1x2
+  complex<T> A, B, a_1, E12;
+  complex<T> delta, A2;
+
+  a_1=T(1)/poly[3];
+  E1=-poly[2]*a_1;
+  E2=poly[1]*a_1;
+  E3=-poly[0]*a_1;
+
+  s0=E1;
+  E12=E1*E1;
+  A=T(2)*E1*E12-T(9)*E1*E2+T(27)*E3;  // =  s1^3 + s2^3
+  B=E12-T(3)*E2;                      // = s1 s2
+  // quadratic equation: z^2-Az+B^3=0  where roots are equal to s1^3 and s2^3
+  A2=A*A;
+  delta=cmplx_roots_sg_sqrt(complex<T>(A2-T(4)*(B*B*B)));
+  if(real(conj(A)*delta)>=0) // scalar product to decide the sign yielding bigger magnitude
+    s1=cmplx_roots_sg_pow(complex<T>(T(0.5)*(A+delta)),third);
+  else
+    s1=cmplx_roots_sg_pow(complex<T>(T(0.5)*(A-delta)),third);
+  if(s1==complex<T>(0)) s2=complex<T>(0);
+  else s2=B/s1;
+
+  x0=third*(s0+s1+s2);
+  x1=third*(s0+s1*zeta2+s2*zeta );
+  x2=third*(s0+s1*zeta +s2*zeta2);
+};
+
+///Divide polynomial 'polyin' by (x-p).
+///Results will be returned in polynomial 'polyout' of degree-1
+///The remainder of the division will be returned in 'remainder'
+///
+///You can provide same array as 'polyin' and 'polyout' - this routine will work fine, though it
+///will not set to zero the unused, highest coefficient in the output array.
+template<typename T>
+void divide_poly_1(complex<T> polyout[], complex<T> &remainder, const complex<T> &p, const complex<T> polyin[], int degree){
+  complex<T> coef, prev;
+  coef=polyin[degree];
+  if(polyout!=polyin)for(int i=0;i<degree;i++)polyout[i]=polyin[i];
+  for(int i=degree-1;i>=0;i--){
+    prev=polyout[i];
+    polyout[i]=coef;
+    coef=prev+p*coef;
+  }
+  remainder=coef;
+};
+
+///Finds roots of a complex polynomial.
+///This is general, however less fast or robust than cmplx_roots_5 which contains failsafe checks
+///in the polishing stage, but is designed only for 5th order polynomials.
+///
+///It uses Laguerre->SG->Newton method (cmplx_laguerre2newton) to find roots, dividing the
+///polynomial one by one by the roots found, and finds the last root from Viete's formula for
+///quadratic equation. Optionally it then polishes all found roots with Laguerre's method using
+///the full polynomial. We do not sort the roots.
+///  - roots   array which will hold all roots that had been found.  If the flag
+///            'use_roots_as_starting_points' is set, then instead of point (0,0) we use value
+///            from this array as starting point for each root search.
+///  - poly    array of polynomial coefs, length = degree+1, poly[0] is the constant term
+///  - degree  degree of the polynomial and size of 'roots' array
+///  - polish_roots_after  polish all roots using full polynomial after the division stage
+template<typename T>
+void cmplx_roots_gen(complex<T> roots[], const complex<T> poly[], int degree, bool polish_roots_after, bool use_roots_as_starting_points){
+  const complex<T> zero=T(0);
+  vector<complex<T> > poly2(poly,poly+degree+1);
+  complex<T> coef, prev;
+  int iter;
+  bool success;
+
+  // initialize starting points
+  if(!use_roots_as_starting_points)for(int i=0;i<degree;i++)roots[i]=zero;
+
+  // skip small degree polynomials from doing Laguerre's method
+  if(degree<=1){
+    //(The Fortran original has -poly(2)/poly(1) here, which is the inverse of the root.)
+    if(degree==1)roots[0]=-poly[0]/poly[1];
+    return;
+  }
+
+  for(int n=degree;n>=3;n--){
+    // find root with (Laguerre's method -> SG method -> Newton's method)
+    cmplx_laguerre2newton(&poly2[0], n, roots[n-1], iter, success, 2);
+    if(!success){
+      roots[n-1]=zero;
+      cmplx_laguerre(&poly2[0], n, roots[n-1], iter, success);
+    }
+    // divide the polynomial by this root
+    coef=poly2[n];
+    for(int i=n-1;i>=0;i--){
+      prev=poly2[i];
+      poly2[i]=coef;
+      coef=prev+roots[n-1]*coef;
+    }
+    // variable coef now holds a remainder - should be close to 0
+  }
+
+  // find all but last root with Laguerre's method
+  cmplx_laguerre2newton(&poly2[0], 2, roots[1], iter, success, 2);
+  if(!success) solve_quadratic_eq(roots[1],roots[0],&poly2[0]);
+  else roots[0]=-(roots[1]+poly2[1]/poly2[2]); // calculate last root from Viete's formula
+
+  if(polish_roots_after){
+    for(int n=0;n<degree;n++) // polish roots one-by-one with a full polynomial
+      cmplx_laguerre(poly, degree, roots[n], iter, success);
+  }
+};
+
+///Finds or polishes roots of a complex polynomial (degree=5)
+///This routine is especially tailored for solving binary lens equation in form of 5th order
+///polynomial.
+///
+///Use of this routine, in comparison to 'cmplx_roots_gen' can yield considerably faster code,
+///because it makes polishing of the roots (that come in as a guess from previous solutions) secure
+///by implementing additional checks on the result of polishing.  If those checks are not satisfied
+///then routine reverts to the robust algorithm. These checks are designed to work for 5th order
+///polynomial originated from binary lens equation.
+///
+///Usage:
+///  - polish_only == false  I do not know the roots, routine should find them from scratch. At the
+///                end it sorts roots from the most distant to closest. Two last roots are the
+///                closest (in no particular order).
+///  - polish_only == true   I do know the roots pretty well, for example I have changed the
+///                coefficients of the polynomial only a bit, so the two closest roots are most
+///                likely still the closest ones.  If the output flag 'first_3_roots_order_changed'
+///                is returned as 'false', then first 3 returned roots are in the same order as
+///                initially given to the routine. The last two roots are the closest ones, but in
+///                no specific order (!). If 'first_3_roots_order_changed' is 'true' then it means
+///                that all roots had been resorted. Two last roots are the closest ones. First is
+///                the most isolated one.
+///Returns all five roots in the 'roots' array.
+template<typename T>
+void cmplx_roots_5(complex<T> roots[5], bool &first_3_roots_order_changed, const complex<T> poly[6], bool polish_only){
+  const int degree=5;
+  const complex<T> zero=T(0);
+  complex<T> remainder, roots_robust[degree];
+  complex<T> poly2[degree+1];
+  T d2min;
+  int iter, root4=3, root5=4;
+  int go_to_robust=0;
+  bool succ=false;
+
+  if(!polish_only){
+    // initialize roots
+    for(int i=0;i<degree;i++)roots[i]=zero;
+    go_to_robust=1;
+  }
+  first_3_roots_order_changed=false;
+
+  for(int loops=1;loops<=3;loops++){
+
+    // ROBUST
+    // (we do not know the roots)
+    if(go_to_robust>0){
+
+      if(go_to_robust>2){  // something is wrong
+	for(int i=0;i<degree;i++)roots[i]=roots_robust[i]; // return not-polished roots, because polishing creates errors
+	return;
+      }
+
+      for(int i=0;i<=degree;i++)poly2[i]=poly[i]; // copy coeffs
+      for(int m=degree;m>=4;m--){ // find the roots one-by-one (until 3 are left to be found)
+	cmplx_laguerre2newton(poly2, m, roots[m-1], iter, succ, 2);
+	if(!succ){
+	  roots[m-1]=zero;
+	  cmplx_laguerre(poly2, m, roots[m-1], iter, succ);
+	}
+	// divide polynomial by this root
+	divide_poly_1(poly2, remainder, roots[m-1], poly2, m);
+      }
+      // find last 3 roots with cubic equation solver (Lagrange's method)
+      solve_cubic_eq(roots[0],roots[1],roots[2],poly2);
+      // all roots found
+
+      // sort roots - first will be most isolated, last two will be the closest
+      sort_5_points_by_separation(roots);
+      // copy roots in case something will go wrong during polishing
+      for(int i=0;i<degree;i++)roots_robust[i]=roots[i];
+
+      // set flag, that roots have been resorted
+      first_3_roots_order_changed=true;
+    }  // go_to_robust>0
+
+    // POLISH
+    // (we know the roots approximately, and we guess that last two are closest)
+    //---------------------
+    for(int i=0;i<=degree;i++)poly2[i]=poly[i]; // copy coeffs
+
+    for(int m=0;m<degree-2;m++){
+      // polish roots with full polynomial
+      cmplx_newton_spec(poly2, degree, roots[m], iter, succ);
+      if(!succ){
+	// go back to robust
+	go_to_robust++;
+	for(int i=0;i<degree;i++)roots[i]=zero;
+	break;
+      }
+    }
+
+    if(succ){
+      for(int m=0;m<degree-2;m++)
+	divide_poly_1(poly2, remainder, roots[m], poly2, degree-m);
+      // last two roots are found with quadratic equation solver
+      // (this is faster and more robust, although little less accurate)
+      solve_quadratic_eq(roots[degree-2], roots[degree-1], poly2);
+      // all roots found and polished
+
+      // TEST ORDER
+      // test closest roots if they are the same pair as given to polish
+      find_2_closest_from_5(root4, root5, d2min, roots);
+
+      if(root4<degree-2 or root5<degree-2){
+	// after polishing some of the 3 far roots become one of the 2 closest ones
+	// go back to robust
+	if(go_to_robust>0){
+	  // if came from robust
+	  // copy two most isolated roots as starting points for new robust
+	  for(int i=0;i<degree-3;i++)roots[degree-1-i]=roots_robust[i];
+	} else {
+	  // came from users initial guess
+	  // copy some 2 roots (except the closest ones)
+	  int i2=degree-1;
+	  for(int i=0;i<degree;i++){
+	    if(i!=root4 and i!=root5){
+	      roots[i2]=roots[i];
+	      i2--;
+	    }
+	    if(i2<=2)break; // do not copy those that will be done by cubic in robust
+	  }
+	}
+	go_to_robust++;
+      } else {
+	// root4 and root5 comes from the initial closest pair
+	// most common case
+	return;
+      }
+    }
+  } // loops
+};
+
+#endif
@@ -0,0 +1,107 @@
+//Dormand-Prince 5(4) Runge-Kutta integrator with fixed-size state
+//
+//This replaces the GSL odeiv2 rkf45 integrator in the integration mode of GLens::compute_trajectory.
+//The state is held in fixed-size arrays (at most N components, only the first n of which are
+//integrated) and the derivative is a template functor, so that it can be inlined into the stepper.
+//The step-size control and the step interface mimic gsl_odeiv2_control_y_new(eps_abs,0) with
+//gsl_odeiv2_evolve_apply, so the former tolerance settings carry over unchanged.
+
+#ifndef DORMAND_PRINCE_HH
+#define DORMAND_PRINCE_HH
+#include <cmath>
+#include <algorithm>
+
+template<int N> class DormandPrince {
+  double eps_abs;
+  double h_min;  //least step size before a step is deemed to have failed
+  int n;
+  bool have_k1;  //k1 holds the derivative at the start of the next step (first same as last)
+  double k1[N];
+  ///Step-size adjustment, as gsl_odeiv2_control_y_new: returns -1 if the step must be retried with smaller h.
+  int adjust_h(const double yerr[],double &h)const{
+    const double S=0.9;
+    const int ord=5;
+    double rmax=0;
+    for(int k=0;k<n;k++)rmax=std::max(rmax,std::fabs(yerr[k])/eps_abs);
+    if(rmax>1.1){
+      double r=S/std::pow(rmax,1.0/ord);
+      if(r<0.2)r=0.2;
+      h*=r;
+      return -1;
+    } else if(rmax<0.5){
+      double r=S/std::pow(rmax,1.0/(ord+1.0));
+      if(r>5)r=5;
+      if(r<1)r=1;
+      h*=r;
+      return 1;
+    }
+    return 0;
+  };
+public:
+  DormandPrince(double eps_abs=1e-10,double h_min=0):eps_abs(eps_abs),h_min(h_min),n(N),have_k1(false){};
+  void set_tol(double tol){eps_abs=tol;};
+  void set_hmin(double hmin){h_min=hmin;};
+  ///Call this when the state is set afresh, rather than carried from the last step.
+  void reset(){have_k1=false;};
+  ///Take one successful step from t toward t1, as gsl_odeiv2_evolve_apply.
+  ///
+  ///The function f(t,y,dydt) must return true on success.  On return t and y are advanced, and h is
+  ///the suggested next step.  The step is limited to land on t1.  Returns false if f failed, or if the step
+  ///size needed to meet the tolerance falls below h_min or no longer advances t (as where the solution runs
+  ///onto a singularity), in which case t and y are unchanged.  Unlike gsl_odeiv2_evolve_apply, which then
+  ///accepts the last step, we leave the caller to fall back on another method.
+  template<class F> bool evolve(F &f, int nvar, double &t, double t1, double &h, double y[]){
+    //Butcher tableau
+    const double c2=1/5.0, c3=3/10.0, c4=4/5.0, c5=8/9.0;
+    const double a21=1/5.0;
+    const double a31=3/40.0, a32=9/40.0;
+    const double a41=44/45.0, a42=-56/15.0, a43=32/9.0;
+    const double a51=19372/6561.0, a52=-25360/2187.0, a53=64448/6561.0, a54=-212/729.0;
+    const double a61=9017/3168.0, a62=-355/33.0, a63=46732/5247.0, a64=49/176.0, a65=-5103/18656.0;
+    const double b1=35/384.0, b3=500/1113.0, b4=125/192.0, b5=-2187/6784.0, b6=11/84.0;
+    //differences between the 5th and 4th order weights
+    const double e1=71/57600.0, e3=-71/16695.0, e4=71/1920.0, e5=-17253/339200.0, e6=22/525.0, e7=-1/40.0;
+    if(nvar!=n){n=nvar;have_k1=false;}
+    double k2[N],k3[N],k4[N],k5[N],k6[N],k7[N],ytmp[N],ynew[N],yerr[N];
+    if(not have_k1){
+      if(not f(t,y,k1))return false;
+      have_k1=true;
+    }
+    const double t0=t,dt=t1-t0;
+    while(true){
+      double h0=h;
+      bool final_step=false;
+      if(h0>dt){h0=dt;final_step=true;}
+      if(not final_step and (h0<h_min or t0+h0==t0))return false;
+      for(int k=0;k<n;k++)ytmp[k]=y[k]+h0*a21*k1[k];
+      if(not f(t0+c2*h0,ytmp,k2))return false;
+      for(int k=0;k<n;k++)ytmp[k]=y[k]+h0*(a31*k1[k]+a32*k2[k]);
+      if(not f(t0+c3*h0,ytmp,k3))return false;
+      for(int k=0;k<n;k++)ytmp[k]=y[k]+h0*(a41*k1[k]+a42*k2[k]+a43*k3[k]);
+      if(not f(t0+c4*h0,ytmp,k4))return false;
+      for(int k=0;k<n;k++)ytmp[k]=y[k]+h0*(a51*k1[k]+a52*k2[k]+a53*k3[k]+a54*k4[k]);
+      if(not f(t0+c5*h0,ytmp,k5))return false;
+      for(int k=0;k<n;k++)ytmp[k]=y[k]+h0*(a61*k1[k]+a62*k2[k]+a63*k3[k]+a64*k4[k]+a65*k5[k]);
+      if(not f(t0+h0,ytmp,k6))return false;
+      for(int k=0;k<n;k++)ynew[k]=y[k]+h0*(b1*k1[k]+b3*k3[k]+b4*k4[k]+b5*k5[k]+b6*k6[k]);
+      if(not f(t0+h0,ynew,k7))return false;
+      for(int k=0;k<n;k++)yerr[k]=h0*(e1*k1[k]+e3*k3[k]+e4*k4[k]+e5*k5[k]+e6*k6[k]+e7*k7[k]);
+      double h_old=h0;
+      if(adjust_h(yerr,h0)<0 and h0<h_old){
+	//reject and retry with the reduced step, if that still makes progress
+	h=h0;
+	if(h0<h_min or t0+h0==t0)return false;
+	continue;
+      }
+      t=(final_step?t1:t0+h_old);
+      h=h0;
+      for(int k=0;k<n;k++){
+	y[k]=ynew[k];
+	k1[k]=k7[k];
+      }
+      return true;
+    }
+  };
+};
+
+#endif
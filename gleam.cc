@@ -335,6 +335,7 @@ int main(int argc, char*argv[]){
       lens->verboseWrite();
       lens->writeMagMap(out, pstart, pend, mm_samples);
     }
+    cout<<GLensBinary::precision_report()<<endl;
     exit(0);
   }    
 
@@ -388,6 +389,7 @@ int main(int argc, char*argv[]){
   
   //Dump summary info
   cout<<"best_post "<<like->bestPost()<<", state="<<like->bestState().get_string()<<endl;
+  cout<<GLensBinary::precision_report()<<endl;
 }
 
 //An analysis function defined below.
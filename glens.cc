@@ -3,17 +3,15 @@
 
 #include "glens.hh"
 #include <gsl/gsl_poly.h>
-#include <gsl/gsl_odeiv2.h>
 #include <gsl/gsl_errno.h>
 #include <cmath>
 #include <algorithm>
 #include <complex>
+#include <type_traits>
+#include <queue>
+#include <cstdint>
 #include "omp.h"
-#ifdef USE_KIND_16
-#include <quadmath.h>
-#else
-#define __float128 long double
-#endif
+#include "cmplx_roots_sg.hh"
 
 const bool fix_nr4_roots=true;
 const bool inv_test_mode=false;
@@ -26,62 +24,70 @@ bool save_thetas_poly=true;
 //bool save_thetas_wide=true;  Strangely, this seems to provide no advantage.  Maybe a bug, but didn't see it. 
 bool save_thetas_wide=false; 
 //
-// Interface to external Skowron&Gould fortran polynomial solver routine
+// Interface to Skowron&Gould polynomial solver routines (templated C++ port in cmplx_roots_sg.hh)
 //
 
 #ifndef USE_KIND_16
 
-extern "C" void cmplx_roots_5_(complex<double> roots[5], int &first_3_roots_order_changed, complex<double> poly[6], const int &polish_only);
-void cmplx_roots_5(complex<double> roots[5], bool &first_3_roots_order_changed, complex<double> poly[6], const bool &polish_only){
-  int first3=first_3_roots_order_changed;
-  cmplx_roots_5_(roots, first3, poly, polish_only);
-  first_3_roots_order_changed=first3;
-};
-extern "C" void cmplx_roots_gen_(complex<double> roots[], complex<double> poly[], const int &degree, const int &polish_roots_after, const int &use_roots_as_starting_points);
-void cmplx_roots_gen(complex<double> roots[], complex<double> poly[], const int &degree, bool const &polish_roots_after, const bool &use_roots_as_starting_points){cmplx_roots_gen_(roots,poly,degree,polish_roots_after,use_roots_as_starting_points);};
 typedef  long double ldouble;
+///Precision of GLensBinary::map.  Double avoids the x87 unit, and is accurate enough for the map tests.
+typedef double map_real;
 const double LEADTOL=1e-5;
 //const double LEADTOL=1e-4;
 //const double epsTOL=1e-15;
 const double epsTOL=1e-14;
 //const double epsTOL=1e-11;
+///Precision level (see WittMao_solve) for the first solve of each point.
+const int WittMao_base_precision=0;
+///Use the perturbative planetary inversion (GLensBinary::invmapPlanetary) for q<qPlanet.
+const bool planetary_inversion=true;
 
 #else
 
-extern "C" void cmplx_roots_5_(complex<__float128> roots[5], int &first_3_roots_order_changed, complex<__float128> poly[6], const int &polish_only);
-void cmplx_roots_5(complex<double> roots[5], bool &first_3_roots_order_changed, complex<double> poly[6], const bool &polish_only){
-  int first3=first_3_roots_order_changed;
-  complex<__float128>longroots[5],longpoly[6];
-  for(int i=0;i<6;i++)longpoly[i]=poly[i];
-  if(!polish_only)for(int i=0;i<5;i++)longroots[i]=roots[i];
-  //cout<<sizeof(longpoly)<<endl;
-  cmplx_roots_5_(longroots, first3, longpoly, polish_only);
-  for(int i=0;i<5;i++)roots[i]=longroots[i];  
-  first_3_roots_order_changed=first3;
-};
-extern "C" void cmplx_roots_gen_(complex<__float128> roots[], complex<__float128> poly[], const int &degree, const int &polish_roots_after, const int &use_roots_as_starting_points);
-void cmplx_roots_gen(complex<double> roots[], complex<double> poly[], const int &degree, const bool &polish_roots_after, const bool &use_roots_as_starting_points){
-  complex<__float128>longroots[5],longpoly[6];
-  for(int i=0;i<degree+1;i++)longpoly[i]=poly[i];
-  /*char c[128];
-  for(int i=0;i<degree+1;i++){
-    quadmath_snprintf (c, sizeof c, "%-#*.35Qe", 46, longpoly[i]);  
-    cout<<"poly["<<i<<"]="<<c<<endl;  
-    }*/
-  if(use_roots_as_starting_points)for(int i=0;i<degree;i++)longroots[i]=roots[i];
-  //cout<<sizeof(longpoly)<<endl;
-  int deg=degree;
-  cmplx_roots_gen_(longroots,longpoly,deg,polish_roots_after,use_roots_as_starting_points);
-  for(int i=0;i<degree;i++)roots[i]=longroots[i];  
-};
+//With USE_KIND_16 every solve is done in quad precision, which serves as a reference for the default build.
 typedef __float128 ldouble;
+typedef ldouble map_real;
 const double LEADTOL=3e-7;
 //const double LEADTOL=1e-5;
 const double epsTOL=1e-18;
 //const double epsTOL=1e-14;
+const int WittMao_base_precision=2;
+//The quad build solves the polynomial throughout, as a reference for the planetary inversion.
+const bool planetary_inversion=false;
 #endif
 
+///Least integration step (in frame time) for image and root integration.  Where the step control asks for
+///less, the images are running onto a caustic, and we switch to the polynomial.
+const double GL_int_hmin=1e-12;
+///Allow re-solving the polynomial at higher precision when the image set is inconsistent.
+const bool escalate_precision=true;
+///Also re-solve when some root's squared map residual is within this factor of the tolerance.
+const double WittMao_min_confidence=10;
+#ifdef CMPLX_ROOTS_SG_FLOAT128
+const int WittMao_max_precision=2;
+#else
+const int WittMao_max_precision=1;
+#endif
 
+///Solve the Witt-Mao polynomial with the working precision given by level prec (0=double, 1=long double,
+///2=__float128).  Coefficients and roots are passed in double.  If polish_only then the roots on input are
+///the starting points for polishing (only for nroots==5).
+template<typename T> static void WittMao_solve_T(complex<double> roots[], const complex<double> c[], int nroots, bool polish_only){
+  complex<T> lroots[5],lpoly[6];
+  for(int i=0;i<=nroots;i++)lpoly[i]=complex<T>(real(c[i]),imag(c[i]));
+  if(polish_only)for(int i=0;i<nroots;i++)lroots[i]=complex<T>(real(roots[i]),imag(roots[i]));
+  bool roots_changed=true;
+  if(nroots==5)cmplx_roots_5<T>(lroots, roots_changed, lpoly, polish_only);
+  else cmplx_roots_gen<T>(lroots, lpoly, nroots, true, false);
+  for(int i=0;i<nroots;i++)roots[i]=complex<double>(real(lroots[i]),imag(lroots[i]));
+};
+static void WittMao_solve(int prec, complex<double> roots[], const complex<double> c[], int nroots, bool polish_only){
+  if(prec==0)WittMao_solve_T<double>(roots, c, nroots, polish_only);
+#ifdef CMPLX_ROOTS_SG_FLOAT128
+  else if(prec==2)WittMao_solve_T<__float128>(roots, c, nroots, polish_only);
+#endif
+  else WittMao_solve_T<long double>(roots, c, nroots, polish_only);
+};
 
 //
 // ******************************************************************
@@ -110,22 +116,247 @@ void GLens::inv_map_curve(const vector<Point> &curve, vector<vector<Point> > &cu
   curve_images.clear();
   curve_mags.clear();
 
-  //Main loop over curve
+  //Invert all the curve points in one batch
   int Ngrid=curve.size();
+  vector<double> bx(Ngrid),by(Ngrid),img_x,img_y;
+  vector<int> img_offset;
+  for(int i=0; i<Ngrid;i++){
+    bx[i]=curve[i].x;
+    by[i]=curve[i].y;
+  }
+  invmap_batch(bx.data(),by.data(),Ngrid,img_offset,img_x,img_y);
+
+  //Main loop over curve
   for(int i=0; i<Ngrid;i++){
-    Point beta=curve[i];
     vector<Point> thetas;
-    //cout<<"curve: beta=("<<beta.x<<","<<beta.y<<")"<<endl;
-    thetas.clear();
-    thetas=invmap(beta);
+    vector<double> mags;
+    for(int k=img_offset[i];k<img_offset[i+1];k++){
+      Point th(img_x[k],img_y[k]);
+      thetas.push_back(th);
+      mags.push_back(mag(th));
+    }
     //record results;
     curve_images.push_back(thetas);
-    vector<double> mags;
-    for(Point th:thetas)mags.push_back(mag(th));
     curve_mags.push_back(mags);
   }
 }
 
+///Batched inverse lens map.
+///This generic version just applies invmap to each point in turn; see the GLens class definition for the output layout.
+void GLens::invmap_batch(const double *bx, const double *by, size_t n, vector<int> &img_offset, vector<double> &img_x, vector<double> &img_y){
+  img_offset.resize(n+1);
+  img_x.clear();
+  img_y.clear();
+  img_offset[0]=0;
+  for(size_t i=0;i<n;i++){
+    Images thetas=invmap(Point(bx[i],by[i]));
+    for(const Point &th : thetas){
+      img_x.push_back(th.x);
+      img_y.push_back(th.y);
+    }
+    img_offset[i+1]=img_x.size();
+  }
+};
+
+///Newton continuation of a set of images.
+///Each image is refined by Newton steps on the lens equation map(theta)=p using the inverse Jacobian.
+///The first step from the old image is effectively the linear extrapolation dtheta = invjac*dbeta.
+///We give up (returning false) if any image fails to converge quickly, comes too close to a critical
+///curve, changes parity, or merges with another image.  Creation of new images is not detected here;
+///lens-specific versions should check for that.
+bool GLens::newton_track_images(const Point &p, Images &thetas){
+  const int maxIter=8;
+  const double tol=1e-13;
+  const double mumax=1e4;
+  int ni=thetas.size();
+  if(ni<NimageMin)return false;
+  for(int k=0;k<ni;k++){
+    Point th=thetas[k];
+    double ij00,ij01,ij10,ij11;
+    double mu0=invjac(th,ij00,ij01,ij10,ij11),mu=mu0;
+    if(!(abs(mu0)<mumax))return false;
+    bool converged=false;
+    for(int iter=0;iter<maxIter;iter++){
+      Point db=map(th)-p;
+      Point dth(ij00*db.x+ij01*db.y,ij10*db.x+ij11*db.y);
+      th=th-dth;
+      mu=invjac(th,ij00,ij01,ij10,ij11);
+      if(dth.x*dth.x+dth.y*dth.y<tol*tol*(1+th.x*th.x+th.y*th.y)){
+	converged=true;
+	break;
+      }
+    }
+    if(!converged)return false;
+    if(!(abs(mu)<mumax) or mu*mu0<=0)return false;
+    thetas[k]=th;
+  }
+  for(int k=0;k<ni;k++)for(int j=k+1;j<ni;j++){
+      Point d=thetas[k]-thetas[j];
+      if(d.x*d.x+d.y*d.y<dThTol*dThTol)return false;
+  }
+  return true;
+};
+
+///Images of beta, tracked by Newton iteration from the seed images (eg those of the matching vertex of a concentric
+///source polygon) where newton_track_images accepts the result, otherwise from invmap.
+Images GLens::seeded_invmap(const Point &beta, const vector<Point> *seed){
+  if(seed and seed->size()<=Images::capacity){
+    Images thetas;
+    for(const Point &th : *seed)thetas.push_back(th);
+    if(newton_track_images(beta,thetas))return thetas;
+  }
+  return invmap(beta);
+};
+
+///The critical curve of a point lens is the Einstein ring, and its caustic is the point at the origin.
+void GLens::find_critical_curves(int n){
+  critical_curves.assign(1,vector<Point>(n));
+  for(int i=0;i<n;i++)critical_curves[0][i]=Point(cos(2*M_PI*i/n),sin(2*M_PI*i/n));
+};
+
+const vector<vector<Point> > &GLens::compute_critical_curves(int n){
+  array<double,2> key=caustic_state();
+  if(n!=caustics_nsamp or key!=caustics_key){
+    find_critical_curves(n);
+    caustic_curves.clear();
+    caustic_bboxes.clear();
+    for(const vector<Point> &curve : critical_curves){
+      int nc=curve.size();
+      vector<Point> caustic;
+      caustic.reserve(nc);
+      for(const Point &th : curve)caustic.push_back(map(th));
+      vector<array<double,4> > bboxes;
+      for(int k0=0;k0<nc;k0+=caustic_block_size){
+	array<double,4> bbox={{INFINITY,-INFINITY,INFINITY,-INFINITY}};
+	for(int k=k0;k<=k0+caustic_block_size and k<=nc;k++){
+	  const Point &c=caustic[k%nc];
+	  bbox={{min(bbox[0],c.x),max(bbox[1],c.x),min(bbox[2],c.y),max(bbox[3],c.y)}};
+	}
+	bboxes.push_back(bbox);
+      }
+      caustic_curves.push_back(caustic);
+      caustic_bboxes.push_back(bboxes);
+    }
+    caustics_nsamp=n;
+    caustics_key=key;
+  }
+  return critical_curves;
+};
+
+const vector<vector<Point> > &GLens::compute_caustics(int n){
+  compute_critical_curves(n);
+  return caustic_curves;
+};
+
+double GLens::caustic_distance(const Point &p,int n){
+  double d2min=INFINITY;
+  for(const vector<Point> &caustic : compute_caustics(n)){
+    int nc=caustic.size();
+    for(int i=0;i<nc;i++){
+      //distance to the segment from caustic[i] to the next vertex
+      Point a=caustic[i],ab=caustic[(i+1)%nc]-a,ap=p-a;
+      double ab2=ab.x*ab.x+ab.y*ab.y,t=0;
+      if(ab2>0)t=min(1.0,max(0.0,(ap.x*ab.x+ap.y*ab.y)/ab2));
+      Point d=ap-ab*t;
+      d2min=min(d2min,d.x*d.x+d.y*d.y);
+    }
+  }
+  return sqrt(d2min);
+};
+
+///Each caustic crossing creates or destroys a pair of images, so inside a caustic (with winding number +/-1)
+///there are two more images than outside.
+int GLens::caustic_image_count(const Point &p,int n){
+  int nimg=NimageMin;
+  for(const vector<Point> &caustic : compute_caustics(n))nimg+=2*abs(pointInPolygon(p,caustic));
+  return min(nimg,NimageMax);
+};
+
+///The bounding boxes of the blocks of caustic edges cover the caustics, including the bits where the polygon
+///cuts corners, so outside them the winding number test is reliable.  Outside the bounding box of the whole
+///caustic we can skip that test.
+bool GLens::caustic_inside_test(const Point &p,int n){
+  const vector<vector<Point> > &caustics=compute_caustics(n);
+  for(int j=0,nj=caustics.size();j<nj;j++){
+    double xmin=INFINITY,xmax=-INFINITY,ymin=INFINITY,ymax=-INFINITY;
+    for(const array<double,4> &bbox : caustic_bboxes[j]){
+      if(p.x>=bbox[0] and p.x<=bbox[1] and p.y>=bbox[2] and p.y<=bbox[3])return true;
+      xmin=min(xmin,bbox[0]);
+      xmax=max(xmax,bbox[1]);
+      ymin=min(ymin,bbox[2]);
+      ymax=max(ymax,bbox[3]);
+    }
+    if(p.x>=xmin and p.x<=xmax and p.y>=ymin and p.y<=ymax and pointInPolygon(p,caustics[j])!=0)return true;
+  }
+  return false;
+};
+
+///Crossings are bracketed by intersecting the chords between successive trajectory samples with the caustic
+///polygons, and then refined by bisection on the image count.  Where a chord crosses caustics more than once,
+///each crossing is bracketed separately, between the midpoints of neighboring intersections.
+void GLens::find_caustic_crossings(const Trajectory &traj, vector<double> &crossing_times, int n){
+  crossing_times.clear();
+  int Ngrid=traj.Nsamples();
+  if(Ngrid<2)return;
+  vector<double> us,ts(Ngrid),bx(Ngrid),by(Ngrid);
+  for(int i=0;i<Ngrid;i++)ts[i]=traj.get_obs_time(i);
+  get_obs_pos_batch(traj,ts.data(),Ngrid,bx.data(),by.data());
+  double t0=ts[0];
+  Point b0(bx[0],by[0]);
+  for(int i=1;i<Ngrid;i++){
+    double t1=ts[i];
+    if(t1<=t0)continue;
+    set_time_dependent_values(t1);
+    Point b1(bx[i],by[i]),db=b1-b0;
+    us.clear();
+    const vector<vector<Point> > &caustics=compute_caustics(n);
+    for(int j=0,nj=caustics.size();j<nj;j++){
+      const vector<Point> &caustic=caustics[j];
+      int nc=caustic.size();
+      for(int ib=0,nb=caustic_bboxes[j].size();ib<nb;ib++){
+	const array<double,4> &bbox=caustic_bboxes[j][ib];
+	if(max(b0.x,b1.x)<bbox[0] or min(b0.x,b1.x)>bbox[1] or max(b0.y,b1.y)<bbox[2] or min(b0.y,b1.y)>bbox[3])continue;
+	for(int k=ib*caustic_block_size;k<(ib+1)*caustic_block_size and k<nc;k++){
+	  //Solve b0+u*db = c0+s*dc, counting each vertex with only one of its edges
+	  Point c0=caustic[k],dc=caustic[(k+1)%nc]-c0,d=c0-b0;
+	  double den=db.x*dc.y-db.y*dc.x;
+	  if(den==0)continue;
+	  double u=(d.x*dc.y-d.y*dc.x)/den,s=(d.x*db.y-d.y*db.x)/den;
+	  if(u>0 and u<=1 and s>=0 and s<1)us.push_back(u);
+	}
+      }
+    }
+    sort(us.begin(),us.end());
+    int nu=us.size();
+    for(int k=0;k<nu;k++){
+      double ua=(k==0?0:(us[k-1]+us[k])/2),ub=(k==nu-1?1:(us[k]+us[k+1])/2);
+      crossing_times.push_back(refine_caustic_crossing(traj,t0+ua*(t1-t0),t0+ub*(t1-t0),t0+us[k]*(t1-t0),n));
+    }
+    t0=t1;
+    b0=b1;
+  }
+  unset_time_dependent_values();
+};
+
+///Bisect for the time in [ta,tb] where the image count changes.  If it doesn't (e.g. at a grazing chord) we
+///return the guess from the chord intersection.
+double GLens::refine_caustic_crossing(const Trajectory &traj, double ta, double tb, double tguess, int n){
+  const int maxIter=60;
+  const double ttol=1e-12;
+  set_time_dependent_values(ta);
+  int na=caustic_image_count(get_obs_pos(traj,ta),n);
+  set_time_dependent_values(tb);
+  int nb=caustic_image_count(get_obs_pos(traj,tb),n);
+  if(na==nb)return tguess;
+  for(int iter=0;iter<maxIter and tb-ta>ttol*(1+abs(ta));iter++){
+    double tm=(ta+tb)/2;
+    set_time_dependent_values(tm);
+    if(caustic_image_count(get_obs_pos(traj,tm),n)==na)ta=tm;
+    else tb=tm;
+  }
+  return (ta+tb)/2;
+};
+
 //Use GSL routine to integrate polygon trajectory
 //just a sketch...
 /*void GLens::integrate_invmap_curve (const vector<Point> &curve, vector<vector<Point> > &curve_images, vector<vector<double>> &curve_mags)
@@ -296,7 +527,7 @@ bool jointOrder(const joint &j1, const joint &j2) {
 ///Presently, this is simply the varance of the point-magnifications around the polygon
 ///wrt the area magnification.
 ///
-void GLens::image_area_mag(Point &p, double radius, int & N, double &magnification, double &var, ostream *out,vector<vector<Point> > *outcurves){
+void GLens::image_area_mag(Point &p, double radius, int & N, double &magnification, double &var, ostream *out,vector<vector<Point> > *outcurves, PolygonVertexCache *vcache){
   ///p      : input  -observer position, relative source center
   ///       : output -returns centroid shift
   ///radius : input  -source radius
@@ -306,6 +537,8 @@ void GLens::image_area_mag(Point &p, double radius, int & N, double &magnificati
   ///var    : output estimated variance result
   ///out    : input  : optional output stream for dumping curve results
   ///outcurves: output: optional return of the computed closed curve set.
+  ///vcache : in/out : optional vertex images from an earlier pass at this epoch, which are reused where the vertices
+  ///                  coincide, or tracked from for a concentric polygon, and replaced with this pass's vertices.
   //save these for debugging reference 
   require_time_dependent_values();
   Point p0=p;
@@ -345,8 +578,12 @@ void GLens::image_area_mag(Point &p, double radius, int & N, double &magnificati
   
   //Construct polygon
   double dphi=twopi/N;
+  int stride=vcache?vcache->stride(p,radius,N):0;
   vector<Point> curve(N);
-  for(int i=0;i<N;i++)curve[i]=Point(p.x+radius*cos(dphi*i),p.y+radius*sin(dphi*i));
+  for(int i=0;i<N;i++){
+    if(stride>0 and i%stride==0)curve[i]=vcache->curve[i/stride];
+    else curve[i]=Point(p.x+radius*cos(dphi*i),p.y+radius*sin(dphi*i));
+  }
   
   //Get image points and mags
   vector<vector<Point> >  image_points;
@@ -358,11 +595,22 @@ void GLens::image_area_mag(Point &p, double radius, int & N, double &magnificati
   ///This will be the most computationally intensive step unless we need to do a lot of refinement near caustics. For each source polygon vertex we compute a set of image points.
   ///
   ///Then (unless fix_vertex_image==false) we check for errors in the image set and try to fix them. In particular, if there are fewer than NimageMin (eg 3 for binarly lens) image points, then we try to recover one.  We are most likely to have missed a negative parity image point which is extremely close to one of the lens centers.  If so, the sum of parities will be zero.  If it is, then we determine which lens center is farthest from any of the image points, and add one there. (How often does this occur?)
+  ///
+  ///Vertices already treated in an earlier pass (see PolygonVertexCache) are taken from the cache as they were recorded.
+  ///If the cache is from a concentric polygon of another radius, its vertex images are instead the starting points for
+  ///Newton tracking of the images here (see seeded_invmap).
   for(int i=0; i<N;i++){
+    if(stride>0 and i%stride==0){
+      int ic=i/stride;
+      image_points.push_back(vcache->image_points[ic]);
+      image_point_mags.push_back(vcache->image_point_mags[ic]);
+      vertex_mags.push_back(vcache->vertex_mags[ic]);
+      continue;
+    }
     Point beta=curve[i];
-    vector<Point> thetas;
+    Images thetas;
     thetas.clear();
-    thetas=invmap(beta);
+    thetas=seeded_invmap(beta,vcache?vcache->seed(p,radius,dphi*i):NULL);
     vector<double> mags;
     for(Point th:thetas)mags.push_back(mag(th));
     double total_mg=0;
@@ -411,6 +659,15 @@ void GLens::image_area_mag(Point &p, double radius, int & N, double &magnificati
     image_point_mags.push_back(mags);
     vertex_mags.push_back(total_mg);
   }
+  if(vcache){//Step 3 inserts refinement points off the limb, so we save the vertices now
+    vcache->p=p;
+    vcache->radius=radius;
+    vcache->N=N;
+    vcache->curve=curve;
+    vcache->image_points=image_points;
+    vcache->image_point_mags=image_point_mags;
+    vcache->vertex_mags=vertex_mags;
+  }
   /*
   cout<<"first pass image points:"<<endl;
   for(int j=0;j<N;j++){
@@ -859,7 +1116,7 @@ void GLens::image_area_mag(Point &p, double radius, int & N, double &magnificati
 	  pnew=p+Point(cos(phinew),sin(phinew))*radius;
 	} else pnew = p0 + dp * ((k+1.0)/factor);
 	new_curve_points.push_back(pnew);
-	vector<Point> thetas=invmap(pnew);
+	Images thetas=invmap(pnew);
 	new_image_points.push_back(thetas);
 	vector<double> mags;
 	for(Point th:thetas)mags.push_back(mag(th));
@@ -1261,6 +1518,337 @@ void GLens::image_area_mag(Point &p, double radius, int & N, double &magnificati
 }
 
 
+///Limb sample for contour_area_mag: images of one source-limb point, with their parities and the image-curve
+///tangents dz/dphi.
+struct contour_sample {
+  double phi;
+  double absmu;
+  Point beta;
+  vector<Point> z,dz;
+  vector<double> mu;
+  vector<int> par;
+};
+
+static inline double cross_product(const Point &a, const Point &b){return a.x*b.y-a.y*b.x;}
+
+///Adaptive contour integration finite size magnification
+///
+///The image area is the parity-weighted sum over images of the contour integral (1/2)z x dz along the image of the
+///source limb.  We sample the limb at angles phi and, for each sample, keep the images together with their image-curve
+///tangents dz/dphi=J^-1 dbeta/dphi.  Between neighbouring samples each image curve is taken as the cubic Hermite curve
+///through the end points and tangents.  The difference between that correction to the chord and the parabolic
+///correction estimates the error of the segment.  Segments are bisected, largest error first, until the summed
+///error is below finite_source_tol times the image area.  Solved samples are kept, so each refinement costs one
+///inversion.  Image pairs created or annihilated within a segment are joined through the caustic crossing using the
+///local fold form of the image curves.  Epochs where the target cannot be met are reported to the caller, which falls
+///back on image_area_mag.
+///
+///As in image_area_mag, a vertex cache from a concentric pass provides seed images for the limb samples, and the
+///initial samples are saved to it for later passes.
+bool GLens::contour_area_mag(Point &p, double radius, int & N, double &magnification, double &var, PolygonVertexCache *vcache){
+  ///p      : input  -observer position, relative source center
+  ///       : output -returns centroid shift
+  ///radius : input  -source radius
+  ///N      : input  -Number of initial limb samples
+  ///       : output -Number of sampled points
+  ///magnification   : output magnification result
+  ///var    : output estimated variance result
+  ///vcache : in/out : optional vertex images from an earlier pass at this epoch
+  ///returns false if the error target was not met, in which case the results are only indicative
+  require_time_dependent_values();
+  const double twopi=2*M_PI;
+  const Point p0=p;
+
+  ///Controls
+  const int N0=max(N,8);
+  const double refine_limit=fmax(finite_source_refine_limit,1.0);
+  const int Nmax=max(N0,(int)(finite_source_Npoly_max*refine_limit));
+  const double hmin=twopi/Nmax/refine_limit;
+  const int nretry=3;
+  const double mismatch_err=M_PI*radius*radius;//Error charged to segments whose image sets cannot be joined.
+  int Nsolve=0;
+
+  //Solve for the images of the limb point at phi, fixing a missing image as in image_area_mag.
+  //Returns false if the image set fails the same sanity checks.
+  auto solve=[&](double phi, contour_sample &s)->bool{
+    Nsolve++;
+    s.phi=phi;
+    s.absmu=0;
+    s.z.clear();s.dz.clear();s.mu.clear();s.par.clear();
+    double c=cos(phi),sn=sin(phi);
+    Point beta(p.x+radius*c,p.y+radius*sn);
+    Point dbeta(-radius*sn,radius*c);
+    s.beta=beta;
+    Images thetas=seeded_invmap(beta,vcache?vcache->seed(p,radius,phi):NULL);
+    int netp=0;
+    for(Point th:thetas){
+      double j00,j01,j10,j11;
+      double mu=invjac(th,j00,j01,j10,j11);
+      int par=copysign(1.0,mu);
+      if(mu==0)par=-1;
+      netp+=par;
+      s.absmu+=abs(mu);
+      s.z.push_back(th);
+      s.dz.push_back(Point(j00*dbeta.x+j01*dbeta.y,j10*dbeta.x+j11*dbeta.y));
+      s.mu.push_back(mu);
+      s.par.push_back(par);
+    }
+    int ni=s.z.size();
+    if(NimageMin==ni+1 and netp==0){//Seem to be missing a negative parity image very near a lens center
+      int kmiss=-1;
+      double rknormfar=-1;
+      for(int k=1;k<NimageMin;k++){
+	Point ck=traj2lens(getCenter(k));
+	double rknormmin=INFINITY;
+	for(int j=0;j<ni;j++)if(s.par[j]<0){
+	  Point rk=s.z[j]-ck;
+	  rknormmin=fmin(rknormmin,rk.x*rk.x+rk.y*rk.y);
+	}
+	if(rknormfar<rknormmin){
+	  rknormfar=rknormmin;
+	  kmiss=k;
+	}
+      }
+      s.z.push_back(traj2lens(getCenter(kmiss)));
+      s.dz.push_back(Point(0,0));
+      s.mu.push_back(-1e-100);
+      s.par.push_back(-1);
+      netp--;
+      ni++;
+    }
+    return ni>=NimageMin && ni<=NimageMax && (ni-NimageMin)%2==0 && -netp==NimageMin%2;
+  };
+
+  //Contribution of the limb segment from sample a to sample b, spanning angle h, to the area and its first moment.
+  //Returns the error estimate for the segment.
+  auto segment=[&](const contour_sample &a, const contour_sample &b, double h, double &dA, Point &dM)->double{
+    double err=0;
+    dA=0;
+    dM=Point(0,0);
+    auto edge=[&](const Point &u, const Point &v, double w){
+      double c=w*cross_product(u,v);
+      dA+=0.5*c;
+      dM=dM+(u+v)*(c/6.0);
+    };
+    for(int par=-1;par<=1;par+=2){
+      vector<int>ia,ib;
+      for(size_t j=0;j<a.z.size();j++)if(a.par[j]==par)ia.push_back(j);
+      for(size_t j=0;j<b.z.size();j++)if(b.par[j]==par)ib.push_back(j);
+      //Join same-parity images greedily, closest pairs first
+      while(ia.size()>0 and ib.size()>0){
+	int ma=0,mb=0;
+	double d2min=INFINITY;
+	for(size_t u=0;u<ia.size();u++)for(size_t v=0;v<ib.size();v++){
+	    Point d=b.z[ib[v]]-a.z[ia[u]];
+	    double d2=d.x*d.x+d.y*d.y;
+	    if(d2<d2min){d2min=d2;ma=u;mb=v;}
+	  }
+	const Point &za=a.z[ia[ma]],&zb=b.z[ib[mb]];
+	Point ta=a.dz[ia[ma]]*(h/3.0),tb=b.dz[ib[mb]]*(h/3.0);
+	edge(za,zb,par);
+	//Area between the chord and the Hermite (Bezier) curve, and its parabolic approximation
+	Point Q1=ta,Q3=zb-za,Q2=Q3-tb;
+	double dH=(3*cross_product(Q1,Q2)+3*cross_product(Q1,Q3)+6*cross_product(Q2,Q3))/20.0;
+	double dP=0.75*cross_product(ta,tb);
+	dA+=par*dH;
+	dM=dM+(za+zb)*(0.5*par*dH);
+	err+=abs(dH-dP);
+	//Near a fold the tangents diverge and the chord length no longer agrees with them
+	double tt=9*(ta.x*tb.x+ta.y*tb.y);
+	if(tt>0)err+=1.5*abs(dP*(d2min/tt-1));
+	else err+=abs(dP)+d2min;
+	//A chord much longer than the tangents allow suggests the images were mismatched
+	double tmax=3*sqrt(fmax(ta.x*ta.x+ta.y*ta.y,tb.x*tb.x+tb.y*tb.y));
+	if(d2min>4*tmax*tmax)err+=d2min;
+	ia.erase(ia.begin()+ma);
+	ib.erase(ib.begin()+mb);
+      }
+    }
+    //Leftover images come in opposite-parity pairs, annihilated after a or created before b within the segment.
+    //Near the fold the pair is z+-=zc+-v*u+w*u^2, with u^2=s the angle to the caustic crossing, so we join them by the
+    //Hermite curve in u.  The two estimates of s from the pair gap and tangents differ at next order, which gives the
+    //error estimate.
+    for(int side=0;side<2;side++){
+      const contour_sample &s=(side==0?a:b);
+      const contour_sample &o=(side==0?b:a);
+      vector<int>plus,minus;
+      for(int par=-1;par<=1;par+=2){
+	size_t no=0;
+	for(size_t j=0;j<o.z.size();j++)if(o.par[j]==par)no++;
+	vector<int>is;
+	for(size_t j=0;j<s.z.size();j++)if(s.par[j]==par)is.push_back(j);
+	if(is.size()<=no)continue;
+	//keep those farthest from any same-parity image of the other sample
+	vector<pair<double,int> >far;
+	for(int j:is){
+	  double d2min=INFINITY;
+	  for(size_t k=0;k<o.z.size();k++)if(o.par[k]==par){
+	      Point d=o.z[k]-s.z[j];
+	      d2min=fmin(d2min,d.x*d.x+d.y*d.y);
+	    }
+	  far.push_back(make_pair(d2min,j));
+	}
+	sort(far.rbegin(),far.rend());
+	for(size_t k=0;k<is.size()-no;k++)(par>0?plus:minus).push_back(far[k].second);
+      }
+      if(plus.size()!=minus.size()){
+	err+=mismatch_err;
+	continue;
+      }
+      while(plus.size()>0){
+	int mp=0,mm=0;
+	double d2min=INFINITY;
+	for(size_t u=0;u<plus.size();u++)for(size_t v=0;v<minus.size();v++){
+	    Point d=s.z[plus[u]]-s.z[minus[v]];
+	    double d2=d.x*d.x+d.y*d.y;
+	    if(d2<d2min){d2min=d2;mp=u;mm=v;}
+	  }
+	const Point &zp=s.z[plus[mp]],&zm=s.z[minus[mm]];
+	const Point &dzp=s.dz[plus[mp]],&dzm=s.dz[minus[mm]];
+	Point dz=zp-zm,ddz=dzp-dzm;
+	double ddz2=ddz.x*ddz.x+ddz.y*ddz.y;
+	double s1=h,s2=h;
+	if(ddz2>0){
+	  s1=fmin(h,abs(dz.x*ddz.x+dz.y*ddz.y)/ddz2/2);
+	  s2=fmin(h,sqrt(d2min/ddz2)/2);
+	}
+	double dHs[2],dP=0;
+	for(int k=0;k<2;k++){
+	  double kt=4*(k==0?s1:s2)/3;
+	  Point Q1,Q2,Q3;
+	  if(side==0){//annihilation: the curve runs from z+ through the crossing to z-
+	    Q1=dzp*kt;Q3=zm-zp;Q2=Q3+dzm*kt;
+	  } else {//creation: the curve runs from z- through the crossing to z+
+	    Q1=dzm*(-kt);Q3=zp-zm;Q2=Q3-dzp*kt;
+	  }
+	  dHs[k]=(3*cross_product(Q1,Q2)+3*cross_product(Q1,Q3)+6*cross_product(Q2,Q3))/20.0;
+	  if(k==0)dP=0.75*cross_product(Q1,Q3-Q2);
+	}
+	if(side==0)edge(zp,zm,1);
+	else edge(zm,zp,1);
+	dA+=dHs[0];
+	dM=dM+(zp+zm)*(0.5*dHs[0]);
+	err+=abs(dHs[0]-dHs[1])+abs(dHs[0]-dP)+abs(dHs[0])*s1/h;
+	plus.erase(plus.begin()+mp);
+	minus.erase(minus.begin()+mm);
+      }
+    }
+    return err;
+  };
+
+  ///Step 1: Initial uniform sampling of the limb.  Samples failing the sanity checks are nudged along the limb.
+  vector<contour_sample> samples;
+  vector<double> vertex_mags;  //Used only for variance estimate at end.
+  double dphi=twopi/N0;
+  for(int i=0;i<N0;i++){
+    contour_sample s;
+    bool ok=false;
+    for(int k=0;k<=nretry and not ok;k++)ok=solve(dphi*(i+1e-3*k),s);
+    if(not ok)continue;
+    samples.push_back(s);
+    vertex_mags.push_back(s.absmu);
+  }
+  if(samples.size()<2){//Fail if we cannot get going
+    magnification=INFINITY;
+    var=0;
+    N=Nsolve;
+    return false;
+  }
+
+  ///Step 2: Evaluate the segments between neighbours; next[i] is the sample following sample i around the limb.
+  vector<int> next;
+  vector<double> seg_err,seg_area;
+  vector<Point> seg_moment;
+  priority_queue<pair<double,int> > queue;
+  double area=0,err=0;
+  auto span=[&](int i)->double{
+    double h=samples[next[i]].phi-samples[i].phi;
+    if(h<=0)h+=twopi;
+    return h;
+  };
+  auto evaluate=[&](int i){
+    seg_err[i]=segment(samples[i],samples[next[i]],span(i),seg_area[i],seg_moment[i]);
+    area+=seg_area[i];
+    err+=seg_err[i];
+    queue.push(make_pair(seg_err[i],i));
+  };
+  int ns=samples.size();
+  for(int i=0;i<ns;i++)next.push_back((i+1)%ns);
+  seg_err.resize(ns);
+  seg_area.resize(ns);
+  seg_moment.resize(ns);
+  for(int i=0;i<ns;i++)evaluate(i);
+
+  ///Step 3: Bisect the worst segments until the error target is met.  Segments at the refinement limit, or whose
+  ///midpoint fails the sanity checks, are left as they are; we give up once their error alone exceeds the target.
+  double stuck_err=0;
+  while(queue.size()>0 and err>finite_source_tol*abs(area) and (int)samples.size()<Nmax){
+    int i=queue.top().second;
+    double e=queue.top().first;
+    queue.pop();
+    if(e!=seg_err[i])continue;//stale entry
+    double h=span(i);
+    contour_sample s;
+    bool ok=false;
+    if(h>2*hmin)for(int k=0;k<=nretry and not ok;k++)ok=solve(samples[i].phi+h*(0.5+0.1*k),s);
+    if(not ok){
+      stuck_err+=e;
+      if(stuck_err>finite_source_tol*abs(area))break;
+      continue;
+    }
+    if(s.phi>=twopi)s.phi-=twopi;
+    area-=seg_area[i];
+    err-=seg_err[i];
+    int j=samples.size();
+    samples.push_back(s);
+    next.push_back(next[i]);
+    next[i]=j;
+    seg_err.push_back(0);
+    seg_area.push_back(0);
+    seg_moment.push_back(Point(0,0));
+    evaluate(i);
+    evaluate(j);
+  }
+
+  ///Step 4: Sum up exactly, and compute the results
+  area=0;
+  err=0;
+  Point moment;
+  for(size_t i=0;i<samples.size();i++){
+    area+=seg_area[i];
+    err+=seg_err[i];
+    moment=moment+seg_moment[i];
+  }
+  double area0=M_PI*radius*radius;
+  magnification=area/area0;
+  p=moment*(1.0/area)-p;//we are recycling this to use as the overall image centroid offset now.
+  N=Nsolve;
+  var=0;
+  for( auto mg : vertex_mags){
+    double dmg=mg-magnification;
+    if(dmg>magnification)dmg=magnification;
+    dmg*=source_var;
+    var+=dmg*dmg;
+  }
+  var/=vertex_mags.size();
+  if(vcache and ns==N0){//Save the initial samples, which are (within the retry nudges) the vertices of an N0-gon
+    vcache->p=p0;
+    vcache->radius=radius;
+    vcache->N=N0;
+    vcache->curve.resize(N0);
+    vcache->image_points.resize(N0);
+    vcache->image_point_mags.resize(N0);
+    vcache->vertex_mags.resize(N0);
+    for(int i=0;i<N0;i++){
+      vcache->curve[i]=samples[i].beta;
+      vcache->image_points[i]=samples[i].z;
+      vcache->image_point_mags[i]=samples[i].mu;
+      vcache->vertex_mags[i]=samples[i].absmu;
+    }
+  }
+  return err<=finite_source_tol*abs(area) and area>0;
+}
+
 ///Brute force integration finite size magnification around 1-D circle
 ///
 ///This is used below in computing the 2D integral over the image plane.
@@ -1300,7 +1888,7 @@ int GLens::brute_force_circle_mag(const Point &p, const double radius, const dou
 	double x=cos(phis[i])*radius;
 	double y=sin(phis[i])*radius;
 	Point beta=p+Point(x,y);
-	vector<Point> thetas=invmap(beta);
+	Images thetas=invmap(beta);
 	double intens=1.0;//can make this a function of r,phi for general intensity profile
 	double mg=mag(thetas);
 	if(not (mg<maxmag))mg=maxmag;
@@ -1604,131 +2192,173 @@ int GLens::brute_force_area_mag(const Point &p, const double radius, double &mag
   return neval;
 }
   
-///Brute mapping finite size magnification
+///Inverse ray shooting
 ///
-///This method is intended only to be guarantedly correct, not fast. The idea is to map the relevant area of the image plane in a field of sample points, then to map these points back to the source plane to compute the magnification. This could also be a moderately efficient way to implement arbitrary source face intensity profiles.
-int GLens::brute_force_map_mag(const Point &p, const double radius, double &magnification){
-
-  //control parameters 
-  double tol=finite_source_tol;
-  double h=radius*sqrt(tol/M_PI);//assuming linear convergence in pixel area=h^2 
-  int Npoly=1/sqrt(tol);
-  const double box_expansion_fac=10;
-  
-  Point b=p;
-  double Amag=0;
-  double variance;
-  const double radius2=radius*radius;
-  vector< vector <Point> > contours;
-  
-  //First we call image area mag, needed to provide a location for the contours
-  image_area_mag(b, radius, Npoly, Amag, variance, NULL, &contours);  
-  
-  //Make boxes around the computed image contours
-  struct box {int xmin,xmax,ymin,ymax;};
-  vector<box> boxes;
-  vector<Point> ths=this->invmap(p);int ic=0;//diagn.
-  for(auto curve:contours){
-    //Find bounding box
-    double xmin=1e100,ymin=1e100,xmax=-1e100,ymax=-1e100;
-    for(auto p:curve){
-      if(p.x<xmin)xmin=p.x;
-      if(p.y<ymin)ymin=p.y;
-      if(p.x>xmax)xmax=p.x;
-      if(p.y>ymax)ymax=p.y;
-    }
-    //cout<<"countour box:"<<xmin<<" "<<xmax<<" "<<ymin<<" "<<ymax<<endl;
-    //cout<<"point images:      "<<ths[ic].x<<"        "<<ths[ic].y<<endl;
-    //ic++;
-    //Expand boxes slightly, snapped to grid of resolution h    
-    int ixc=int(((xmin+xmax)/2-p.x)/h+0.5);
-    int iyc=int(((ymin+ymax)/2-p.y)/h+0.5);
-    int nx=int(box_expansion_fac*(xmax-xmin)/h/2);//one-sided count n
-    int ny=int(box_expansion_fac*(ymax-ymin)/h/2);//total points = 2*n+1
-    //cout<<"box:"<<ixc-nx<<" "<<ixc+nx<<" "<<iyc-ny<<" "<<iyc+ny<<endl;
-    boxes.push_back((box){ixc-nx,ixc+nx,iyc-ny,iyc+ny});
-  }
-
-  //Sum up weighted image area in grid units
-  double sum=0;
-  for(int k=0;k<boxes.size();k++){
-    auto box=boxes[k];
-    //cout<<"box "<<k<<endl;
-    for(int i=box.xmin;i<=box.xmax;i++){
-      double x=p.x+h*i;
-      //check which boxes may already have counted this row
-      int jcountedmin=box.ymax+1,jcountedmax=box.ymin-1;
-      for(int kk=0;kk<k;kk++)
-	if( i>=boxes[kk].xmin and i<=boxes[kk].xmax
-	    and box.ymax>=boxes[kk].ymin and box.ymin<=boxes[kk].ymax){//overlaps in x
-	  if(boxes[kk].ymax>=box.ymin and boxes[kk].ymin<jcountedmin)jcountedmin=boxes[kk].ymin;
-	  if(boxes[kk].ymin<=box.ymax and boxes[kk].ymax>jcountedmax)jcountedmax=boxes[kk].ymax;
-	  //cout<<"overlap range ["<<jcountedmin<<","<<jcountedmax<<"]"<<endl;
-	}
-      for(int j=box.ymin;j<=box.ymax;j++){
-	//check if this cell is already counted
-	if(j>=jcountedmin and j<=jcountedmax)continue;
-	//map back to source plane to compute pixel intensity (uniform disk implemented)
-	Point pgrid(x,p.y+h*j);
-	Point psource=this->map(pgrid);
-	//cout<<h<<": pgrid("<<pgrid.x<<","<<pgrid.y<<")"<<" psource("<<psource.x<<","<<psource.y<<")"<<" p("<<p.x<<","<<p.y<<")"<<endl;
-	//compute squared distance to source center
-	double dx=psource.x-p.x, dy=psource.y-p.y;
-	double d2=dx*dx+dy*dy;
-	//cout<<"  "<<j<<" "<<d2<<" "<<radius2<<endl;
-
-	double edgebuf=0;
-	if(0){//handle edges at higher orger
-	  //when is (d-radius)^2<2 -> |1-d2/radius2|/(1+d/radius)<sqrt2
-	  //                       ~> |1-d2/radius2|<2*sqrt(2)
-	  //                       ~> -2*sqrt2 < d2/radius2-1 <2sqrt2
-	  edgebuf=1.0-2.0*sqrt(2.0);
-	}
-	//linear inclusion in disk computation
-	double area=0;
-	if(d2/radius2<1-edgebuf)area=1.0;//inside source disk
-	else if(fabs(d2/radius2-1)<edgebuf){//handle fractional part of edge cell to O(h^4)
-	  if(dy==0){
-	    area=(radius-fabs(dx))/h+0.5;
-	  }else{//this has been though through only for d2>rho2 ... needs work.
-	    double z=(d2-sqrt(d2)*radius)/h;
-	    double yp=(-dx/2 + z)/dy, ym=(-dx/2 - z)/dy;
-	    double xp=0.5,xm=-0.5;
-	    if(yp>0.5){//out top to right
-	      yp=0.5;
-	      xp=(-dy/2 + z)/dx;
-	      if(xp>0.5)xp=0.5;
-	    } else if(yp<-0.5){//out bottom to right
-	      yp=-0.5;
-	      xp=(-dy/2 + z)/dx;
-	      if(xp>0.5)xp=0.5;
-	    }
-	    if(ym<-0.5){//in from bottom on left
-	      ym=-0.5;
-	      xm=(-dy/2 - z)/dx;
-	      if(xm<-0.5)xm=-0.5;
-	    }else if(ym>0.5){//in from top on left
-	      ym=0.5;
-	      xm=(-dy/2 + z)/dx;
-	      if(xm<-0.5)xm=-0.5;
-	    }
-	    area=0.5*(1-(0.5-yp)*(0.5-xp)-(ym+0.5)*(xm+0.5));
+///Rays are shot from the centers of the cells of a grid of spacing h in the lens plane (or from uniformly random points
+///within them, if jitter is set), mapped to the observer plane, and binned.  Each ray adds h^2 to the lens-plane area
+///of its bin, so that area divided by the bin's observer-plane area is the magnification averaged over the bin.  The
+///first moments of the rays' lens-plane positions are accumulated too, if requested.
+///
+///All images of the binned region lie within image_radius_bound of the origin, so the grid needs only cover a square
+///of that half-width.  That square is divided as a quadtree, down to leaf tiles of nleaf by nleaf rays, skipping any
+///tile whose center maps farther from the bins than map_variation_bound allows the tile to spread; so only tiles near
+///the images of the region are shot.  The leaves are then shared dynamically over ray_threads OpenMP threads, each
+///with a private histogram, and these are summed at the end.  Jitter offsets are a hash of the global ray indices, so
+///results don't depend on the thread schedule.
+long GLens::shoot_rays(const RayBins &bins, double h, bool jitter, vector<double> &area, vector<Point> *moment){
+  require_time_dependent_values();
+  const int nleaf=16;
+  const double leaf=nleaf*h;
+  int levels=0;
+  double R=image_radius_bound(bins.max_radius());
+  while(leaf*pow(2.0,levels)<2*R)levels++;
+  const double S=leaf*pow(2.0,levels)/2;
+
+  //Find the leaf tiles which may map onto the bins
+  struct tile {int i,j,l;};
+  vector<tile> stack(1,(tile){0,0,levels}),leaves;
+  while(stack.size()>0){
+    tile t=stack.back();
+    stack.pop_back();
+    double side=leaf*pow(2.0,t.l);
+    Point c(-S+(t.i+0.5)*side,-S+(t.j+0.5)*side);
+    if(bins.distance(map(c))>map_variation_bound(c,side/2))continue;
+    if(t.l==0)leaves.push_back(t);
+    else for(int k=0;k<4;k++)stack.push_back((tile){2*t.i+k%2,2*t.j+k/2,t.l-1});
+  }
+
+  //Shoot them
+  int nb=bins.size();
+  area.assign(nb,0);
+  if(moment)moment->assign(nb,Point(0,0));
+  int nthreads=ray_threads;
+  if(omp_get_active_level()>=omp_get_max_active_levels())nthreads=1;
+  auto jitter_offset=[](uint64_t k)->double{//splitmix64 finalizer, to [0,1)
+    k^=k>>30;k*=0xbf58476d1ce4e5b9ULL;
+    k^=k>>27;k*=0x94d049bb133111ebULL;
+    k^=k>>31;
+    return (k>>11)*(1.0/9007199254740992.0);
+  };
+#pragma omp parallel num_threads(nthreads)
+  {
+    const int nr=nleaf*nleaf;
+    vector<double> a(nb,0),x(nr),y(nr),bx(nr),by(nr);
+    vector<Point> m(moment?nb:0);
+    vector<int> cells(nr);
+#pragma omp for schedule(dynamic,4)
+    for(size_t k=0;k<leaves.size();k++){
+      for(int jj=0;jj<nleaf;jj++)for(int ii=0;ii<nleaf;ii++){
+	  int n=jj*nleaf+ii;
+	  uint64_t gi=leaves[k].i*nleaf+ii,gj=leaves[k].j*nleaf+jj;
+	  double ux=0.5,uy=0.5;
+	  if(jitter){
+	    ux=jitter_offset(2*(gi<<32|gj));
+	    uy=jitter_offset(2*(gi<<32|gj)+1);
 	  }
+	  x[n]=-S+(gi+ux)*h;
+	  y[n]=-S+(gj+uy)*h;
 	}
-	sum+=area;
-      }
+      map_batch(x.data(),y.data(),nr,bx.data(),by.data());
+      bins.bin(bx.data(),by.data(),nr,cells.data());
+      for(int n=0;n<nr;n++)if(cells[n]>=0){
+	  a[cells[n]]+=1;
+	  if(moment)m[cells[n]]=m[cells[n]]+Point(x[n],y[n]);
+	}
+    }
+#pragma omp critical
+    {
+      for(int b=0;b<nb;b++)area[b]+=a[b];
+      if(moment)for(int b=0;b<nb;b++)(*moment)[b]=(*moment)[b]+m[b];
+    }
+  }
+  for(int b=0;b<nb;b++){
+    area[b]*=h*h;
+    if(moment)(*moment)[b]=(*moment)[b]*(h*h);
+  }
+  return (long)leaves.size()*nleaf*nleaf;
+}
+
+///For a point lens of unit mass at the origin, the map's derivative is bounded by 1+1/r^2.
+double GLens::map_variation_bound(const Point &c, double s)const{
+  double dx=fmax(abs(c.x)-s,0.0),dy=fmax(abs(c.y)-s,0.0),d2=dx*dx+dy*dy;
+  if(d2==0)return INFINITY;
+  return s*M_SQRT2*(1+1/d2);
+}
+
+///Brute mapping finite size magnification
+///
+///This method is intended to be guaranteed correct rather than fast.  We shoot rays on a jittered grid (see
+///shoot_rays) into annuli of the source disk, so that any radial brightness profile can be applied, here the limb
+///darkening with the exact mean brightness of each annulus.  The jitter noise is mostly from rays near the image
+///boundaries, for which the relative error is about (h/radius)^(3/2), so the ray spacing is set to make that
+///the tolerance.  The image centroid is returned in centroid.  Returns the number of rays shot.
+int GLens::brute_force_map_mag(const Point &p, const double radius, double &magnification, Point &centroid){
+  const int nbins=64;
+  const double h=radius*pow(finite_source_tol,2/3.0);
+  DiskRayBins bins(p,radius,nbins);
+  vector<double> area;
+  vector<Point> moment;
+  long nrays=shoot_rays(bins,h,true,area,&moment);
+  double flux=0;
+  Point M;
+  for(int j=0;j<nbins;j++){
+    double muin=1-j/(double)nbins,muout=1-(j+1)/(double)nbins;
+    double xin=1-muin*muin,xout=1-muout*muout;
+    double B=(source_LD_flux(xout)-source_LD_flux(xin))/(xout-xin);
+    flux+=B*area[j];
+    M=M+moment[j]*B;
+  }
+  magnification=flux/(M_PI*radius*radius*source_LD_flux(1));
+  centroid=M*(1.0/flux);
+  return nrays;
+}
+
+///Pixel-averaged magnification map by inverse ray shooting
+///
+///The pixels are centered on the same points as in writeMagMap, with magmap_rays rays per pixel (in the absence of
+///lensing).  The lens is taken at its reference time.
+void GLens::writeRayMagMap(ostream &out, const Point &LLcorner,const Point &URcorner,int samples){
+  double dx=(URcorner.x-LLcorner.x)/(samples-1);
+  double dy=(URcorner.y-LLcorner.y)/(samples-1);
+  int ny=0;
+  for(double y=LLcorner.y;y<=URcorner.y;y+=dy)ny++;//the rows of writeMagMap
+  set_time_dependent_values(0);
+  Point origin=traj2lens(Point(0,0)),xdir=traj2lens(Point(1,0))-origin;
+  RectRayBins bins(Point(LLcorner.x-dx/2,LLcorner.y-dy/2),dx,dy,samples,ny,origin,xdir.x,xdir.y);
+  vector<double> area;
+  long nrays=shoot_rays(bins,sqrt(dx*dy/magmap_rays),false,area);
+  unset_time_dependent_values();
+  cout<<"GLens::writeRayMagMap: shot "<<nrays<<" rays"<<endl;
+  int output_precision=out.precision();
+  ios_base::fmtflags flags=out.flags();
+  double ten2prec=pow(10,output_precision-2);
+  out<<"#x  y  magnification"<<endl;
+  double y=LLcorner.y;
+  for(int j=0;j<ny;j++,y+=dy){
+    for(int i=0;i<samples;i++){
+      double mtruc=floor(area[j*samples+i]/(dx*dy)*ten2prec)/ten2prec;
+      out<<LLcorner.x+i*dx<<" "<<y<<" "<<setiosflags(ios::scientific)<<mtruc<<resetiosflags(flags)<<endl;
     }
+    out<<endl;
   }
-  magnification=sum*h*h/radius2/M_PI;
-  //double dmag=magnification-Amag;
-  //cout<<"mag dmag:"<<magnification<<" "<<dmag<<endl;
 }
 
 vector<double> GLens::_compute_trajectory_dummy_dmag;//dummy argument
 
-void GLens::finite_source_compute_trajectory (const Trajectory &traj, vector<double> &time_series, vector<vector<Point> > &thetas_series, vector<double>&mag_series, vector<double>&dmag_series, ostream *out){
-  //Can optionally provide out stream to which to write image curves.
+///Limb-darkened source brightness integrated over the area within radius r, in units of the central brightness
+///
+///With x=r^2 and mu=sqrt(1-x), the profile 1-a(1-mu)-b(1-mu)^2 integrates (dx) to x-a(x+2mu^3/3)-b(2x-x^2/2+4mu^3/3),
+///less its value at x=0.
+double GLens::source_LD_flux(double x)const{
+  double mu=sqrt(fmax(0.0,1-x)),mu3=mu*mu*mu;
+  double a=source_LD_a,b=source_LD_b;
+  return x-a*(x+2*mu3/3.0-2/3.0)-b*(2*x-x*x/2+4*mu3/3.0-4/3.0);
+};
 
+///Finite-source magnification at frame time tgrid, for finite_source_compute_trajectory, with its uncertainty and the
+///offset of the overall image centroid from the source.  Returns the number of point-source inversions, for
+///diagnostics.  Apart from the saved roots the result depends only on tgrid, so epochs can be done in any order.
+int GLens::finite_source_mag(const Trajectory &traj, double tgrid, double &mag_out, double &dmag_out, Point &centroid, ostream *out){
   //Controls
   const bool debug=false;
   const int Npoly_max=finite_source_Npoly_max;        //Part of magnification-based estimate for polygon order.
@@ -1738,6 +2368,7 @@ void GLens::finite_source_compute_trajectory (const Trajectory &traj, vector<dou
   bool do_laplacian = false;
   bool do_polygon = false;
   bool do_brute = false;
+  bool do_contour = false;
 
   const double rho2=source_radius*source_radius;
   const double mtol=finite_source_tol;
@@ -1749,16 +2380,7 @@ void GLens::finite_source_compute_trajectory (const Trajectory &traj, vector<dou
   bool do_shear_test=false;
   //if(mag_pcut>1) mag_pcut=1.0;
   const double dmag_pcut=ftol;
-  //decimation
-  double decimate_dtmin=source_radius*finite_source_decimate_dtmin;
-
-  //diagnostics
-  bool diagnose=false;
-  static int d_count=0,d_N=0,d_every=500000;
-  static double d_time=0,d_rho,t_rho,t_N;
-  double tstart=omp_get_wtime();
   int Nsum=0;
-
   int Npoly;
 
   if(finite_source_method<0)dont_mix=true;
@@ -1767,6 +2389,11 @@ void GLens::finite_source_compute_trajectory (const Trajectory &traj, vector<dou
     do_laplacian=true;
   } else if(abs(finite_source_method)==2)do_laplacian=true;
   else if(abs(finite_source_method)==4)do_brute=true;
+  else if(abs(finite_source_method)==5){
+    do_polygon=true;
+    do_laplacian=true;
+    do_contour=true;
+  }
   
   if(debug){
     cout<<"source_radius="<<source_radius<<endl;
@@ -1774,212 +2401,402 @@ void GLens::finite_source_compute_trajectory (const Trajectory &traj, vector<dou
     cout<<"do_polygon="<<do_polygon<<endl;
   }
   
-  int Ngrid=traj.Nsamples();
-  vector<double>full_time_series(Ngrid);
-  vector<int>time_series_map;
-  time_series.resize(0);
-  double tlast=-INFINITY;
-  for(int i=0; i<Ngrid;i++){
-    double t=full_time_series[i]=traj.get_obs_time(i);
-    if(i+2>=Ngrid or traj.get_obs_time(i+1)-tlast>=decimate_dtmin){
-      time_series.push_back(t);
-      time_series_map.push_back(i); 
-      tlast=t;
-    }
-  }
-  int Neval=time_series.size();
-  //cout<<"Neval="<<Neval<<" < "<<Ngrid<<endl;
-  thetas_series.resize(Neval);
-  mag_series.resize(Neval);
-  dmag_series.resize(Neval);
+  set_time_dependent_values(tgrid);
+  Point b=get_obs_pos(traj,tgrid);
+  if(debug)cout<<" t="<<tgrid<<" b=("<<b.x<<","<<b.y<<")"<<endl;
+  double Amag=0;
+  Point CoM;
+  double variance=0;
+
   
-  for(int i=0; i<Neval;i++){
-    double tgrid=time_series[i];
-    set_time_dependent_values(tgrid);
-    Point b=get_obs_pos(traj,tgrid);
-    if(debug)cout<<i<<" t="<<tgrid<<" b=("<<b.x<<","<<b.y<<")"<<endl;
-    double Amag=0;
-    Point CoM;
-    double variance=0;
+  //Here begins a decision tree of various possible finite source treatments
 
-    
-    //Here begins a decision tree of various possible finite source treatments
-
-    //The first option is just to explicitly compute by brute force
-    //This option works independently without mixing (A mix version could also be implemented below if desired
-    //In this case,  we do not compute any variance or centroid information
-    if(do_brute){
-      //cout<<"t "<<tgrid<<endl;
-      Npoly=brute_force_map_mag(b, source_radius, Amag);
-      //Npoly=brute_force_area_mag(b, source_radius, Amag);
-      //Pack up results
-      mag_series[i]=Amag;
-      dmag_series[i]=0;
-      thetas_series[i]=vector<Point>(1,CoM-b);//TBD Except for the brute case, return the centriod. We haven't computed the centroid yet for brute.
-      //cout<<Npoly<<" "<<tgrid<<" "<<Amag<<endl;
-      Nsum+=Npoly;
-      //cout<<i<<" mg0="<<mg0<<" Amag="<<Amag<<endl;
-      continue; //finish the loop here. (Rest of this file is irrelevant in this case)
+  //The first option is just to explicitly compute by brute force
+  //This option works independently without mixing (A mix version could also be implemented below if desired
+  //In this case,  we do not compute any variance information
+  if(do_brute){
+    //cout<<"t "<<tgrid<<endl;
+    Npoly=brute_force_map_mag(b, source_radius, Amag, CoM);
+    //Npoly=brute_force_area_mag(b, source_radius, Amag);
+    //Pack up results
+    mag_out=Amag;
+    dmag_out=0;
+    centroid=CoM-b;
+    //cout<<Npoly<<" "<<tgrid<<" "<<Amag<<endl;
+    Nsum+=Npoly;
+    //cout<<i<<" mg0="<<mg0<<" Amag="<<Amag<<endl;
+    return Nsum; //finish here. (The rest is irrelevant in this case)
+  }
+  
+  //At first we just compute the ordinary magnification and a leading-order finite source term
+  //This is probably relatively fast enough that we can do it without worry about the additional cost
+  Images thetas=invmap(b);
+  int nk=thetas.size();
+  double mg0 = mag(thetas);
+  Nsum++;
+  double mu0s[Images::capacity];
+  for(int k=0;k<nk;k++)mu0s[k]=mag(thetas[k]);
+  if(debug){
+    cout<<"mg0="<<mg0<<endl;
+    for(int k=0;k<nk;k++)cout<<"  mu0s["<<k<<"]="<<mu0s[k]<<endl;
+  }
+  //Now estimate the leading order finite source term:
+  //This is a smaller calculation than the full Laplacian, keep in only up to 1/r^6 terms
+  // dA*/A=1 + 4*norm(mu*dgamma)
+  //Interestingly, for each of the images, the same term is dominant, and it is dA~O(1/r^6)
+  //For the near-lens images, mu is small but dgamma is large, yielding the same order.
+  //Analytically I get leading order for a binary as:
+  //
+  // A* = 1 + 2(1-q(1-q))r^(-4)( 1 + 4rho^2/r^2 )
+  //
+  //where all 3 images are included.
+  bool shear_test=false;
+  //The finite source terms are second order in the source radius, so they scale with the brightness-weighted mean
+  //of r^2, which is 1/2 for a uniform source.
+  const double LD_r2=source_LD_mean_r2();
+  for(int k=0;k<nk;k++){
+    Point th=thetas[k];
+    ShearDerivs gammas;
+    if(do_shear_test)gammas=compute_shear(th,2);
+    else gammas=compute_shear(th,1);
+    double dArel=0;
+    if(mu0s[k]!=0)dArel=norm(mu0s[k]*gammas[1]*source_radius)*2*LD_r2;
+    double Ak=abs(mu0s[k])*(1+dArel);
+    //cout<<"k="<<k<<gammas[1]<<" "<<dArel<<" "<<Ak<<endl;
+    Amag+=Ak;
+    CoM=CoM+th*Ak;
+    //This test is based on an estimator for the max difference in mu^-1 near a point where mu^-1=0 only for the outer mu>1 image. 
+    if(do_shear_test and mu0s[k]>1){
+      cout<<"shear test: "<<shear_cut<<" < "<< norm(gammas[0]*gammas[2]) + norm(gammas[1]*gammas[1]) <<" mu="<<mu0s[k]<<" "<<mg0<<endl;
+      shear_test = ( shear_cut < norm(gammas[0]*gammas[2]) + norm(gammas[1]*gammas[1]) );
     }
-    
-    //At first we just compute the ordinary magnification and a leading-order finite source term
-    //This is probably relatively fast enough that we can do it without worry about the additional cost
-    vector<Point>thetas=invmap(b);
-    int nk=thetas.size();
-    double mg0 = mag(thetas);
-    Nsum++;
-    vector<double> mu0s(nk),mus(nk);
-    for(int k=0;k<nk;k++)mu0s[k]=mag(thetas[k]);
-    if(debug){
-      cout<<"mg0="<<mg0<<endl;
-      for(int k=0;k<nk;k++)cout<<"  mu0s["<<k<<"]="<<mu0s[k]<<endl;
-    }
-    //Now estimate the leading order finite source term:
-    //This is a smaller calculation than the full Laplacian, keep in only up to 1/r^6 terms
-    // dA*/A=1 + 4*norm(mu*dgamma)
-    //Interestingly, for each of the images, the same term is dominant, and it is dA~O(1/r^6)
-    //For the near-lens images, mu is small but dgamma is large, yielding the same order.
-    //Analytically I get leading order for a binary as:
-    //
-    // A* = 1 + 2(1-q(1-q))r^(-4)( 1 + 4rho^2/r^2 )
-    //
-    //where all 3 images are included.
-    bool shear_test=false;
+  }
+  CoM=CoM*(1.0/Amag);
+  if(debug)cout<<"Amag[lo]="<<Amag<<endl;
+  if(debug)cout<<"CoM[lo]="<<CoM.x<<" "<<CoM.y<<endl;
+  
+  //Eventually we will want to dynamically select efficient methods for different regions.
+  //For now we just have fixed choice of analytic or polygon methods
+  if(debug)cout<<  Amag -1 <<" > "<<mag_lcut<<" ? "<<( Amag - 1 > mag_lcut)<<endl;
+  bool do_laplacian_test= do_laplacian and ( Amag - 1 > mag_lcut or dont_mix);
+  if(debug)cout<<" do_laplacian_test="<<do_laplacian_test<<endl;
+  if(do_laplacian_test){
+    if(debug)cout<<"doing laplacian"<<endl;
+    //This method builds on PejchaEA2007? method
+    // Amag = \sum_k I[k]/I[0] Lap^k[mu] / (2^k k!)^2
+    // I[k] = \int_0^1 r^(2k+1) B(r) dr
+    //Where B(rho/rho*) is the surface brightness at radius rho, for star-disk of radius rho*.
+    //For constant surface brightness, I[k]/I[0]=1/(k+1), in general I[1]/I[0] is the mean r^2, LD_r2.
+    //Here we just keep the first nonleading term
+    Amag=0;
+    CoM=Point(0,0);
     for(int k=0;k<nk;k++){
+      if(mu0s[k]==0)continue;
       Point th=thetas[k];
-      vector<complex<double> > gammas;
-      if(do_shear_test)gammas=compute_shear(th,2);
-      else gammas=compute_shear(th,1);
-      double dArel=0;
-      if(mu0s[k]!=0)dArel=norm(mu0s[k]*gammas[1]*source_radius);
+      double Lmu=Laplacian_mu(th);
+      double dArel=Lmu*source_radius*source_radius/4.0/mu0s[k]*LD_r2;
       double Ak=abs(mu0s[k])*(1+dArel);
-      //cout<<"k="<<k<<gammas[1]<<" "<<dArel<<" "<<Ak<<endl;
+      if(debug)cout<<k<<" "<<th.x<<" "<<th.y<<" L="<<Lmu<<" mu="<<mu0s[k]<<" Ak="<<endl;
       Amag+=Ak;
       CoM=CoM+th*Ak;
-      //This test is based on an estimator for the max difference in mu^-1 near a point where mu^-1=0 only for the outer mu>1 image. 
-      if(do_shear_test and mu0s[k]>1){
-	cout<<"shear test: "<<shear_cut<<" < "<< norm(gammas[0]*gammas[2]) + norm(gammas[1]*gammas[1]) <<" mu="<<mu0s[k]<<" "<<mg0<<endl;
-	shear_test = ( shear_cut < norm(gammas[0]*gammas[2]) + norm(gammas[1]*gammas[1]) );
-      }
     }
     CoM=CoM*(1.0/Amag);
-    if(debug)cout<<"Amag[lo]="<<Amag<<endl;
-    if(debug)cout<<"CoM[lo]="<<CoM.x<<" "<<CoM.y<<endl;
-    
-    //Eventually we will want to dynamically select efficient methods for different regions.
-    //For now we just have fixed choice of analytic or polygon methods
-    if(debug)cout<<  Amag -1 <<" > "<<mag_lcut<<" ? "<<( Amag - 1 > mag_lcut)<<endl;
-    bool do_laplacian_test= do_laplacian and ( Amag - 1 > mag_lcut or dont_mix);
-    if(debug)cout<<" do_laplacian_test="<<do_laplacian_test<<endl;
-    if(do_laplacian_test){
-      if(debug)cout<<"doing laplacian"<<endl;
-      //This method builds on PejchaEA2007? method
-      // Amag = \sum_k I[k]/I[0] Lap^k[mu] / (2^k k!)^2
-      // I[k] = \int_0^1 r^(2k+1) B(r) dr
-      //Where B(rho/rho*) is the surface brightness at radius rho, for star-disk of radius rho*.
-      //For constant surface brightness, I[k]/I[0]=1/(k+1)
-      //Here we just keep the first nonleading term
-      Amag=0;
-      CoM=Point(0,0);
-      for(int k=0;k<nk;k++){
-	if(mu0s[k]==0)continue;
-	Point th=thetas[k];
-	double Lmu=Laplacian_mu(th);
-	double dArel=Lmu*source_radius*source_radius/4.0/mu0s[k];
-	dArel/=2.0;  //This is a total experimental HACK playing around...
-	double Ak=abs(mu0s[k])*(1+dArel);
-	if(debug)cout<<k<<" "<<th.x<<" "<<th.y<<" L="<<Lmu<<" mu="<<mu0s[k]<<" Ak="<<endl;
-	Amag+=Ak;
-	CoM=CoM+th*Ak;
-      }
-      CoM=CoM*(1.0/Amag);
-    }
+  }
 
-    
-    if(debug)cout<<  Amag -1 <<" > "<<mag_pcut<<" ? or "<<  abs(Amag/mg0 - 1)  <<" > "<<dmag_pcut<<" ?  shear_test="<<shear_test<<endl;
-    bool do_polygon_test= do_polygon  and ( shear_test or Amag - 1 > mag_pcut or abs(Amag/mg0 - 1) > dmag_pcut or dont_mix);
-    if(debug)cout<<" do_polygon_test="<<do_polygon_test<<endl;
-    if(do_polygon_test){
-      if(debug)cout<<"doing polygon"<<endl;
-      //This section computes the polygon order to apply
-      //There are several possibilities in principle:
-      //  -Use adaptive stepping in the polygon computation itself (maybe best long term)
-      //  -Use an estimate from an analytic estimate of size of finite source effect
-      //  -Use an estimate based on point-source magnification [implememted here]
-      //  -Fixed (probably way too slow).
-      //
-      //Magnification-based Npoly: Based on the idea that the mean side length of poly is fixed
-      //  -scales with sqrt(mg)
-      //  -min of 4          as  Area/pi -> rho^2
-      //  -max of Npoly_max  as  Area/pi >= Npoly_Asat
-      //  -always even (to preserve time symmetry)
-      //const double N2scale=Npoly_max*Npoly_max/16.0-1.0;//4*sqrt(N2scale+1)=Npoly_max
-      //double extra_area = (mg0-1)/Npoly_Asat;
-      //if(extra_area>1.0)extra_area=1.0;       //extra_area ranges from 0 to 1
-      //int Npoly = 2 * (int)(2*sqrt(1.0 + extra_area*N2scale));
-      //Npoly = 2 * (int)(2*sqrt(1.0 + extra_area*extra_area*N2scale));
-      double Npolyold=0;
-      //Npoly = 2 * (int)(2*sqrt(1.0 +(Amag-1)/finite_source_tol));{
+  
+  if(debug)cout<<  Amag -1 <<" > "<<mag_pcut<<" ? or "<<  abs(Amag/mg0 - 1)  <<" > "<<dmag_pcut<<" ?  shear_test="<<shear_test<<endl;
+  bool do_polygon_test= do_polygon  and ( shear_test or Amag - 1 > mag_pcut or abs(Amag/mg0 - 1) > dmag_pcut or dont_mix);
+  //With caustic segmentation, the polygon method is kept to sources near the caustics
+  if(caustic_window>0 and not dont_mix and do_polygon_test)do_polygon_test = caustic_distance(b) < caustic_window+source_radius;
+  if(debug)cout<<" do_polygon_test="<<do_polygon_test<<endl;
+  if(do_polygon_test){
+    if(debug)cout<<"doing polygon"<<endl;
+    //This section computes the polygon order to apply
+    //There are several possibilities in principle:
+    //  -Use adaptive stepping in the polygon computation itself (maybe best long term)
+    //  -Use an estimate from an analytic estimate of size of finite source effect
+    //  -Use an estimate based on point-source magnification [implememted here]
+    //  -Fixed (probably way too slow).
+    //
+    //Magnification-based Npoly: Based on the idea that the mean side length of poly is fixed
+    //  -scales with sqrt(mg)
+    //  -min of 4          as  Area/pi -> rho^2
+    //  -max of Npoly_max  as  Area/pi >= Npoly_Asat
+    //  -always even (to preserve time symmetry)
+    //const double N2scale=Npoly_max*Npoly_max/16.0-1.0;//4*sqrt(N2scale+1)=Npoly_max
+    //double extra_area = (mg0-1)/Npoly_Asat;
+    //if(extra_area>1.0)extra_area=1.0;       //extra_area ranges from 0 to 1
+    //int Npoly = 2 * (int)(2*sqrt(1.0 + extra_area*N2scale));
+    //Npoly = 2 * (int)(2*sqrt(1.0 + extra_area*extra_area*N2scale));
+    //Npoly = 2 * (int)(2*sqrt(1.0 +(Amag-1)/finite_source_tol));{
 
-      double Atest=fmax(mg0,Amag);
+    //The magnification of a uniform disk of radius r.  Passes at this epoch share the vertex cache, so that vertex
+    //images are reused at the same radius, and tracked from those of the last disk at another radius.
+    const double Atest0=fmax(mg0,Amag);
+    PolygonVertexCache vcache;
+    auto disk_mag=[&](double r, double &Adisk, Point &Cdisk, double &vdisk){
+      double Npolyold=0;
+      double Atest=Atest0;
+      bool contour_ok=false;
+      if(do_contour){
+	//The contour method refines itself, so the magnification-based order only sets its initial sampling.
+	//If it cannot meet the tolerance, we fall back on the polygon method.
+	Npoly = fmin(Npoly_max,4+(int)4*sqrt(fmin(0.1,(Atest-1))/finite_source_tol));
+	Point btmp=b;
+	double Acontour;
+	contour_ok=contour_area_mag(btmp, r, Npoly, Acontour, vdisk, &vcache);
+	Nsum+=Npoly;
+	if(contour_ok){
+	  Adisk=Acontour;
+	  Cdisk=btmp;
+	}
+      }
       //Npoly = fmin(Npoly_max,4+(int)sqrt(fmin(0.1,(Atest-1))/finite_source_tol));
       //cout<<"stats: t,Amg,Atest,Npoly: "<<traj.get_phys_time(tgrid)<<", "<<Amag<<", "<<Atest<<", "<<Npoly<<endl;
       //while( (Npoly = (int)4*sqrt(fmin(100,finite_source_tol + (Atest-1))/finite_source_tol)) > Npolyold*4){
-      while( (Npoly = fmin(Npoly_max,4+(int)4*sqrt(fmin(0.1,(Atest-1))/finite_source_tol))) > Npolyold*4){
+      if(not contour_ok)while( (Npoly = fmin(Npoly_max,4+(int)4*sqrt(fmin(0.1,(Atest-1))/finite_source_tol))) > Npolyold*4){
       //while( (Npoly = 4+(int)sqrt(fmin(100,4*(Amag-1)*(Amag-1))/finite_source_tol)) > Npolyold*4){
       //Npoly*=30;
 	//if(Npolyold>0)cout<<" Npoly="<<Npoly<<" < "<<Npoly_max<<" Npolyold="<<Npolyold<<" Amag="<<Amag<<endl;
-	//results go in Amag and CoM
+	//results go in Adisk and Cdisk
 	//cout<<" mu_i={ ";for(auto mui : mu0s)cout<<mui<<" ";cout<<"}"<<endl;
 	//cout<<"source_radius="<<source_radius<<endl;
+	//Keep the previous vertices, so that their images can be reused from the cache
+	if(Npolyold>0)Npoly-=Npoly%(int)Npolyold;
 	Point btmp=b;
 	Npolyold=Npoly;
-	Atest=fmax(mg0,Amag);
-	image_area_mag(btmp, source_radius, Npoly, Amag, variance, out);  
-	CoM=btmp;
+	image_area_mag(btmp, r, Npoly, Adisk, vdisk, out, NULL, &vcache);  
+	Atest=fmax(mg0,Adisk);//escalate if the polygon finds more magnification than the estimate
+	Cdisk=btmp;
 	Nsum+=Npoly;
       }
-      //if(debug)cout<<" Npoly="<<Npoly<<" < "<<Npoly_max<<" N2scale="<<N2scale<<" extra_area="<<extra_area<<" Npoly="<<Npoly<<endl;
-      //if(Npoly>Npoly_max*5)cout<<"Npoly="<<Npoly<<endl;
-    }
-    //Sanity check
-    if(Amag<1){
-      //if(1-Amag>1e-1)cout<<"impossible total magnification = "<<Amag<<" (polygon="<<do_polygon_test<<"), setting to mg0="<<mg0<<endl;
-      Amag=mg0;
+    };
+    if(source_LD_law==0 or source_LD_annuli<=1)disk_mag(source_radius,Amag,CoM,variance);
+    else {
+      //Limb darkening: We divide the source into annuli in x=r^2, each taken at its mean brightness B_j, so that the
+      //magnified flux is a sum over the uniform disks bounded by the annuli, F A = sum_j (B_j-B_{j+1}) G_j, where G=x A(x)
+      //and B_{K+1}=0.  With G'' estimated from the neighbouring annuli, the error of annulus j is about
+      //|dB_j G''| dx_j^2/12.  Starting from two annuli, we bisect the worst one (in mu=sqrt(1-x), which is finer toward
+      //the limb) until the error is within half the tolerance, up to source_LD_annuli.  Each disk tracks its vertex
+      //images from the last, where it can.
+      const double F=source_LD_flux(1);
+      vector<double> mu={1,0.5,0},x={0,0.75,1},G(3,0),V(3,0);
+      vector<Point> MG(3);
+      auto disk=[&](int j){
+	double Aj;
+	Point Cj;
+	disk_mag(source_radius*sqrt(x[j]),Aj,Cj,V[j]);
+	G[j]=x[j]*Aj;
+	MG[j]=Cj*G[j];
+      };
+      disk(2);
+      disk(1);
+      while(true){
+	int na=x.size()-1;
+	vector<double> B(na+2,0),slope(na+1),err(na+1);
+	for(int j=1;j<=na;j++){
+	  B[j]=(source_LD_flux(x[j])-source_LD_flux(x[j-1]))/(x[j]-x[j-1]);
+	  slope[j]=(G[j]-G[j-1])/(x[j]-x[j-1]);
+	}
+	Amag=0;
+	double errsum=0;
+	int jworst=1;
+	for(int j=1;j<=na;j++){
+	  Amag+=(B[j]-B[j+1])*G[j]/F;
+	  int jl=max(j-1,1),jr=min(j+1,na);
+	  double G2=(slope[jr]-slope[jl])/((x[jr]+x[jr-1])-(x[jl]+x[jl-1]))*2;
+	  double dI=source_LD_brightness(mu[j])-source_LD_brightness(mu[j-1]);
+	  err[j]=abs(dI*G2)*(x[j]-x[j-1])*(x[j]-x[j-1])/12/F;
+	  errsum+=err[j];
+	  if(err[j]>err[jworst])jworst=j;
+	}
+	if(errsum<=finite_source_tol*Amag/2 or na>=source_LD_annuli){
+	  Point M;
+	  variance=0;
+	  for(int j=1;j<=na;j++){
+	    M=M+MG[j]*((B[j]-B[j+1])/F);
+	    variance+=(B[j]-B[j+1])*x[j]*V[j]/F;
+	  }
+	  CoM=M*(1.0/Amag);
+	  break;
+	}
+	double mumid=(mu[jworst]+mu[jworst-1])/2;
+	mu.insert(mu.begin()+jworst,mumid);
+	x.insert(x.begin()+jworst,1-mumid*mumid);
+	G.insert(G.begin()+jworst,0);
+	V.insert(V.begin()+jworst,0);
+	MG.insert(MG.begin()+jworst,Point(0,0));
+	disk(jworst);
+      }
     }
+    //if(debug)cout<<" Npoly="<<Npoly<<" < "<<Npoly_max<<" N2scale="<<N2scale<<" extra_area="<<extra_area<<" Npoly="<<Npoly<<endl;
+    //if(Npoly>Npoly_max*5)cout<<"Npoly="<<Npoly<<endl;
+  }
+  //Sanity check
+  if(Amag<1){
+    //if(1-Amag>1e-1)cout<<"impossible total magnification = "<<Amag<<" (polygon="<<do_polygon_test<<"), setting to mg0="<<mg0<<endl;
+    Amag=mg0;
+  }
 
-    if(not do_polygon)cout<<" didn't do polygon"<<endl;
-    //Pack it back up
-    //cout<<"COM="<<CoM.x<<" "<<CoM.y<<endl;
-    thetas_series[i]=vector<Point>(1,CoM-b); //Note we return lenght-1 vector with the overall image centroid offset.
-    mag_series[i]=Amag;
-    //if(variance<0 or not isfinite(variance)){cout<<"variance weird after image_area_mag"<<endl;exit(0);}
-    dmag_series[i]=sqrt(variance)*source_var;
-    //cout<<i<<" mg0="<<mg0<<" Amag="<<Amag<<endl;
+  if(not do_polygon)cout<<" didn't do polygon"<<endl;
+  //Pack it back up
+  //cout<<"COM="<<CoM.x<<" "<<CoM.y<<endl;
+  centroid=CoM-b; //Note we return a single "image" with the overall image centroid offset.
+  mag_out=Amag;
+  //if(variance<0 or not isfinite(variance)){cout<<"variance weird after image_area_mag"<<endl;exit(0);}
+  dmag_out=sqrt(variance)*source_var;
+  //cout<<i<<" mg0="<<mg0<<" Amag="<<Amag<<endl;
 
-    //cout<<Npoly<<" "<<tgrid<<" "<<Amag<<endl;
-    
-    //if(not isfinite(variance) or debug and do_polygon_test){
-    //#pragma omp critical    
-      //cout<<"Npoly="<<Npoly<<" Amag="<<Amag<<" var="<<variance<<endl;
-    //}
-  }
-  unset_time_dependent_values();
+  //cout<<Npoly<<" "<<tgrid<<" "<<Amag<<endl;
+  
+  //if(not isfinite(variance) or debug and do_polygon_test){
+  //#pragma omp critical    
+    //cout<<"Npoly="<<Npoly<<" Amag="<<Amag<<" var="<<variance<<endl;
+  //}
+  return Nsum;
+};
 
-  if(debug){
-#pragma omp critical
-    cout<<"Nsum="<<Nsum<<endl;
-  }
-    
-  if(Neval<Ngrid){//Need to reconstitute full grid by interpolation.
-    //cout<<"Neval<Ngrid: "<<Neval<<"<"<<Ngrid<<endl;
-    //cout<<"len(thetas)="<<thetas_series.size()<<endl;
-    int imap=0;
-    double t0,t1,m0,m1,v0,v1;
-    Point c0,c1;
-    vector<double>full_mag_series(Ngrid);
-    vector<double>full_dmag_series(Ngrid);
-    vector<vector<Point> > full_thetas_series(Ngrid);
+///If mags_out is given, the magnification of each sample i is written to mags_out[i] (and its uncertainty to
+///dmag_out[i], if given) instead, and res is left untouched.
+void GLens::finite_source_compute_trajectory (const Trajectory &traj, TrajectoryResult &res, ostream *out, double *mags_out, double *dmag_out){
+  //Can optionally provide out stream to which to write image curves.
+  const bool debug=false;
+
+  //decimation
+  double decimate_dtmin=source_radius*finite_source_decimate_dtmin;
+
+  //diagnostics
+  bool diagnose=false;
+  static int d_count=0,d_N=0,d_every=500000;
+  static double d_time=0,d_rho,t_rho,t_N;
+  double tstart=omp_get_wtime();
+  int Nsum=0;
+
+  int Ngrid=traj.Nsamples();
+  vector<double>full_time_series(Ngrid);
+  for(int i=0; i<Ngrid;i++)full_time_series[i]=traj.get_obs_time(i);
+  //Results for each sample, filled in only for the evaluated ones
+  vector<double>mag_all(Ngrid),dmag_all(Ngrid);
+  vector<Point>centroid_all(Ngrid);
+  vector<bool>evaluated(Ngrid,false);
+
+  //The epochs are independent, but their cost varies greatly, from the leading-order estimate alone to many polygon
+  //passes near caustic crossings.  With finite_source_threads>1 they are scheduled dynamically over the threads, each
+  //with its own working copy of the lens, so no mutable state is shared.  Image curves written to out stay serial, in order
+  //of evaluation.
+  if(caustic_window>0 and not time_dependent and finite_source_threads>1)compute_caustics();//for the working copies to inherit
+  auto evaluate=[&](const vector<int> &batch){
+    int nbatch=batch.size();
+    int nthreads=min(finite_source_threads,nbatch);
+    if(out or omp_get_active_level()>=omp_get_max_active_levels())nthreads=1;
+    if(nthreads<=1){
+      for(int k=0; k<nbatch;k++){
+	int i=batch[k];
+	if(finite_source_deterministic)have_saved_soln=false;
+	Nsum+=finite_source_mag(traj,full_time_series[i],mag_all[i],dmag_all[i],centroid_all[i],out);
+      }
+    } else {
+      int nsum=0;
+      prepare_work_lenses(nthreads);
+#pragma omp parallel num_threads(nthreads) reduction(+:nsum)
+      {
+	GLens *worklens=work_lenses.lenses[omp_get_thread_num()];
+#pragma omp for schedule(dynamic,1)
+	for(int k=0; k<nbatch;k++){
+	  int i=batch[k];
+	  if(finite_source_deterministic)worklens->have_saved_soln=false;
+	  nsum+=worklens->finite_source_mag(traj,full_time_series[i],mag_all[i],dmag_all[i],centroid_all[i],NULL);
+	}
+      }
+      Nsum+=nsum;
+    }
+    for(int i:batch)evaluated[i]=true;
+  };
+
+  if(adaptive_tol>0 and Ngrid>0){
+    ///With adaptive_tol set, the fixed decimation generalizes to adaptive sampling as in
+    ///compute_trajectory_adaptive.  We evaluate every adaptive_stride-th sample (and the last), then bisect the
+    ///intervals between evaluated samples breadth-first, so that each pass is one batch over the threads.  The
+    ///interval is refined where the magnification at the midpoint differs from the linear interpolant of the end
+    ///points by more than adaptive_tol, or where it overlaps the time the source takes to cross a caustic
+    ///(widened by caustic_window).  In the latter case we stop at intervals shorter than decimate_dtmin.
+    vector<double> crossings,crossing_dt;
+    find_caustic_crossings(traj,crossings);
+    for(double tc:crossings){
+      set_time_dependent_values(tc);
+      Point v=get_obs_vel(traj,tc);
+      crossing_dt.push_back((source_radius+caustic_window)/sqrt(v.x*v.x+v.y*v.y));
+    }
+    unset_time_dependent_values();
+    int Ncross=crossings.size();
+    vector<int> batch;
+    for(int i=0;i<Ngrid;i+=adaptive_stride)batch.push_back(i);
+    if(batch.back()!=Ngrid-1)batch.push_back(Ngrid-1);
+    evaluate(batch);
+    vector<array<int,2> > intervals,next_intervals;
+    for(size_t k=0;k+1<batch.size();k++)intervals.push_back({{batch[k],batch[k+1]}});
+    while(intervals.size()>0){
+      batch.clear();
+      for(auto &iv:intervals)if(iv[1]-iv[0]>1)batch.push_back((iv[0]+iv[1])/2);
+      evaluate(batch);
+      next_intervals.clear();
+      for(auto &iv:intervals){
+	int ia=iv[0],ib=iv[1];
+	if(ib-ia<=1)continue;
+	int im=(ia+ib)/2;
+	double ta=full_time_series[ia],tb=full_time_series[ib],tm=full_time_series[im];
+	bool refine=false;
+	if(tb-ta>decimate_dtmin)for(int k=0;k<Ncross and not refine;k++)
+	  refine=(crossings[k]+crossing_dt[k]>=ta and crossings[k]-crossing_dt[k]<=tb);
+	double est=(mag_all[ib]*(tm-ta)+mag_all[ia]*(tb-tm))/(tb-ta);
+	if(not refine)refine=not (abs(est-mag_all[im])<=adaptive_tol*mag_all[im]);
+	if(refine){
+	  next_intervals.push_back({{ia,im}});
+	  next_intervals.push_back({{im,ib}});
+	}
+      }
+      intervals.swap(next_intervals);
+    }
+  } else {
+    //Fixed decimation
+    vector<int> batch;
+    double tlast=-INFINITY;
+    for(int i=0; i<Ngrid;i++){
+      if(i+2>=Ngrid or full_time_series[i+1]-tlast>=decimate_dtmin){
+	batch.push_back(i);
+	tlast=full_time_series[i];
+      }
+    }
+    evaluate(batch);
+  }
+
+  //The evaluated (decimated) samples, with the image centroid offsets
+  vector<int>time_series_map;
+  vector<double>time_series,mag_series,dmag_series;
+  vector<Point>centroid_series;
+  for(int i=0; i<Ngrid;i++)if(evaluated[i]){
+      time_series_map.push_back(i);
+      time_series.push_back(full_time_series[i]);
+      mag_series.push_back(mag_all[i]);
+      dmag_series.push_back(dmag_all[i]);
+      centroid_series.push_back(centroid_all[i]);
+    }
+  int Neval=time_series.size();
+  //cout<<"Neval="<<Neval<<" < "<<Ngrid<<endl;
+  unset_time_dependent_values();
+
+  if(debug){
+#pragma omp critical
+    cout<<"Nsum="<<Nsum<<endl;
+  }
+    
+  //Pack up the results, reconstituting the full grid by interpolation if needed
+  if(not mags_out)res.clear();
+  if(Neval<Ngrid){
+    //cout<<"Neval<Ngrid: "<<Neval<<"<"<<Ngrid<<endl;
+    int imap=0;
+    double t0,t1,m0,m1,v0,v1;
+    Point c0,c1;
     for(int i=0; i<Ngrid;i++){
       if(imap==0 or ( imap+1<time_series_map.size() and time_series_map[imap]<=i ) ){
 	//cout<<"imap="<<imap<<endl;
@@ -1989,45 +2806,36 @@ void GLens::finite_source_compute_trajectory (const Trajectory &traj, vector<dou
 	m1=mag_series[imap+1];
 	v0=dmag_series[imap];
 	v1=dmag_series[imap+1];
-	c0=thetas_series[imap][0];
-	c1=thetas_series[imap+1][0];
+	c0=centroid_series[imap];
+	c1=centroid_series[imap+1];
 	imap++;
       }
       double t=full_time_series[i];
       //fill values by linear interpolation, minimizing issues when edges are not smooth
-      full_mag_series[i]=(m1*(t-t0)+m0*(t1-t))/(t1-t0);
-      full_dmag_series[i]=(v1*(t-t0)+v0*(t1-t))/(t1-t0);
-      vector<Point> thetas;
-      thetas.push_back((c1*(t-t0)+c0*(t1-t))*(1.0/(t1-t0)));
-      full_thetas_series[i]=thetas;
+      double m=(m1*(t-t0)+m0*(t1-t))/(t1-t0);
+      double v=(v1*(t-t0)+v0*(t1-t))/(t1-t0);
+      if(mags_out){
+	mags_out[i]=m;
+	if(dmag_out)dmag_out[i]=v;
+	continue;
+      }
+      Point c=(c1*(t-t0)+c0*(t1-t))*(1.0/(t1-t0));
+      res.push_back(t,m,v,Images(1,c),&m);
       /*
       cout<<"i="<<i<<endl;
-      cout<<"  t: "<<t0<<", "<<t1<<" -> "<<full_time_series[i]<<endl;
-      cout<<"  m: "<<m0<<", "<<m1<<" -> "<<full_mag_series[i]<<endl;
-      cout<<"  v: "<<v0<<", "<<v1<<" -> "<<full_dmag_series[i]<<endl;
-      cout<<" cx: "<<c0.x<<", "<<c1.x<<" -> "<<full_thetas_series[i][0].x<<endl;
-      cout<<" cy: "<<c0.y<<", "<<c1.y<<" -> "<<full_thetas_series[i][0].y<<endl;
+      cout<<"  t: "<<t0<<", "<<t1<<" -> "<<t<<endl;
+      cout<<"  m: "<<m0<<", "<<m1<<" -> "<<m<<endl;
+      cout<<"  v: "<<v0<<", "<<v1<<" -> "<<v<<endl;
+      cout<<" cx: "<<c0.x<<", "<<c1.x<<" -> "<<c.x<<endl;
+      cout<<" cy: "<<c0.y<<", "<<c1.y<<" -> "<<c.y<<endl;
       */
     }
-    /*
-    cout<<"sizes time:"<<time_series.size()<<" -> "<<full_time_series.size()<<endl;
-    cout<<"sizes  mag:"<<mag_series.size()<<" -> "<<full_mag_series.size()<<endl;
-    cout<<"sizes dmag:"<<dmag_series.size()<<" -> "<<full_dmag_series.size()<<endl;
-    cout<<"sizes thts:"<<thetas_series.size()<<" -> "<<full_thetas_series.size()<<endl;
-    */
-
-    //now copy back:
-    mag_series=full_mag_series;
-    dmag_series=full_dmag_series;
-    thetas_series=full_thetas_series;
-    time_series=full_time_series;
+  } else if(mags_out){
+    copy(mag_series.begin(),mag_series.end(),mags_out);
+    if(dmag_out)copy(dmag_series.begin(),dmag_series.end(),dmag_out);
+  } else {
+    for(int i=0; i<Neval;i++)res.push_back(time_series[i],mag_series[i],dmag_series[i],Images(1,centroid_series[i]),&mag_series[i]);
   }
-  /*
-  cout<<"sizes time:"<<time_series.size()<<endl;
-  cout<<"sizes  mag:"<<mag_series.size()<<endl;
-  cout<<"sizes dmag:"<<dmag_series.size()<<endl;
-  cout<<"sizes thts:"<<thetas_series.size()<<endl;
-  */
 
   if(diagnose){
     double dt=omp_get_wtime()-tstart;
@@ -2049,86 +2857,85 @@ void GLens::finite_source_compute_trajectory (const Trajectory &traj, vector<dou
   }
 };
     
-//Use GSL routine to integrate 
-void GLens::compute_trajectory (const Trajectory &traj, vector<double> &time_series, vector<vector<Point> > &thetas_series, vector<int> &index_series,vector<double>&mag_series,vector<double> &dmag, bool integrate)
-{
-  // Given a trajectory through the observer plane, and a list of observation times, integrate the Jacobian to yield the corresponding trajectory in the lens plane.
-  //
-  //Arguments:
-  //
-  //Trajectory traj       -provides information about the trajectory of early thorough the observer plane.
-  //traj->times  -provides a list of observation times to be included in the sample set 
-  //vector<double> theta  -yields the resulting thetas for all sample times
-  //vector<int> grid_idxs -has lenght of "times" and yield index values for the location of the corresponding results within the larger "theta" vector.
-  //bool integrate (false for direct polynomial evaluation rather than integration. 
-  //  if use_integrate is set then the value it overrides integrate 
-  //
-  //cout<<"lens="<<print_info()<<endl;
-  //cout<<"compute_trajectory for traj="<<traj.print_info()<<endl;
-
-  if(do_finite_source&&source_radius>0){//For finite-sources, we use a different approach
-    //ostringstream oss;oss<<"curves_"<<source_radius<<".dat";
-    //ofstream out(oss.str());
-    //finite_source_compute_trajectory( traj, time_series, thetas_series, mag_series, dmag, &out);
-    finite_source_compute_trajectory( traj, time_series, thetas_series, mag_series, dmag, finite_source_image_ofstream);
-    int n=time_series.size();
-    index_series.resize(n);
-    for(int i=0;i<n;i++)index_series[i]=i;
-    return;
+///Magnification of a set of images, as mag(thetas), also returning the signed magnifications of each in mus
+double GLens::image_mags(const Images &thetas, double *mus){
+  double m=0;
+  for(int k=0;k<thetas.size();k++){
+    mus[k]=mag(thetas[k]);
+    m+=abs(mus[k]);
   }
-  
+  if(thetas.size()==0)return 1;
+  return m;
+};
+
+///The point-source loop of compute_trajectory over samples i0<=i<i1 of the trajectory, appending to res.
+///The caustic crossings (with time half-widths crossing_dt) must already be in caustic_crossings.
+///If mags_out is given, the magnification of each sample i is written to mags_out[i-i0] instead, and res is
+///left untouched.
+void GLens::compute_trajectory_range(const Trajectory &traj, int i0, int i1, bool integrate, const vector<double> &crossing_dt, TrajectoryResult &res, double *mags_out){
   //control parameters:
   double caustic_mag_poly_level = GL_int_mag_limit; //use direct polynomial eval near caustics.
   const double intTOL = GL_int_tol;  //control integration error tolerance
-  const double test_result_tol = 1e-4;  //control integration error tolerance
-  if(have_integrate)integrate=use_integrate;
-  double prec=cout.precision();cout.precision(20);
   const double rWide_int_fac=100.0;
 
-  
-  //cout<<"glens::compTraj: int="<<integrate<<"\nthisLens="<<print_info()<<"\n traj="<<traj.print_info()<<endl;
-  //cout<<"this="<<this<<endl;
-  cout.precision(prec);
-
-  ///clear the outputs
-  time_series.clear();
-  thetas_series.clear();
-  index_series.clear();
-  mag_series.clear();
-
+  if(adaptive_tol>0){
+    compute_trajectory_adaptive(traj,i0,i1,crossing_dt,res,mags_out);
+    return;
+  }
+  if(integrate and use_int_roots){
+    compute_trajectory_integrate_roots(traj,i0,i1,crossing_dt,res,mags_out);
+    return;
+  }
   trajectory=&traj;//a convenience for passing to the integrator
   int NintSize=2*NimageMax;
+  int Ncross=caustic_crossings.size();
+  int icross=0;
 
-  //Set up for GSL integration routines
-  const gsl_odeiv2_step_type * stepType = gsl_odeiv2_step_rkf45;
-  gsl_odeiv2_step * step=nullptr;
-  gsl_odeiv2_control * control=nullptr;
-  gsl_odeiv2_evolve * evol=nullptr;
-  gsl_odeiv2_system sys = {GLens::GSL_integration_func_vec, NULL, (size_t)NintSize, this};
-  double h=1e-5;
+  //Set up the image integrator
+  const double h_start=1e-5;
+  double h=h_start;
   if(integrate){
-    step = gsl_odeiv2_step_alloc (stepType, NintSize);
-    control = gsl_odeiv2_control_y_new (intTOL, 0.0);
-    //control = gsl_odeiv2_control_standard_new (intTOL, 0.0,1.0,10.0);//Also apply limits on the derivative
-    evol = gsl_odeiv2_evolve_alloc (NintSize);
-    gsl_odeiv2_control_init(control,intTOL,0.0,1,0);//Do I need this?
-    gsl_odeiv2_evolve_reset(evol);//or this
+    integrator.set_tol(intTOL);
+    integrator.set_hmin(GL_int_hmin);
+    integrator.reset();
   }
 
   //Main loop over observation times specified in the Trajectory object
   //initialization
   Point beta;
-  vector<Point> thetas;
+  Images thetas;
   bool evolving=false;
   double mg;
+  double mus[Images::capacity];
   have_saved_soln=false;
 
-  int Ngrid=traj.Nsamples();
-  double t_old=-1e100;
-  for(int i=0; i<Ngrid;i++){    
+  //Without integration, and for a lens which is not time-dependent, the polynomial solutions are
+  //independent of the loop below, so we can invert all the points up front in one batch.
+  bool batch=(not integrate) and (not time_dependent) and (not use_newton);
+  bool tracking=false;//true when the last images came from Newton continuation
+  vector<double> batch_bx,batch_by,batch_img_x,batch_img_y;
+  vector<int> batch_img_offset;
+  if(batch){
+    vector<double> batch_t(i1-i0);
+    batch_bx.resize(i1-i0);
+    batch_by.resize(i1-i0);
+    for(int i=i0; i<i1;i++)batch_t[i-i0]=traj.get_obs_time(i);
+    get_obs_pos_batch(traj,batch_t.data(),i1-i0,batch_bx.data(),batch_by.data());
+    invmap_batch(batch_bx.data(),batch_by.data(),i1-i0,batch_img_offset,batch_img_x,batch_img_y);
+  }
+  double t_old=(i0>0?traj.get_obs_time(i0-1):-1e100);
+  for(int i=i0; i<i1;i++){    
     double tgrid=traj.get_obs_time(i);
     //entering main loop
 
+    //Check whether the interval since the last sample overlaps a caustic-crossing window
+    bool near_crossing=false;
+    if(Ncross>0){
+      while(icross<Ncross and caustic_crossings[icross]+crossing_dt[icross]<t_old)icross++;
+      near_crossing=(icross<Ncross and caustic_crossings[icross]-crossing_dt[icross]<=tgrid);
+    }
+    if(near_crossing)evolving=false;
+
     //We either compute the next step by evolution or by polynomial evaluation.
     //We do evolution is the integration flag is set *and* the last evaluated point had a
     //magnification under caustic_mag_poly_level.
@@ -2161,24 +2968,23 @@ void GLens::compute_trajectory (const Trajectory &traj, vector<double> &time_ser
 
 	}
 	for(int k=2*thetas.size();k<NintSize;k++)theta[k]=0;
-	int status = gsl_odeiv2_evolve_apply (evol, control, step, &sys, &t, tgrid, &h, theta);
+	bool status = evolve_images(t, tgrid, h, theta);
 	set_time_dependent_values(t);
 	//Need some step-size control checking for near caustics?
-	if (status != GSL_SUCCESS) { 
+	if (not status) { 
 	  evolving=false;//switch to polynomial
+	  h=h_start;//the failed step may have left h tiny
 	  break;
 	}
 	//record results
 	for(int image=0;image<thetas.size();image++){
 	  thetas[image]=Point(theta[2*image],theta[2*image+1]);	    
 	}
-	mg=mag(thetas);
+	mg=image_mags(thetas,mus);
 	if(mg>=caustic_mag_poly_level)evolving=false;//switch to polynomial and don't record result
 	else {
 	  if(debugint)cout<<"mg="<<mg<<endl;
-	  time_series.push_back(t);
-	  thetas_series.push_back(thetas);
-	  mag_series.push_back(mg);
+	  if(not mags_out)res.push_back(t,mg,0,thetas,mus);
 	  if(!isfinite(mg)){
 	    cout<<"integrate: mg is infinite!\n";
 	    for(int image=0;image<thetas.size();image++){
@@ -2193,16 +2999,33 @@ void GLens::compute_trajectory (const Trajectory &traj, vector<double> &time_ser
       }
     } else { //not evolving, solve polynomial
       set_time_dependent_values(tgrid);
-      beta=get_obs_pos(traj,tgrid);
       //cout<<i<<" t="<<tgrid<<" b=("<<beta.x<<","<<beta.y<<")"<<endl;
       //cout<<"Not evolving: beta=("<<beta.x<<","<<beta.y<<")"<<endl;
-      thetas.clear();
-      thetas=invmap(beta);
+      bool tracked=false;
+      if(use_newton and i>i0){
+	//Try continuing the images from the last sample, otherwise solve afresh
+	if(not near_crossing){
+	  beta=get_obs_pos(traj,tgrid);
+	  Images thetas_new=thetas;
+	  tracked=newton_track_images(beta,thetas_new);
+	  if(tracked)thetas=thetas_new;
+	}
+	if(tracking and not tracked)have_saved_soln=false;//the saved roots are stale
+      }
+      tracking=tracked;
+      if(not tracked){
+	thetas.clear();
+	if(batch){
+	  beta=Point(batch_bx[i-i0],batch_by[i-i0]);
+	  for(int k=batch_img_offset[i-i0];k<batch_img_offset[i-i0+1];k++)thetas.push_back(Point(batch_img_x[k],batch_img_y[k]));
+	} else {
+	  beta=get_obs_pos(traj,tgrid);
+	  thetas=invmap(beta);
+	}
+      }
       //record results;
-      mg=mag(thetas);
-      time_series.push_back(tgrid);
-      thetas_series.push_back(thetas);
-      mag_series.push_back(mg);
+      mg=image_mags(thetas,mus);
+      if(not mags_out)res.push_back(tgrid,mg,0,thetas,mus);
       //cout<<"mg="<<mg<<", caustic_mag_poly_level="<<caustic_mag_poly_level<<endl;
       if(integrate&&mg<caustic_mag_poly_level){
 	double r2=beta.x*beta.x+beta.y*beta.y;
@@ -2210,7 +3033,7 @@ void GLens::compute_trajectory (const Trajectory &traj, vector<double> &time_ser
 	if(testWide(beta,rWide_int_fac))evolving=false;//Don't switch if in "wide" domain.
 	//if(!evolving)cout<<"not evol: testWide==true"<<endl;
 	if(!(thetas.size()==3||thetas.size()==5))evolving=false;//Don't switch to integrate if the number of images doesn't make sense
-	if(evolving)gsl_odeiv2_evolve_reset(evol);
+	if(evolving)integrator.reset();
       };
       if(!isfinite(mg)){
 	//We do some specific handling for GLensBinary here, could be cleaned up...
@@ -2239,251 +3062,367 @@ void GLens::compute_trajectory (const Trajectory &traj, vector<double> &time_ser
     }//end of polynomial step
     unset_time_dependent_values();
 
-    if(time_series.size()<1)cout<<"Time series empty i="<<i<<endl;
     t_old=tgrid;
-    index_series.push_back(time_series.size()-1);
-  }//end of main observation times loop
-
-  if(integrate){
-    gsl_odeiv2_evolve_free (evol);
-    gsl_odeiv2_control_free (control);
-    gsl_odeiv2_step_free (step);
-  }
-
-  if(test_result){
-  //initialization
-    for(int i=0; i<Ngrid;i++){
-      double ttest=traj.get_obs_time(i);
-      set_time_dependent_values(ttest);
-      int ires=index_series[i];
-      double tres=time_series[ires];
-      Point beta=get_obs_pos(traj,ttest);
-      vector<Point> thetas=invmap(beta);
-      int nimages=thetas.size();
-      double mgtest=mag(thetas);
-      unset_time_dependent_values();
-      double mgres=mag_series[ires];
-      double tminus,tplus,mgminus,mgplus;
-      if(ires>0&&ires<time_series.size()-1){
-	tminus=time_series[ires-1];
-	tplus=time_series[ires+1];
-	set_time_dependent_values(tminus);
-	beta=get_obs_pos(traj,tminus);
-	thetas=invmap(beta);
-	mgminus=mag(thetas);
-	set_time_dependent_values(tplus);
-	beta=get_obs_pos(traj,tplus);
-	thetas=invmap(beta);
-	mgplus=mag(thetas);
-	unset_time_dependent_values();
-      }
-
-      if(abs(mgtest-mgres)/mgtest>test_result_tol)
-#pragma omp critical
-	{
-	cout<<"\ncompute_trajectory: test failed. test/res:\nindex="<<i<<","<<ires<<"\ntime="<<ttest<<","<<tres<<"\nmag="<<mgtest<<","<<mgres<<" -> "<<abs(mgtest-mgres)<<"["<<nimages<<" images]"<<endl;
-	cout<<"beta=("<<beta.x<<","<<beta.y<<")"<<endl;
-	if(ires>0&&ires<time_series.size()-1){
-	  cout<<"nearby times  :"<<tminus<<" < t < "<<tplus<<endl;
-	  cout<<"   with mags  :"<<mgminus<<" < mg < "<<mgplus<<endl;
-	}
-	//if(i>0&&ires<index_series.size()-1)cout<<"nearby idx times:"<<time_series[index_series[i-1]]<<" < t < "<<time_series[index_series[i+1]]<<endl;
-      }
+    if(mags_out){
+      mags_out[i-i0]=mg;
+      continue;
     }
-  }
-
-}
-
-
+    if(res.size()<1)cout<<"Time series empty i="<<i<<endl;
+    res.index.push_back(res.size()-1);
+  }//end of main observation times loop
 
-/* Under development
-//Use GSL routine to integrate polynomial roots
-void GLens::compute_trajectory_integrate_roots (const Trajectory &traj, vector<double> &time_series, vector<vector<Point> > &thetas_series, vector<int> &index_series,vector<double>&mag_series,vector<double> &dmag)
-{
-  // Given a trajectory through the observer plane, and a list of observation times, integrate the Jacobian to yield the corresponding trajectory in the lens plane.
-  //
-  //Arguments:
-  //
-  //Trajectory traj       -provides information about the trajectory of early thorough the observer plane.
-  //traj->times  -provides a list of observation times to be included in the sample set 
-  //vector<double> theta  -yields the resulting thetas for all sample times
-  //vector<int> grid_idxs -has lenght of "times" and yield index values for the location of the corresponding results within the larger "theta" vector.
-  //bool integrate (false for direct polynomial evaluation rather than integration. 
-  //  if use_integrate is set then the value it overrides integrate 
-  //
-  //cout<<"lens="<<print_info()<<endl;
-  //cout<<"compute_trajectory for traj="<<traj.print_info()<<endl;
+};
 
-  //control parameters:
-  double caustic_mag_poly_level = GL_int_mag_limit; //use direct polynomial eval near caustics.
-  const double intTOL = GL_int_tol;  //control integration error tolerance
-  const double test_result_tol = 1e-4;  //control integration error tolerance
-  if(have_integrate)integrate=use_integrate;
-  double prec=cout.precision();cout.precision(20);
+///Root-integration version of compute_trajectory_range.
+///
+///Here we integrate all the roots of the lens polynomial (see poly_roots), including the ghost roots which are
+///not images.  At a caustic crossing a pair of ghost roots merges into a pair of images, or the reverse, so
+///the nearness of any near-real root pair to merging (see root_images) warns of a crossing before it happens.
+///We integrate wherever that is at least int_roots_gap and the image count is unchanged, without the magnification limit of
+///the image integration, and otherwise solve the polynomial.  The caustic-crossing windows and the wide-binary
+///test apply as in compute_trajectory_range.  The images are polished on the lens equation at each sample (see
+///below), so the magnifications agree with the polynomial solution to about 1e-9 (q=1e-3 near the resonant
+///caustic) or better.  With samples as sparse as those of test/m4-test (about 0.01 tE apart) the integration
+///takes several steps per sample, and is several times slower than solving the polynomial.
+void GLens::compute_trajectory_integrate_roots(const Trajectory &traj, int i0, int i1, const vector<double> &crossing_dt, TrajectoryResult &res, double *mags_out){
   const double rWide_int_fac=100.0;
-
-  cout.precision(prec);
-
-  ///clear the outputs
-  time_series.clear();
-  thetas_series.clear();
-  index_series.clear();
-  mag_series.clear();
-
   trajectory=&traj;//a convenience for passing to the integrator
-  int NintSize=2*NimageMax;
-
-  //Set up for GSL integration routines
-  const gsl_odeiv2_step_type * stepType = gsl_odeiv2_step_rkf45;
-  gsl_odeiv2_step * step=nullptr;
-  gsl_odeiv2_control * control=nullptr;
-  gsl_odeiv2_evolve * evol=nullptr;
-  gsl_odeiv2_system sys = {GLens::GSL_integration_func_vec, NULL, (size_t)NintSize, this};
-  double h=1e-5;
-  step = gsl_odeiv2_step_alloc (stepType, NintSize);
-  control = gsl_odeiv2_control_y_new (intTOL, 0.0);
-  //control = gsl_odeiv2_control_standard_new (intTOL, 0.0,1.0,10.0);//Also apply limits on the derivative
-  evol = gsl_odeiv2_evolve_alloc (NintSize);
-  gsl_odeiv2_control_init(control,intTOL,0.0,1,0);//Do I need this?
-  gsl_odeiv2_evolve_reset(evol);//or this
-
+  int Ncross=caustic_crossings.size();
+  int icross=0;
+  const double h_start=1e-5;
+  double h=h_start;
+  integrator.set_tol(GL_int_tol);
+  integrator.set_hmin(GL_int_hmin);
+  integrator.reset();
 
-  //Main loop over observation times specified in the Trajectory object
-  //initialization
   Point beta;
-  vector<Point> thetas;
+  Images thetas;
+  double roots[2*Images::capacity];
+  int nroots=0,nimg=0;
   bool evolving=false;
-  double mg;
+  double mg=0;
+  double mus[Images::capacity];
   have_saved_soln=false;
-
-  int Ngrid=traj.Nsamples();
-  double t_old=-1e100;
-  for(int i=0; i<Ngrid;i++){    
+  double t_old=(i0>0?traj.get_obs_time(i0-1):-1e100);
+  //The flow conserves the map residual of the images, so errors in the starting roots (the polynomial is poorly
+  //conditioned near a small mass) and in the steps would persist.  At each sample we polish the images among the
+  //roots by Newton iteration on the lens equation, and put them back among the roots.  If the polishing fails
+  //we go back to the polynomial.
+  auto polish_images=[&](const Point &b, Images &images){
+    Images polished=images;
+    if(not GLens::newton_track_images(b,polished))return false;
+    for(int k=0;k<images.size();k++)for(int j=0;j<nroots;j++){
+	if(roots[2*j]==images[k].x and roots[2*j+1]==images[k].y){
+	  roots[2*j]=polished[k].x;
+	  roots[2*j+1]=polished[k].y;
+	}
+      }
+    images=polished;
+    integrator.reset();
+    return true;
+  };
+  for(int i=i0; i<i1;i++){
     double tgrid=traj.get_obs_time(i);
-    //entering main loop
-    
-    //test whether to evolve based on how close to "real" root pairs are...TBD
-    //also test for wide binary (at target time) and test "have_roots"
-    if(evolve){
+
+    //Check whether the interval since the last sample overlaps a caustic-crossing window
+    bool near_crossing=false;
+    if(Ncross>0){
+      while(icross<Ncross and caustic_crossings[icross]+crossing_dt[icross]<t_old)icross++;
+      near_crossing=(icross<Ncross and caustic_crossings[icross]-crossing_dt[icross]<=tgrid);
+    }
+    if(near_crossing)evolving=false;
+
+    if(evolving){
       double t=t_old;
-      //The next loop steps (probably more finely) toward the next grid time point.      
       while(t<tgrid){
-	//integrate each root
-	vector<Point>roots;
-	double theta[NintSize];
-	for(int iroot=0;iroot<roots.size();iroot++){
-	  theta[2*iroot]=thetas[iroot].x;
-	  theta[2*iroot+1]=thetas[iroot].y;
-	}
-	for(int k=2*thetas.size();k<NintSize;k++)theta[k]=0;
-	int status = gsl_odeiv2_evolve_apply (evol, control, step, &sys, &t, tgrid, &h, theta);
-	//Need some step-size control checking for near caustics?
-	if (status != GSL_SUCCESS) { 
-	  evolving=false;//switch to polynomial
+	set_time_dependent_values(t);
+	if(testWide(get_obs_pos(traj,t),rWide_int_fac)){
+	  evolving=false;
 	  break;
 	}
-	//record results
-	for(int image=0;image<thetas.size();image++){
-	  thetas[image]=Point(theta[2*image],theta[2*image+1]);	    
+	bool status=evolve_roots(t, tgrid, h, roots, nroots);
+	set_time_dependent_values(t);
+	if(status){
+	  beta=get_obs_pos(traj,t);
+	  double gap=root_images(beta,roots,nroots,thetas);
+	  status=(gap>=int_roots_gap and thetas.size()==nimg);
+	  if(debugint)cout<<"roots: t="<<t<<" gap="<<gap<<" nimg="<<thetas.size()<<endl;
+	  if(status and t>=tgrid)status=polish_images(beta,thetas);
 	}
-	
-	//Now test again if that there are not  near real root pairs
-	//if it is s real root, then we can also check that magnification
-	//has not changed sign.  Does that generalize to ghost roots??
-	if(fail test) evolve=false;
-	else{
-	  time_series.push_back(t);
-	  thetas_series.push_back(thetas);
-	  mag_series.push_back(mg);//need to compute mg??
-	  if(!isfinite(mg)){
-	    cout<<"integrate: mg is infinite!\n";
-	    for(int image=0;image<thetas.size();image++){
-	      cout<<theta[2*image]<<","<<theta[2*image+1]<<endl;
-	    }	    
-	  }
+	if(not status){
+	  evolving=false;//switch to polynomial and don't record result
+	  h=h_start;//the failed step may have left h tiny
+	  break;
 	}
+	mg=image_mags(thetas,mus);
+	if(not mags_out)res.push_back(t,mg,0,thetas,mus);
       }
       if(!evolving){
 	i--;//go back and try this step again with solving polynomial
 	continue;
       }
     } else { //not evolving, solve polynomial
+      set_time_dependent_values(tgrid);
       beta=get_obs_pos(traj,tgrid);
-      //cout<<i<<" t="<<tgrid<<" b=("<<beta.x<<","<<beta.y<<")"<<endl;
-      //cout<<"Not evolving: beta=("<<beta.x<<","<<beta.y<<")"<<endl;
-      thetas.clear();
-      thetas=invmap(beta);//Want to use wittmag with nocheck directly instead to get all root
-      //record results?? First need to check roots tho...
-      mg=mag(thetas);
-      time_series.push_back(tgrid);
-      thetas_series.push_back(thetas);
-      mag_series.push_back(mg);
-      //cout<<"mg="<<mg<<", caustic_mag_poly_level="<<caustic_mag_poly_level<<endl;
-      if(integrate&&mg<caustic_mag_poly_level){
-	double r2=beta.x*beta.x+beta.y*beta.y;
-	evolving=true;
-	if(testWide(beta,rWide_int_fac))evolving=false;//Don't switch if in "wide" domain.
-	//if(!evolving)cout<<"not evol: testWide==true"<<endl;
-	if(!(thetas.size()==3||thetas.size()==5))evolving=false;//Don't switch to integrate if the number of images doesn't make sense
-	if(evolving)gsl_odeiv2_evolve_reset(evol);
-      };
-      if(!isfinite(mg)){
-	//We do some specific handling for GLensBinary here, could be cleaned up...
-	GLensBinary* gb;
-	bool squak=true;
-	if(gb=dynamic_cast< GLensBinary* > (this)){
-	  if(gb->get_q()<1e-14)squak=false;//we are going to fail with NAN, but not give a bunch of output, deal with it...
-	  else cout<<"q,L="<<gb->get_q()<<","<<gb->get_L()<<endl;
-	}
-	if(squak){
-	  cout<<"!integrate: mg is infinite! at beta="<<beta.x<<","<<beta.y<<endl;
-	  for(int image=0;image<thetas.size();image++){
-	    cout<<thetas[image].x<<","<<thetas[image].y<<" -> "<<mag(thetas[image])<<endl;
-	  }
-	  Trajectory::verbose=true;
-	  beta=get_obs_pos(traj,tgrid);
-	  alert();	 
-	  Trajectory::verbose=false;
-	}
+      thetas=invmap(beta);
+      mg=image_mags(thetas,mus);
+      if(not mags_out)res.push_back(tgrid,mg,0,thetas,mus);
+      if(!isfinite(mg))cout<<"integrate_roots: mg is infinite! at beta="<<beta.x<<","<<beta.y<<endl;
+      //Start integrating if the roots are well separated and include the images found by invmap.
+      if(not near_crossing and not testWide(beta,rWide_int_fac)){
+	nroots=poly_roots(beta,roots);
+	nimg=thetas.size();
+	Images root_thetas;
+	evolving=(nroots>0 and root_images(beta,roots,nroots,root_thetas)>=int_roots_gap and root_thetas.size()==nimg
+		  and polish_images(beta,root_thetas));
       }
-      if(debugint){
-	cout<<"polynomial calc at t="<<tgrid<<":"<<endl;
-	for(int image=0;image<thetas.size();image++)
-	  cout<<"   theta["<<image<<"] = ("<<thetas[image].x<<","<<thetas[image].y<<")"<<endl;
+    }
+    unset_time_dependent_values();
+
+    t_old=tgrid;
+    if(mags_out){
+      mags_out[i-i0]=mg;
+      continue;
+    }
+    res.index.push_back(res.size()-1);
+  }
+};
+
+///Adaptive version of compute_trajectory_range.
+///
+///We evaluate every adaptive_stride-th sample (and the last), then bisect each interval between evaluated
+///samples, by sample index.  The magnification at the midpoint is compared with the cubic Hermite
+///interpolant of the end-point magnifications and their time derivatives (from mag_rate).  Where the
+///relative difference exceeds adaptive_tol we evaluate the midpoint and recurse on both halves; otherwise
+///the remaining samples are interpolated, using the midpoint value, on each half.  We always refine where
+///the image count changes across the interval, or the interval overlaps a caustic-crossing window (or contains
+///a crossing, if there are no windows).  finite_source_compute_trajectory does the same for finite sources,
+///in place of its fixed decimation.  Every sample gets an entry in the outputs, but the image sets of interpolated samples are left empty.  The integration and Newton
+///continuation options do not apply here; each evaluated sample is inverted with invmap.
+void GLens::compute_trajectory_adaptive(const Trajectory &traj, int i0, int i1, const vector<double> &crossing_dt, TrajectoryResult &res, double *mags_out){
+  int n=i1-i0;
+  if(n<=0)return;
+  int Ncross=caustic_crossings.size();
+  vector<double> times(n),mags(n),rates(n);
+  vector<Images> images(n);
+  vector<array<double,Images::capacity> > mus(n);
+  vector<bool> evaluated(n,false);
+  for(int i=0;i<n;i++)times[i]=traj.get_obs_time(i0+i);
+  have_saved_soln=false;
+  auto evaluate=[&](int i){
+    double t=times[i];
+    set_time_dependent_values(t);
+    images[i]=invmap(get_obs_pos(traj,t));
+    mags[i]=image_mags(images[i],mus[i].data());
+    rates[i]=mag_rate(images[i],get_obs_vel(traj,t));
+    unset_time_dependent_values();
+    evaluated[i]=true;
+  };
+  auto hermite=[&](int a,int b,double t){
+    double h=times[b]-times[a],s=(t-times[a])/h,s2=s*s,s3=s2*s;
+    return (2*s3-3*s2+1)*mags[a]+(s3-2*s2+s)*h*rates[a]+(-2*s3+3*s2)*mags[b]+(s3-s2)*h*rates[b];
+  };
+  auto hermite_rate=[&](int a,int b,double t){
+    double h=times[b]-times[a],s=(t-times[a])/h,s2=s*s;
+    return ((6*s2-6*s)*(mags[a]-mags[b]))/h+(3*s2-4*s+1)*rates[a]+(3*s2-2*s)*rates[b];
+  };
+  auto fill=[&](int a,int b){
+    for(int i=a+1;i<b;i++)mags[i]=hermite(a,b,times[i]);
+  };
+  //Recursive bisection, left to right so that invmap can polish from nearby saved roots
+  vector<array<int,2> > stack;
+  int a=0;
+  evaluate(0);
+  while(a<n-1){
+    int b=min(a+adaptive_stride,n-1);
+    evaluate(b);
+    stack.push_back({{a,b}});
+    while(stack.size()>0){
+      int ia=stack.back()[0],ib=stack.back()[1];
+      stack.pop_back();
+      if(ib-ia<=1)continue;
+      int im=(ia+ib)/2;
+      bool refine=(images[ia].size()!=images[ib].size());
+      for(int k=0;k<Ncross and not refine;k++)
+	refine=(caustic_crossings[k]+crossing_dt[k]>=times[ia] and caustic_crossings[k]-crossing_dt[k]<=times[ib]);
+      double est=hermite(ia,ib,times[im]),est_rate=hermite_rate(ia,ib,times[im]);
+      evaluate(im);
+      //A narrow peak can pass the midpoint by chance, but not also match its slope there
+      if(not refine)refine=not (abs(est-mags[im])<=adaptive_tol*mags[im]
+				and abs(est_rate-rates[im])*(times[ib]-times[ia])<=2*adaptive_tol*mags[im]);
+      if(refine){
+	stack.push_back({{im,ib}});
+	stack.push_back({{ia,im}});
+      } else {
+	fill(ia,im);
+	fill(im,ib);
       }
-    }//end of polynomial step
-    if(time_series.size()<1)cout<<"Time series empty i="<<i<<endl;
-    t_old=tgrid;
-    index_series.push_back(time_series.size()-1);
-  }//end of main observation times loop
+    }
+    a=b;
+  }
+  if(mags_out){
+    copy(mags.begin(),mags.end(),mags_out);
+    return;
+  }
+  for(int i=0;i<n;i++){
+    res.push_back(times[i],mags[i],0,evaluated[i]?images[i]:Images(),mus[i].data());
+    res.index.push_back(res.size()-1);
+  }
+};
 
-  if(integrate){
-    gsl_odeiv2_evolve_free (evol);
-    gsl_odeiv2_control_free (control);
-    gsl_odeiv2_step_free (step);
+///Caustic-crossing segmentation: Between crossings the image count is fixed and we can integrate or
+///Newton-track the images.  In a window around each crossing we solve the polynomial at every sample.
+///This finds the crossings (into caustic_crossings) and the time half-widths of their windows.  Adaptive
+///sampling needs the crossings too, even without windows, since a brief excursion into a caustic can fall
+///between two coarse samples whose magnifications give no hint of it.
+void GLens::prepare_caustic_crossings(const Trajectory &traj, vector<double> &crossing_dt){
+  caustic_crossings.clear();
+  if(caustic_window>0 or adaptive_tol>0)find_caustic_crossings(traj,caustic_crossings);
+  int Ncross=caustic_crossings.size();
+  crossing_dt.resize(Ncross);
+  for(int k=0;k<Ncross;k++){
+    double tc=caustic_crossings[k];
+    set_time_dependent_values(tc);
+    Point v=get_obs_vel(traj,tc);
+    crossing_dt[k]=caustic_window/sqrt(v.x*v.x+v.y*v.y);
+  }
+  unset_time_dependent_values();
+};
+
+void GLens::prepare_work_lenses(int n){
+  vector<GLens*> &lenses=work_lenses.lenses;
+  if((int)lenses.size()<n)lenses.resize(n,nullptr);
+  for(int k=0;k<n;k++){
+    if(lenses[k] and assign_to(lenses[k]))continue;
+    delete lenses[k];
+    lenses[k]=clone();
+  }
+};
+
+///Magnifications only, at the trajectory's sample times.
+///
+///This is the light-curve part of compute_trajectory without the time, image and index series.  The
+///magnification of sample i goes to mags_out[i] and, if dmag_out is given, its uncertainty (nonzero only
+///for finite sources) to dmag_out[i].  The buffers must hold traj.Nsamples() values.  Integration steps
+///between samples are taken as in compute_trajectory, but not recorded.
+void GLens::compute_magnification(const Trajectory &traj, double *mags_out, double *dmag_out){
+  int Ngrid=traj.Nsamples();
+  if(do_finite_source&&source_radius>0){
+    TrajectoryResult no_result;
+    finite_source_compute_trajectory( traj, no_result, finite_source_image_ofstream, mags_out, dmag_out);
+    return;
+  }
+  bool integrate=(have_integrate and use_integrate);
+  vector<double> crossing_dt;
+  prepare_caustic_crossings(traj,crossing_dt);
+  //The range loops take a result, which stays empty when mags_out is given.
+  TrajectoryResult no_result;
+  //Each chunk writes to its own part of the buffer, so there is nothing to merge.
+  int nchunk=min(trajectory_chunks,Ngrid/min_chunk_samples);
+  if(nchunk<=1){
+    compute_trajectory_range(traj,0,Ngrid,integrate,crossing_dt,no_result,mags_out);
+  } else {
+    prepare_work_lenses(nchunk);
+#pragma omp parallel for schedule(dynamic,1)
+    for(int ic=0;ic<nchunk;ic++){
+      GLens *worklens=work_lenses.lenses[ic];
+      int i0=(Ngrid*(long)ic)/nchunk, i1=(Ngrid*(long)(ic+1))/nchunk;
+      TrajectoryResult chunk_result;
+      worklens->compute_trajectory_range(traj,i0,i1,integrate,crossing_dt,chunk_result,mags_out+i0);
+    }
+  }
+  if(dmag_out)fill(dmag_out,dmag_out+Ngrid,0.0);
+};
+
+//Use GSL routine to integrate 
+void GLens::compute_trajectory (const Trajectory &traj, TrajectoryResult &res, bool integrate)
+{
+  // Given a trajectory through the observer plane, and a list of observation times, integrate the Jacobian to yield the corresponding trajectory in the lens plane.
+  //
+  //Arguments:
+  //
+  //Trajectory traj       -provides information about the trajectory of early thorough the observer plane.
+  //traj->times  -provides a list of observation times to be included in the sample set 
+  //TrajectoryResult res  -yields the resulting times, magnifications and images for all samples, with res.index
+  //                       giving the location of the results for each of the trajectory's times.
+  //bool integrate (false for direct polynomial evaluation rather than integration. 
+  //  if use_integrate is set then the value it overrides integrate 
+  //
+  //cout<<"lens="<<print_info()<<endl;
+  //cout<<"compute_trajectory for traj="<<traj.print_info()<<endl;
+
+  if(do_finite_source&&source_radius>0){//For finite-sources, we use a different approach
+    //ostringstream oss;oss<<"curves_"<<source_radius<<".dat";
+    //ofstream out(oss.str());
+    //finite_source_compute_trajectory( traj, res, &out);
+    finite_source_compute_trajectory( traj, res, finite_source_image_ofstream);
+    int n=res.size();
+    res.index.resize(n);
+    for(int i=0;i<n;i++)res.index[i]=i;
+    return;
+  }
+  
+  const double test_result_tol = 1e-4;  //control integration error tolerance
+  if(have_integrate)integrate=use_integrate;
+
+  
+  //cout<<"glens::compTraj: int="<<integrate<<"\nthisLens="<<print_info()<<"\n traj="<<traj.print_info()<<endl;
+  //cout<<"this="<<this<<endl;
+
+  ///clear the outputs
+  res.clear();
+
+  vector<double> crossing_dt;
+  prepare_caustic_crossings(traj,crossing_dt);
+
+  int Ngrid=traj.Nsamples();
+
+  ///With trajectory_chunks>1 the samples are split into contiguous chunks which are computed in parallel,
+  ///each by its own working copy of the lens (with its own integrator state and saved roots).  Each chunk starts
+  ///afresh with a polynomial solve, so the results agree with the serial computation to within the
+  ///integration or Newton tolerance.  Nested inside other OpenMP parallel regions (e.g. over chains) the
+  ///chunks are computed in turn.
+  int nchunk=min(trajectory_chunks,Ngrid/min_chunk_samples);
+  if(nchunk<=1){
+    compute_trajectory_range(traj,0,Ngrid,integrate,crossing_dt,res);
+  } else {
+    vector<TrajectoryResult> chunk_res(nchunk);
+    prepare_work_lenses(nchunk);
+#pragma omp parallel for schedule(dynamic,1)
+    for(int ic=0;ic<nchunk;ic++){
+      GLens *worklens=work_lenses.lenses[ic];
+      int i0=(Ngrid*(long)ic)/nchunk, i1=(Ngrid*(long)(ic+1))/nchunk;
+      worklens->compute_trajectory_range(traj,i0,i1,integrate,crossing_dt,chunk_res[ic]);
+    }
+    for(int ic=0;ic<nchunk;ic++)res.append(chunk_res[ic]);
   }
 
   if(test_result){
   //initialization
     for(int i=0; i<Ngrid;i++){
       double ttest=traj.get_obs_time(i);
-      int ires=index_series[i];
-      double tres=time_series[ires];
+      set_time_dependent_values(ttest);
+      int ires=res.index[i];
+      double tres=res.t[ires];
       Point beta=get_obs_pos(traj,ttest);
-      vector<Point> thetas=invmap(beta);
+      Images thetas=invmap(beta);
       int nimages=thetas.size();
       double mgtest=mag(thetas);
-      double mgres=mag_series[ires];
+      unset_time_dependent_values();
+      double mgres=res.mag[ires];
       double tminus,tplus,mgminus,mgplus;
-      if(ires>0&&ires<time_series.size()-1){
-	tminus=time_series[ires-1];
-	tplus=time_series[ires+1];
+      if(ires>0&&ires<res.size()-1){
+	tminus=res.t[ires-1];
+	tplus=res.t[ires+1];
+	set_time_dependent_values(tminus);
 	beta=get_obs_pos(traj,tminus);
 	thetas=invmap(beta);
 	mgminus=mag(thetas);
+	set_time_dependent_values(tplus);
 	beta=get_obs_pos(traj,tplus);
 	thetas=invmap(beta);
 	mgplus=mag(thetas);
+	unset_time_dependent_values();
       }
 
       if(abs(mgtest-mgres)/mgtest>test_result_tol)
@@ -2491,17 +3430,32 @@ void GLens::compute_trajectory_integrate_roots (const Trajectory &traj, vector<d
 	{
 	cout<<"\ncompute_trajectory: test failed. test/res:\nindex="<<i<<","<<ires<<"\ntime="<<ttest<<","<<tres<<"\nmag="<<mgtest<<","<<mgres<<" -> "<<abs(mgtest-mgres)<<"["<<nimages<<" images]"<<endl;
 	cout<<"beta=("<<beta.x<<","<<beta.y<<")"<<endl;
-	if(ires>0&&ires<time_series.size()-1){
+	if(ires>0&&ires<res.size()-1){
 	  cout<<"nearby times  :"<<tminus<<" < t < "<<tplus<<endl;
 	  cout<<"   with mags  :"<<mgminus<<" < mg < "<<mgplus<<endl;
 	}
-	//if(i>0&&ires<index_series.size()-1)cout<<"nearby idx times:"<<time_series[index_series[i-1]]<<" < t < "<<time_series[index_series[i+1]]<<endl;
+	//if(i>0&&ires<res.index.size()-1)cout<<"nearby idx times:"<<res.t[res.index[i-1]]<<" < t < "<<res.t[res.index[i+1]]<<endl;
       }
     }
   }
 
 }
-*/
+
+///Version of compute_trajectory with the results as separate series, and a vector of images for each sample.
+///The dmag series is set only for finite sources.
+void GLens::compute_trajectory (const Trajectory &traj, vector<double> &time_series, vector<vector<Point> > &thetas_series, vector<int> &index_series,vector<double>&mag_series,vector<double> &dmag, bool integrate){
+  TrajectoryResult res;
+  compute_trajectory(traj,res,integrate);
+  time_series=res.t;
+  mag_series=res.mag;
+  index_series=res.index;
+  thetas_series.resize(res.size());
+  for(int k=0;k<res.size();k++)thetas_series[k]=res.images(k);
+  if(do_finite_source&&source_radius>0)dmag=res.dmag;
+}
+
+
+
 
 //This version seems no longer used 04.02.2016..
 int GLens::GSL_integration_func (double t, const double theta[], double thetadot[], void *instance){
@@ -2533,48 +3487,45 @@ int GLens::GSL_integration_func (double t, const double theta[], double thetadot
 }
 
 
-int GLens::GSL_integration_func_vec (double t, const double theta[], double thetadot[], void *instance){
-  //We make the following cast static, thinking that that should realize faster integration
-  //However, since we call functions which are virtual, this may/will give the wrong result if used
-  //with a derived class that has overloaded those functions {get_obs_pos, get_obs_vel, invjac, map}
-  GLens *thisobj = static_cast<GLens *>(instance);
-  //thisobj->set_time_dependent_values(t);
-  const Trajectory *traj=thisobj->trajectory;
-  Point beta0=thisobj->get_obs_pos(*traj,t);
-  Point betadot=thisobj->get_obs_vel(*traj,t);
-  bool fail=false;
-  for(int k=0;k<2*thisobj->NimageMax;k++)thetadot[k]=0;
-  //cout<<"beta0=("<<beta0.x<<","<<beta0.y<<")"<<endl;
-  for(int image =0; image<thisobj->Ntheta;image++){
-    Point p(theta[image*2+0],theta[image*2+1]);
-    double j00i,j10i,j01i,j11i,invJ = thisobj->invjac(p,j00i,j01i,j10i,j11i);
-    Point beta=thisobj->map(p);
-    double dx=beta.x-beta0.x,dy=beta.y-beta0.y;
-    double adjbetadot[2];
-    //double rscale=thisobj->estimate_scale(Point(theta[0],theta[1]));
-    //if our image is near one of the lenses, then we need to tread carefully
-    double rk=thisobj->kappa;//*rscale;
-    adjbetadot[0] = betadot.x;
-    adjbetadot[1] = betadot.y;
-    if(isfinite(dx))adjbetadot[0] += -rk*dx;
-    if(isfinite(dy))adjbetadot[1] += -rk*dy;
-    if(isfinite(invJ)){
-      thetadot[2*image]   = (j00i*adjbetadot[0]+j01i*adjbetadot[1]);
-      thetadot[2*image+1] = (j10i*adjbetadot[0]+j11i*adjbetadot[1]);
-    }
-    if(!isfinite(invJ)){    
-      //cout<<"GLens::GSL_integration_func_vec: FAIL"<<endl;
-      //fail=true;
-      //here we panic and rather than return NAN, we evolve as if the lensing effect is trivial...
-      cout<<"GLens::GSL_integration_func_vec: invJ=inf, |beta|="<<sqrt(beta0.x*beta0.x+beta0.y*beta0.y)<<endl;
-      thetadot[2*image]   = betadot.x;
-      thetadot[2*image+1] = betadot.y;
-    }
-  }
-  for(int k=2*thisobj->Ntheta;k<2*thisobj->NimageMax;k++)thetadot[k]=0;
-  //thisobj->unset_time_dependent_values();
+///Derivative of the image positions for evolve_images.
+///
+///For Lens=GLens the map and inverse Jacobian are called virtually, so that the base evolve_images serves
+///derived classes which have not provided their own.
+template<class Lens> struct GLens::ImageFlow {
+  static const bool exact=not is_same<Lens,GLens>::value;
+  Lens *lens;
+  ImageFlow(Lens *lens):lens(lens){};
+  bool operator()(double t, const double theta[], double thetadot[]){
+    const Trajectory *traj=lens->trajectory;
+    Point beta0=lens->get_obs_pos(*traj,t);
+    Point betadot=lens->get_obs_vel(*traj,t);
+    double rk=lens->kappa;
+    for(int image=0;image<lens->Ntheta;image++){
+      Point p(theta[image*2+0],theta[image*2+1]);
+      double j00i,j10i,j01i,j11i;
+      double invJ=(exact?lens->Lens::invjac(p,j00i,j01i,j10i,j11i):lens->invjac(p,j00i,j01i,j10i,j11i));
+      Point beta=(exact?lens->Lens::map(p):lens->map(p));
+      double dx=beta.x-beta0.x,dy=beta.y-beta0.y;
+      double adjbetadot[2]={betadot.x,betadot.y};
+      if(isfinite(dx))adjbetadot[0] += -rk*dx;
+      if(isfinite(dy))adjbetadot[1] += -rk*dy;
+      if(isfinite(invJ)){
+	thetadot[2*image]   = (j00i*adjbetadot[0]+j01i*adjbetadot[1]);
+	thetadot[2*image+1] = (j10i*adjbetadot[0]+j11i*adjbetadot[1]);
+      } else {
+	//rather than return NAN, evolve as if the lensing effect is trivial
+	cout<<"GLens::ImageFlow: invJ=inf, |beta|="<<sqrt(beta0.x*beta0.x+beta0.y*beta0.y)<<endl;
+	thetadot[2*image]   = betadot.x;
+	thetadot[2*image+1] = betadot.y;
+      }
+    }
+    return true;
+  };
+};
 
-  return !fail?GSL_SUCCESS:3210123;
+bool GLens::evolve_images(double &t, double t1, double &h, double theta[]){
+  ImageFlow<GLens> flow(this);
+  return integrator.evolve(flow,2*Ntheta,t,t1,h,theta);
 }
 
 void GLens::addOptions(Options &opt,const string &prefix){
@@ -2583,24 +3534,47 @@ void GLens::addOptions(Options &opt,const string &prefix){
   opt.add(Option("GLB_circular_orbit","Allow circular orbital motion of binary."));
   opt.add(Option("GL_poly","Don't use integration method for lens magnification, use only the polynomial method."));
   //opt.add(Option("poly","Same as GL_poly for backward compatibility.  (Deprecated)"));
+  opt.add(Option("GL_newton","Use Newton continuation of images along the trajectory, with polynomial solves only where that fails (implies GL_poly)."));
+  opt.add(Option("GL_int_roots","Integrate all the roots of the lens polynomial, including ghost roots, rather than just the images, solving the polynomial only where two roots nearly merge (implies integration)."));
+  opt.add(Option("GL_int_roots_gap","Least distance (Einstein units) of any near-real pair of polynomial roots from merging for root integration to continue. (0.01)","0.01"));
   opt.add(Option("GL_int_tol","Tolerance for GLens inversion integration. (1e-10)","1e-10"));
   opt.add(Option("GL_int_mag_limit","Magnitude where GLens inversion integration reverts to poly. (1.5)","1.5"));
+  opt.add(Option("GL_caustic_window","Half-width (Einstein units) of windows around caustic crossings where the polynomial is solved at each sample and finite-source methods are applied. Elsewhere integration or Newton tracking is used. (0 default, no caustic segmentation)","0"));
+  opt.add(Option("GL_chunks","Number of time chunks into which point-source light curves are split for parallel (OpenMP) computation. (1 default, serial)","1"));
+  opt.add(Option("GL_adaptive_tol","Relative magnification tolerance for adaptive sampling of light curves, with cubic Hermite (point source) or linear (finite source) interpolation between evaluated samples. For finite sources this replaces the GL_finite_source_decimate_dtmin decimation. (0 default, evaluate every sample)","0"));
   opt.add(Option("GL_int_kappa","Strength of driving term for GLens inversion. (0.1)","0.1"));
-  opt.add(Option("GL_finite_source","Flag to turn on finite source fitting. Optional argument to provide method [leading,laplacian,polygon,(no arg default), uses fastest appropriate, up to specification or use eg 'strict_polygon']"));
+  opt.add(Option("GL_finite_source","Flag to turn on finite source fitting. Optional argument to provide method [leading,laplacian,polygon,contour,(no arg default), uses fastest appropriate, up to specification or use eg 'strict_polygon']"));
   opt.add(Option("GL_finite_source_Npoly_max","Max number of sides in polygon source approximation.(40 default)","40"));
+  opt.add(Option("GL_finite_source_LD","Limb darkening law for the finite source [none,linear,quadratic]. (none default)","none"));
+  opt.add(Option("GL_finite_source_LD_a","Linear limb darkening coefficient, or fixed value if not fit. (0.5 default)","0.5"));
+  opt.add(Option("GL_finite_source_LD_b","Quadratic limb darkening coefficient, or fixed value if not fit. (0 default)","0"));
+  opt.add(Option("GL_finite_source_LD_fit","Fit the limb darkening coefficients, with uniform priors on [0,1]. The quadratic law is fit in q1=(a+b)^2 and q2=a/(2(a+b)), which keeps the brightness positive and decreasing toward the limb."));
+  opt.add(Option("GL_finite_source_LD_annuli","Maximum number of annuli, chosen adaptively, in the limb-darkened source for the polygon and contour methods. (16 default)","16"));
   opt.add(Option("GL_finite_source_var","Factor (roughly) for variance in surface brightness from uniformity.(0.01 default)","0.01"));
   opt.add(Option("GL_finite_source_log_rho_max","Set max uniform prior range for log_rho. (-100->gaussian prior default)","-100"));
   opt.add(Option("GL_finite_source_log_rho_min","Set min if uniform prior for log_rho. (-6.0 default)","-6"));
   opt.add(Option("GL_finite_source_refine_limit","Maximum refinement factor. (100.0 default)","100.0"));
   opt.add(Option("GL_finite_source_tol","Magnitude tolerance target. (1e-3 default)","1e-3"));
-  opt.add(Option("GL_finite_source_decimate_dtmin","Interpolate time-steps closer than this fraction of source size. (default sqrt(GL_finite_source_tol))","-1"));
+  opt.add(Option("GL_finite_source_threads","Number of OpenMP threads over which the epochs of finite-source light curves are dynamically scheduled. (1 default, serial)","1"));
+  opt.add(Option("GL_finite_source_deterministic","Make finite-source results independent of the epoch order and thread schedule, by solving each epoch afresh (for regression tests)."));
+  opt.add(Option("GL_ray_threads","Number of OpenMP threads for inverse ray shooting (strict_brute finite sources and ray-shot magnification maps). (1 default, serial)","1"));
+  opt.add(Option("GL_magmap_rays","Make magnification maps by inverse ray shooting, averaging over each pixel with this many rays per pixel (in the absence of lensing). (0 default, point-source maps)","0"));
+  opt.add(Option("GL_finite_source_decimate_dtmin","Interpolate time-steps closer than this fraction of source size. With GL_adaptive_tol, the least spacing enforced while the source crosses a caustic. (default sqrt(GL_finite_source_tol))","-1"));
 };
 
 void GLens::setup(){
-  set_integrate(!optSet("GL_poly"));
+  use_newton=optSet("GL_newton");
+  set_integrate(!optSet("GL_poly") and !use_newton);
+  if(optSet("GL_int_roots"))set_int_roots(true);
+  *optValue("GL_int_roots_gap")>>int_roots_gap;
   *optValue("GL_int_tol")>>GL_int_tol;
   *optValue("GL_int_mag_limit")>>GL_int_mag_limit;
   *optValue("GL_int_kappa")>>kappa;
+  *optValue("GL_caustic_window")>>caustic_window;
+  *optValue("GL_chunks")>>trajectory_chunks;
+  *optValue("GL_adaptive_tol")>>adaptive_tol;
+  *optValue("GL_ray_threads")>>ray_threads;
+  *optValue("GL_magmap_rays")>>magmap_rays;
   double finite_source_log_rho_max;
   double finite_source_log_rho_min;
   if(optSet("GL_finite_source")){
@@ -2615,6 +3589,8 @@ void GLens::setup(){
     else if(method=="strict_polygon")finite_source_method=-1;
     else if(method=="strict_laplacian")finite_source_method=-2;
     else if(method=="strict_brute")finite_source_method=-4;
+    else if(method=="contour")finite_source_method=5;
+    else if(method=="strict_contour")finite_source_method=-5;
     else{
       cout<<"GLens::setup: Finite source method '"<<method<<"' not recognized."<<endl;
       exit(1);
@@ -2626,21 +3602,49 @@ void GLens::setup(){
     *optValue("GL_finite_source_refine_limit")>>finite_source_refine_limit;
     *optValue("GL_finite_source_decimate_dtmin")>>finite_source_decimate_dtmin;
     *optValue("GL_finite_source_tol")>>finite_source_tol;
+    *optValue("GL_finite_source_threads")>>finite_source_threads;
+    finite_source_deterministic=optSet("GL_finite_source_deterministic");
+    string law;
+    *optValue("GL_finite_source_LD")>>law;
+    if(law=="none")source_LD_law=0;
+    else if(law=="linear")source_LD_law=1;
+    else if(law=="quadratic")source_LD_law=2;
+    else{
+      cout<<"GLens::setup: Limb darkening law '"<<law<<"' not recognized."<<endl;
+      exit(1);
+    }
+    if(source_LD_law>0){
+      *optValue("GL_finite_source_LD_a")>>source_LD_a;
+      if(source_LD_law==2)*optValue("GL_finite_source_LD_b")>>source_LD_b;
+      *optValue("GL_finite_source_LD_annuli")>>source_LD_annuli;
+      fit_source_LD=optSet("GL_finite_source_LD_fit");
+      cout<<"limb darkening law = '"<<law<<"' with "<<source_LD_annuli<<" annuli"<<endl;
+    }
     if(finite_source_decimate_dtmin<0)finite_source_decimate_dtmin=sqrt(finite_source_tol);
   }
   haveSetup();
   cout<<"GLens set up with:\n\tintegrate=";
   if(use_integrate)cout<<"true\n\tGL_int_tol="<<GL_int_tol<<"\n\tkappa="<<kappa<<endl;
   else cout<<"false"<<endl;
+  if(use_integrate and use_int_roots)cout<<"\tintegrating polynomial roots, with GL_int_roots_gap="<<int_roots_gap<<endl;
   if(do_finite_source){
-    string names[] =                                      {"log_rho_star"};
-    nativeSpace=stateSpace(1);
+    //The limb darkening coefficients, if fit, follow log_rho_star
+    int nLD=fit_source_LD?source_LD_law:0;
+    string names[] =                                      {"log_rho_star","LD_a","LD_b"};
+    if(source_LD_law==2){
+      names[1]="LD_q1";
+      names[2]="LD_q2";
+    }
+    nativeSpace=stateSpace(1+nLD);
     nativeSpace.set_names(names);
     GLSpace=nativeSpace;
     const int uni=mixed_dist_product::uniform, gauss=mixed_dist_product::gaussian, pol=mixed_dist_product::polar; 
-    valarray<double>    centers((initializer_list<double>){ -4.0  });
-    valarray<double>     scales((initializer_list<double>){  1.0  });
-    valarray<int>         types((initializer_list<int>)   { gauss });
+    valarray<double>    centers(0.5,1+nLD);
+    valarray<double>     scales(0.5,1+nLD);
+    valarray<int>         types(uni,1+nLD);
+    centers[0]=-4.0;
+    scales[0]=1.0;
+    types[0]=gauss;
     if(finite_source_log_rho_max>-100.0){//set uniform prior for log_rho
       centers[0]=(finite_source_log_rho_max+finite_source_log_rho_min)/2.0;
       scales[0]=(finite_source_log_rho_max-finite_source_log_rho_min)/2.0;
@@ -2688,7 +3692,7 @@ void GLens::setup(){
 /// involving up to d4gamma.
 double GLens::Laplacian_mu(const Point &p)const{
   //Computuing the shear and derives is specialized to the lens-type, the rest is general...
-  vector<complex<double> >gammas=compute_shear(p,2);
+  ShearDerivs gammas=compute_shear(p,2);
   complex<double>   gamma=gammas[0], gammac=conj(gamma), dgamma=gammas[1], d2gamma=gammas[2];
   double invmu = 1-norm(gamma);
   if(invmu==0)return 0;//Fail gracefully;  There is no appropriate result near caustics
@@ -2698,18 +3702,38 @@ double GLens::Laplacian_mu(const Point &p)const{
   return 4*mu*mu2*(term1+term2);
 };
  
+///Time derivative of the total magnification, sum_k |mu_k|, of a set of images.
+///
+///With the shear gamma (see compute_shear), the lens equation gives dbeta = dz + gamma^* dz^*, so that for each
+///image dz/dt = mu (betadot - gamma^* betadot^*), and since 1/mu = 1-|gamma|^2,
+///dmu/dt = 2 mu^2 Re(gamma^* gamma' dz/dt).
+double GLens::mag_rate(const Images &thetas, const Point &beta_dot)const{
+  complex<double> bdot(beta_dot.x,beta_dot.y);
+  double rate=0;
+  for(const Point &th : thetas){
+    ShearDerivs gammas=compute_shear(th,1);
+    complex<double> gc=conj(gammas[0]);
+    double mu=1/(1-norm(gammas[0]));
+    complex<double> zdot=mu*(bdot-gc*conj(bdot));
+    double dmu=2*mu*mu*real(gc*gammas[1]*zdot);
+    rate+=(mu>0?dmu:-dmu);
+  }
+  return rate;
+};
+
 ///Compute the complex lens shear, and some number of its derivatives
 /// gamma = \sum_i^N nu_i / (zc*zc)   =  dbetac/dz
-vector<complex<double> > GLens::compute_shear(const Point &p, int nder)const{
+ShearDerivs GLens::compute_shear(const Point &p, int nder)const{
   double x=p.x,y=p.y;
   complex<double> z(x,y);
-  vector<complex<double> >gammas;   
+  ShearDerivs gammas;   
+  if(nder>=(int)gammas.size()){cout<<"GLens::compute_shear: Only up to "<<gammas.size()-1<<" derivatives are available."<<endl;exit(1);}
   complex<double>   gamma=1.0/z/z, gammac=conj(gamma);
   complex<double> dNgamma=gamma;
-  gammas.push_back(gamma);
+  gammas[0]=gamma;
   for(int n=0;n<nder;n++){
     dNgamma *=-(n+2.0)/z;
-    gammas.push_back(dNgamma);
+    gammas[n+1]=dNgamma;
   }
   return gammas;
 };
@@ -2720,6 +3744,36 @@ vector<complex<double> > GLens::compute_shear(const Point &p, int nder)const{
 // ******************************************************************
 //
 
+vector<long*> GLensBinary::precision_count_list;
+
+long *GLensBinary::precision_counts(){
+  //Each thread's counters are allocated on first use and kept for the life of the program, so that counts
+  //from threads which have since exited still appear in the report.
+  static thread_local long *counts=nullptr;
+  if(not counts){
+    counts=new long[3]();
+#pragma omp critical (GLensBinary_precision_counts)
+    precision_count_list.push_back(counts);
+  }
+  return counts;
+};
+
+///Summary of polynomial solves at each precision over all threads.  Call this outside of any parallel region.
+string GLensBinary::precision_report(){
+  ostringstream s;
+  const char *names[3]={"double","long-double","quad"};
+  long totals[3]={0,0,0};
+#pragma omp critical (GLensBinary_precision_counts)
+  for(long *counts:precision_count_list)for(int i=0;i<3;i++)totals[i]+=counts[i];
+  long npoints=totals[WittMao_base_precision];
+  s<<"GLensBinary polynomial solves:";
+  for(int i=WittMao_base_precision;i<=WittMao_max_precision;i++){
+    s<<" "<<names[i]<<"="<<totals[i];
+    if(i>WittMao_base_precision and npoints>0)s<<" ("<<100.0*totals[i]/npoints<<"%)";
+  }
+  return s.str();
+};
+
 GLensBinary::GLensBinary(double q,double aL,double phi0):q(q),aL(aL),phi0(phi0),sin_phi0(sin(phi0)),cos_phi0(cos(phi0)){
   typestring="GLens";
   option_name="BinaryLens";
@@ -2727,26 +3781,31 @@ GLensBinary::GLensBinary(double q,double aL,double phi0):q(q),aL(aL),phi0(phi0),
   NimageMax=5;
   NimageMin=3;
   nu=1/(1+q);
+  sL=aL;
+  cm=Point((q/(1.0+q)-0.5)*sL,0);
   rWide=5;
+  qPlanet=1e-4;
   do_remap_q=false;
   q_ref=0;
   idx_q=idx_L=idx_phi0=-1;
   idx_lona=idx_inc=idx_chi=-1;
   time_dependent=false;
+  circular_orbit=false;//before set_time_dependent_values, which tests it
   set_time_dependent_values(0);
-  circular_orbit=false;
   sin_phit=sin_phi0;
   cos_phit=cos_phi0;
 };
 
 void GLensBinary::setup(){
-  set_integrate(!optSet("GL_poly"));
+  use_newton=optSet("GL_newton");
+  set_integrate(!optSet("GL_poly") and !use_newton);
   circular_orbit=(optSet("GLB_circular_orbit"));
   time_dependent=circular_orbit;
   *optValue("GL_int_tol")>>GL_int_tol;
   *optValue("GL_int_mag_limit")>>GL_int_mag_limit;
   *optValue("GL_int_kappa")>>kappa;
   *optValue("GLB_rWide")>>rWide;
+  *optValue("GLB_qPlanet")>>qPlanet;
   haveSetup();
   //cout<<"GLens set up with:\n\tintegrate=";
   //if(use_integrate)cout<<"true\n\tGL_int_tol="<<GL_int_tol<<"\n\tkappa="<<kappa<<endl;
@@ -2804,23 +3863,74 @@ void GLensBinary::setup(){
   //cout<<"net prior is:\n"<<nativePrior->show()<<endl;
 };
 
+///The forward lens map.  In the default build this is evaluated in double precision (see map_real).  The shifts
+///x-sL/2 and x+sL/2 are exact (Sterbenz) for images near either lens, where the deflection is large, so the
+///result is good to a few ulp of the larger of the image position and its deflection.  That is far below
+///the LEADTOL tolerance on the map tests.  Run test/map-bench to compare against the long double version.
 Point GLensBinary::map(const Point &p){
   require_time_dependent_values();
-  ldouble x=p.x,y=p.y,x1=x-ldouble(sL)/2.0L,x2=x+ldouble(sL)/2.0L,r1sq=x1*x1+y*y,r2sq=x2*x2+y*y;
-  ldouble c1=(1.0L-nu)/r1sq,c2=nu/r2sq;
-  return Point(x-x1*c1-x2*c2,y-y*(c1+c2));
+  map_real x=p.x,y=p.y,y2=y*y,x1=x-map_real(sL)/2,x2=x+map_real(sL)/2,r1sq=x1*x1+y2,r2sq=x2*x2+y2;
+  map_real c1=(1-map_real(nu))/r1sq,c2=map_real(nu)/r2sq;
+  return Point(x-(x1*c1+x2*c2),y-y*(c1+c2));
+};
+
+///The forward lens map for n points, in double precision, written as a branch-free loop for vectorization.
+void GLensBinary::map_batch(const double *x, const double *y, int n, double *bx, double *by){
+  require_time_dependent_values();
+  const double hL=sL/2,m1=1-nu,m2=nu;
+#pragma omp simd
+  for(int i=0;i<n;i++){
+    double x1=x[i]-hL,x2=x[i]+hL,y2=y[i]*y[i];
+    double c1=m1/(x1*x1+y2),c2=m2/(x2*x2+y2);
+    bx[i]=x[i]-(x1*c1+x2*c2);
+    by[i]=y[i]-y[i]*(c1+c2);
+  }
+};
+
+///Each lens contributes its mass over the squared distance to the bound on the map's derivative.
+double GLensBinary::map_variation_bound(const Point &c, double s)const{
+  require_time_dependent_values();
+  double dy=fmax(abs(c.y)-s,0.0),dx1=fmax(abs(c.x-sL/2)-s,0.0),dx2=fmax(abs(c.x+sL/2)-s,0.0);
+  double d1sq=dx1*dx1+dy*dy,d2sq=dx2*dx2+dy*dy;
+  if(d1sq==0 or d2sq==0)return INFINITY;
+  return s*M_SQRT2*(1+(1-nu)/d1sq+nu/d2sq);
+};
+
+///Beyond the lenses at distance sL/2, the deflection of an image at radius r is at most 1/(r-sL/2).
+double GLensBinary::image_radius_bound(double bmax)const{
+  require_time_dependent_values();
+  double d=sL/2;
+  return (bmax+d+sqrt((bmax-d)*(bmax-d)+4))/2;
 };
 
-vector<Point> GLensBinary::invmap(const Point &p){
+Images GLensBinary::invmap(const Point &p){
   require_time_dependent_values();
   const double rTest=1.1*rWide;
   double r2=p.x*p.x+p.y*p.y;
+  if(planetary_inversion and testPlanetary(p)){
+    Images thP=invmapPlanetary(p);
+    have_saved_soln=false;//no saved roots from the planetary inversion
+    if(thP.size()==0){
+      if(debug)cout<<"Planetary inversion failed"<<endl;
+      return invmapWittMao(p);
+    }
+    if(inv_test_mode){
+      Images thWM=invmapWittMao(p);
+      have_saved_soln=false;
+      double mag_P=mag(thP),mag_WM=mag(thWM);
+      if(abs(mag_P-mag_WM)/mag_WM>1e-6){
+	cout.precision(15);
+	cout<<"\nInversion methods disagree: magP="<<mag_P<<"["<<thP.size()<<" images] magWM="<<mag_WM<<"["<<thWM.size()<<" images] at ("<<p.x<<","<<p.y<<")"<<endl;
+      }
+    }
+    return thP;
+  }
   if(testWide(p,1.0)){
     if(debug||inv_test_mode&&debugint){
       debug=true;
       cout<<"wide"<<endl;
     }
-    vector<Point>thWB= invmapWideBinary(p);
+    Images thWB= invmapWideBinary(p);
     //if fails to converge (rare) revert to WittMao:
     if(thWB.size()==0){
       //cout<<"WideBinary failed to converge"<<endl;
@@ -2829,7 +3939,7 @@ vector<Point> GLensBinary::invmap(const Point &p){
     }
     if(inv_test_mode&&r2<rTest*rTest){
       if(debug||debugint)cout<<"wide-test"<<endl;
-      vector<Point>thWM= invmapWittMao(p);
+      Images thWM= invmapWittMao(p);
       double mag_WB=mag(thWB),mag_WM=mag(thWM);
       if(abs(mag_WB-mag_WM)/mag_WM>1e-6){//the two methods don't agree.
 	if(debug||debugint)cout<<"wide-test FAILED"<<endl;
@@ -2903,7 +4013,7 @@ vector<Point> GLensBinary::invmap(const Point &p){
 /// Note that it is straightforward to generalize to multiple lenses by changing the definition of \f$\epsilon\f$
 /// to include contrinbutions from additional distant lenses.
 ///
-vector<Point> GLensBinary::invmapWideBinary(const Point &p){
+Images GLensBinary::invmapWideBinary(const Point &p){
   require_time_dependent_values();
   const int maxIter=1000;
   //const int maxIter=20;
@@ -2920,7 +4030,7 @@ vector<Point> GLensBinary::invmapWideBinary(const Point &p){
   double_type xL=p.x,yL=p.y,x1=xL-(double_type)sL/2.0L,x2=xL+(double_type)sL/2.0L,r1sq=x1*x1+yL*yL,r2sq=x2*x2+yL*yL;
   double_type nu_neg=(double_type)nu,nu_pos=1.0L-nu_neg,cpos=nu_pos*nu_pos/r1sq,cneg=nu_neg*nu_neg/r2sq;
   double_type nu_n,nu_f,c;
-  vector<Point>result;
+  Images result;
   if(cpos<cneg){//close (dominant) point is one x<0 half-plane
     //cout<<"neg-dominant"<<endl;
     c=(double_type)sL;
@@ -3054,28 +4164,141 @@ vector<Point> GLensBinary::invmapWideBinary(const Point &p){
   return result;
 };
 
-vector<Point> GLensBinary::invmapWittMao(const Point &p,bool no_check){
+///Inverse lens map for planetary mass ratios.
+///
+///For q<<1 the planet's contributions to the Witt-Mao coefficients are small differences of O(1) terms, and the
+///quintic solution suffers cancellation.  Instead we start from approximate images and refine them by Newton
+///iteration on the full lens equation.  Writing z_s, m_s for the star (primary) and z_p, m_p for the planet,
+///and u=z-z_p, the approximate images are:
+///  - the single-lens images of the star, ignoring the planet, and
+///  - the images of the Chang-Refsdal lens, with the planet sitting in the shear of the star,
+/// \f[
+///    w = u - \frac{m_p}{u^*} + g u^*,\quad g=\frac{m_s}{(z_p-z_s)^{*2}},\quad w=\beta-z_p+\frac{m_s}{(z_p-z_s)^*},
+/// \f]
+///    which (after eliminating u^* with the conjugate equation) is a quartic in u.  Outside the Chang-Refsdal
+///    caustics two of its roots are spurious, but near the caustics of the full lens these may lie close to a
+///    pair of images the Chang-Refsdal approximation has lost, so we seed from all of the roots.
+///Far from the planet the Chang-Refsdal images are just the star's image near the planet and the planet's own
+///image at u~-m_p/w^*, so we skip the quartic.  Near the planet, the star's image there duplicates one of the
+///Chang-Refsdal images, but we keep it since for g~1 the quartic degenerates and the Chang-Refsdal images
+///may not cover it.
+///
+///The Newton iteration for the lens equation f(z)=z-sum_i m_i/(z-z_i)^*-beta=0 has df=dz+G dz^*, with
+///G=sum_i m_i/(z-z_i)^{*2}, so each step is dz=(G f^* - f)/(1-|G|^2).  Near a critical curve roundoff in f is
+///amplified by 1/(1-|G|^2), so there we judge convergence by |dz||1-|G|^2|.
+///The refined images are kept if they are distinct.  None of this guarantees that we have found all five images
+///inside a caustic (the Chang-Refsdal approximation misses the central caustic, and misplaces the edges of the
+///planetary ones), so where we have only three and the point is near the planet or the star we check whether it
+///may be inside a caustic polygon (see caustic_inside_test).  If so, we also seed from the Witt-Mao images, which
+///the Newton iteration polishes.  If we still have only three images inside a caustic, or the number of images
+///(3 or 5) or their parities (one more negative than positive) are inconsistent, we return no images, and
+///invmap falls back on invmapWittMao.
+Images GLensBinary::invmapPlanetary(const Point &p){
+  require_time_dependent_values();
+  const int maxIter=30;
+  const double tol=1e-14;
+  const double far_planet=100;//in units of the planet's squared Einstein radius
+  Images result;
+  //The lens at +sL/2 has mass 1-nu, the lens at -sL/2 has mass nu
+  bool plus_star=(nu<0.5);
+  double ms=plus_star?1-nu:nu, mp=1-ms;
+  complex<double> zs(plus_star?sL/2:-sL/2,0), zp=-zs, d=zp-zs, beta(p.x,p.y);
+  complex<double> seeds[7];
+  int nseed=0;
+  //Single-lens images of the star
+  complex<double> zeta=beta-zs;
+  double root=sqrt(1+4*ms/norm(zeta));
+  complex<double> zstar_p=zs+zeta*((1+root)/2), zstar_m=zs+zeta*((1-root)/2);
+  //Chang-Refsdal images near the planet
+  complex<double> g=ms/conj(d*d), gc=conj(g), w=beta-zp+ms/conj(d), wc=conj(w);
+  double g2=norm(g);
+  seeds[nseed++]=zstar_p;
+  seeds[nseed++]=zstar_m;
+  bool far=norm(w)>far_planet*mp*(1+g2/abs(1-g2));
+  if(far){
+    seeds[nseed++]=zp-mp/(wc-g*mp/w);
+  } else {
+    complex<double> poly[5],roots[4];
+    poly[4]=gc*(g2-1);
+    poly[3]=wc*(1-2*g2)+w*gc;
+    poly[2]=g*wc*wc-2*g2*mp-w*wc;
+    poly[1]=mp*(2.0*g*wc-w);
+    poly[0]=g*mp*mp;
+    int degree=4;
+    double scale=abs(poly[0])+abs(poly[1])+abs(poly[2])+abs(poly[3]);
+    while(degree>1 and abs(poly[degree])<=epsTOL*scale)degree--;//near g=1 the quartic degenerates
+    cmplx_roots_gen<double>(roots,poly,degree,true,false);
+    for(int k=0;k<degree;k++)seeds[nseed++]=zp+roots[k];
+  }
+  //Refine each seed and collect the distinct images
+  int npos=0,nneg=0;
+  auto refine=[&](complex<double> z)->bool{
+    bool converged=false;
+    double G2;
+    for(int iter=0;iter<maxIter;iter++){
+      complex<double> rs=1.0/conj(z-zs),rp=1.0/conj(z-zp);
+      complex<double> f=z-ms*rs-mp*rp-beta, G=ms*rs*rs+mp*rp*rp;
+      G2=norm(G);
+      complex<double> dz=(G*conj(f)-f)/(1-G2);
+      z+=dz;
+      if(!(isfinite(real(z)) and isfinite(imag(z))))break;
+      double cond=min(1.0,abs(1-G2));
+      if(norm(dz)*cond*cond<tol*tol*(1+norm(z))){
+	converged=true;
+	break;
+      }
+    }
+    if(not converged)return true;
+    for(const Point &im : result){
+      double dd2=norm(z-complex<double>(im.x,im.y));
+      if(dd2<dThTol*dThTol*(1+norm(z)))return true;
+    }
+    if(result.size()==NimageMax)return false;
+    result.push_back(Point(real(z),imag(z)));
+    if(G2<1)npos++;
+    else nneg++;
+    return true;
+  };
+  for(int k=0;k<nseed;k++)if(not refine(seeds[k]))return Images();
+  //The central caustic has width ~4 q/(s-1/s)^2
+  double sc=norm(d)+1/norm(d)-2, central=40*mp/ms/sc;
+  if(result.size()<NimageMax and (not far or norm(zeta)<central*central) and caustic_inside_test(p)){
+    if(debug)cout<<"invmapPlanetary: "<<result.size()<<" images, but possibly inside a caustic"<<endl;
+    Images thWM=invmapWittMao(p);
+    have_saved_soln=false;
+    for(const Point &th : thWM)if(not refine(complex<double>(th.x,th.y)))return Images();
+    if(result.size()<NimageMax and caustic_image_count(p)==NimageMax)return Images();
+  }
+  if(debug)cout<<"invmapPlanetary: "<<npos<<" positive and "<<nneg<<" negative parity images"<<endl;
+  if(not ((result.size()==NimageMin or result.size()==NimageMax) and nneg==npos+1))return Images();
+  return result;
+};
+
+Images GLensBinary::invmapWittMao(const Point &p,bool no_check){
   require_time_dependent_values();
-  bool test_images=true;
   //if no_check==true then we return all polynomial roots without checking that they are consistent with the forward map.
+  complex<double> c[7];
+  bool z1scaled=WittMao_coeffs(p.x,p.y,c);
+  return invmapWittMao_roots(p,c,z1scaled,no_check);
+};
+
+///Arithmetic kernel for the Witt-Mao polynomial coefficients c[0..5] with the lenses at +/-z1 and
+///mass fraction nu.  This has no branching on the source point (bx,by), so that loops over many
+///points (as in GLensBinary::invmap_batch) can be vectorized by the compiler.
+static inline void WittMao_coeffs_kernel(double bx, double by, double z1, double nu, complex<double> c[7]){
   //Here quantities are like WittMao95, but with:
   // z         ->  z*z1
   // 2m        -> M*z1^2  ; but in our normalization 2 m = nu+(1-nu) = 1
   // 2 Delta m -> DM*z1^2 ; in our normalization 2 Delta m = nu - (1-nu) = 2*nu-1
   // zeta      -> B*z1
-  const complex<double> cplx_i=complex<double>(0,1),cplx_1=1;
-  double z1=sL/2;
+  const complex<double> cplx_i=complex<double>(0,1);
   double z12=z1*z1;
   double M=1/z12;
   double DM=M*(2*nu-1);
-  complex<double> B=(p.x+cplx_i*p.y)/z1,Bb=conj(B);
+  complex<double> B=(bx+cplx_i*by)/z1,Bb=conj(B);
   complex<double> u,v,w,wb;
-  complex<double> c[7],roots[6];
-  int nroots=5;
-  bool z1scaled=false;
   //if(z1>LEADTOL){    //scaled with z->z*z1,ck->ck*z1^-k
-  if(z1>1){
-    z1scaled=true;//scaled with z->z*z1,ck->ck*z1^-k
+  if(z1>1){//scaled with z->z*z1,ck->ck*z1^-k
     u=DM*B+M;
     w=M*Bb+DM;
     wb=conj(w);
@@ -3087,8 +4310,8 @@ vector<Point> GLensBinary::invmapWittMao(const Point &p,bool no_check){
     c[1]=1.0-v*v-M*M*conj(c[5]);
     c[0]=(DM+2.0*Bb)*u+c[4];
   } 
-  else if(true) {    //scaled with z->z*z1,ck->ck*z1^-k
-    B=(p.x+cplx_i*p.y);Bb=conj(B);   //=B1*z1     
+  else {    //scaled with z->z*z1,ck->ck*z1^-k
+    B=(bx+cplx_i*by);Bb=conj(B);   //=B1*z1     
     M=1;
     DM=2*nu-1;            //=(DM*z1^2 above)
     u=DM*B+z1;           //(=u*z1^3 above)
@@ -3101,18 +4324,205 @@ vector<Point> GLensBinary::invmapWittMao(const Point &p,bool no_check){
     c[2]=wb-2.0*(Bb*u*z1+c[4]*z12);         //c2*z1^5
     c[1]=z12*z12*z12-v*v-conj(c[5]);        //c1*z1^6
     c[0]=((DM+2.0*Bb*z1)*u+c[4]*z12)*z12;//c0*z1^7
-  } 
-  else { //handle degenerate (single point lens) case without z1 scalingelse { //handle degenerate (single point lens) case without z1 scaling
-    B=(p.x+cplx_i*p.y);Bb=conj(B);
-    M=1;
-    DM=2*nu-1;
-    c[5]=0;c[4]=0;
-    c[3]=-Bb*Bb;
-    c[2]=-B*c[3]-Bb;
-    c[1]=2.0*B*Bb;
-    c[0]=B;
-    nroots=3;
   }
+  //A degenerate (single point lens) case without z1 scaling was formerly sketched here
+  //as a cubic: c[3]=-Bb*Bb; c[2]=-B*c[3]-Bb; c[1]=2.0*B*Bb; c[0]=B;
+};
+
+///Number of points whose roots GLensBinary::invmap_batch polishes together, one per SIMD lane (eight doubles
+///fill an AVX-512 register or two AVX2 registers).
+const int WittMao_lanes=8;
+
+///Lane-parallel polishing of the Witt-Mao roots for nlanes<=WittMao_lanes points with coefficients c+7*l, each
+///starting from the roots seed[0..4].  As in the polish_only branch of cmplx_roots_5, the first three roots are
+///polished by Newton iteration on the full quintic, and the last two (which should remain the closest pair) come
+///from the deflated quadratic.  The Newton loop is written in real arithmetic over the lanes so that it
+///vectorizes with whatever SIMD width the build targets (complex<double> division calls out to a library
+///routine).  The roots for lane l go to roots[5*l..5*l+4], and ok[l] is false if they did not meet the Adams
+///stopping criterion of cmplx_newton_spec, or if the closest pair changed, in which case the point should be
+///solved on its own.
+static void WittMao_polish_lanes(const complex<double> *c, int nlanes, const complex<double> seed[5], complex<double> *roots, bool *ok){
+  const int W=WittMao_lanes,maxiter=20;
+  const double FRAC_ERR=cmplx_roots_sg_traits<double>::FRAC_ERR(),steptol=1e-30;
+  double cr[6][W],ci[6][W],zr[3][W],zi[3][W],converged[3][W];
+  for(int l=0;l<W;l++){
+    int lc=min(l,nlanes-1);//spare lanes repeat the last point
+    for(int k=0;k<=5;k++){
+      cr[k][l]=real(c[7*lc+k]);
+      ci[k][l]=imag(c[7*lc+k]);
+    }
+    for(int m=0;m<3;m++){
+      zr[m][l]=real(seed[m]);
+      zi[m][l]=imag(seed[m]);
+    }
+  }
+  for(int m=0;m<3;m++){
+    for(int iter=0;iter<maxiter;iter++){
+      double maxstep=0;
+#pragma omp simd reduction(max:maxstep)
+      for(int l=0;l<W;l++){
+	double x=zr[m][l],y=zi[m][l],pr=cr[5][l],pi=ci[5][l],dr=0,di=0;
+	for(int k=4;k>=0;k--){
+	  double t=dr*x-di*y+pr;
+	  di=dr*y+di*x+pi;
+	  dr=t;
+	  t=pr*x-pi*y+cr[k][l];
+	  pi=pr*y+pi*x+ci[k][l];
+	  pr=t;
+	}
+	double d2=dr*dr+di*di;
+	double sr=(pr*dr+pi*di)/d2,si=(pi*dr-pr*di)/d2;
+	zr[m][l]=x-sr;
+	zi[m][l]=y-si;
+	maxstep=max(maxstep,(sr*sr+si*si)/(x*x+y*y+steptol));
+      }
+      if(not(maxstep>FRAC_ERR*FRAC_ERR))break;
+    }
+    //The stopping criterion, as in cmplx_newton_spec
+#pragma omp simd
+    for(int l=0;l<W;l++){
+      double x=zr[m][l],y=zi[m][l],pr=cr[5][l],pi=ci[5][l];
+      double absz=sqrt(x*x+y*y),ek=sqrt(pr*pr+pi*pi);
+      for(int k=4;k>=0;k--){
+	double t=pr*x-pi*y+cr[k][l];
+	pi=pr*y+pi*x+ci[k][l];
+	pr=t;
+	ek=absz*ek+sqrt(pr*pr+pi*pi);
+      }
+      converged[m][l]=(pr*pr+pi*pi<=(FRAC_ERR*ek)*(FRAC_ERR*ek));
+    }
+  }
+  for(int l=0;l<nlanes;l++){
+    complex<double> *z=roots+5*l,poly[6],rem;
+    ok[l]=(converged[0][l] and converged[1][l] and converged[2][l]);
+    if(not ok[l])continue;
+    for(int k=0;k<=5;k++)poly[k]=c[7*l+k];
+    for(int m=0;m<3;m++){
+      z[m]=complex<double>(zr[m][l],zi[m][l]);
+      divide_poly_1(poly,rem,z[m],poly,5-m);
+    }
+    solve_quadratic_eq(z[3],z[4],poly);
+    int root4,root5;
+    double d2min;
+    find_2_closest_from_5(root4,root5,d2min,z);
+    ok[l]=(root4>=3 and root5>=3 and isfinite(d2min));
+  }
+};
+
+///Compute the Witt-Mao polynomial coefficients c[0..5] for the source point (bx,by).
+///Returns true if the polynomial is in the scaled variable z/z1 rather than z.
+bool GLensBinary::WittMao_coeffs(double bx, double by, complex<double> c[7])const{
+  double z1=sL/2;
+  WittMao_coeffs_kernel(bx,by,z1,nu,c);
+  if(debug)cout<<"nu="<<nu<<" z1="<<z1<<" B=("<<bx<<","<<by<<")"<<endl;
+  return z1>1;
+};
+
+///Batched inverse lens map.
+///The Witt-Mao coefficients for all the points are computed first in a single (vectorizable) pass.
+///Then, where there are saved roots to polish from, the roots for each block of WittMao_lanes points are
+///polished together by WittMao_polish_lanes, every lane starting from the roots saved at the start of the
+///block.  The polished roots are then tested against the lens map point-by-point, in order, just as for a
+///sequence of invmap calls.  Points whose lane did not converge are solved on their own as before (polishing
+///from the previous point's roots), which is also the scalar fallback where there are no saved roots or the
+///base precision is not double.  Points in the wide-binary domain are handed to invmap.
+void GLensBinary::invmap_batch(const double *bx, const double *by, size_t n, vector<int> &img_offset, vector<double> &img_x, vector<double> &img_y){
+  require_time_dependent_values();
+  const double z1=sL/2;
+  vector<complex<double> > cbuf(7*n);
+  complex<double> *c=cbuf.data();
+  bool planetary=planetary_inversion and min(q,1/q)<qPlanet;
+  if(not planetary)
+#pragma omp simd
+    for(size_t i=0;i<n;i++)WittMao_coeffs_kernel(bx[i],by[i],z1,nu,c+7*i);
+  
+  img_offset.resize(n+1);
+  img_x.clear();
+  img_y.clear();
+  img_x.reserve(n*NimageMax);
+  img_y.reserve(n*NimageMax);
+  img_offset[0]=0;
+  complex<double> seed[5],lane_roots[5*WittMao_lanes];
+  bool lane_ok[WittMao_lanes];
+  for(size_t i=0;i<n;i++){
+    size_t lane=i%WittMao_lanes;
+    if(lane==0){
+      int nlanes=min((size_t)WittMao_lanes,n-i);
+      bool lanes=(not inv_test_mode and not planetary and WittMao_base_precision==0
+		  and save_thetas_poly and have_saved_soln and theta_save.size()==5);
+      if(lanes){
+	for(int k=0;k<5;k++)seed[k]=complex<double>(theta_save[k].x,theta_save[k].y);
+	WittMao_polish_lanes(c+7*i,nlanes,seed,lane_roots,lane_ok);
+      } else fill(lane_ok,lane_ok+nlanes,false);
+    }
+    Point p(bx[i],by[i]);
+    Images thetas;
+    if(inv_test_mode or planetary or testWide(p,1.0))thetas=invmap(p);
+    else thetas=invmapWittMao_roots(p,c+7*i,z1>1,false,lane_ok[lane]?lane_roots+5*lane:nullptr);
+    for(const Point &th : thetas){
+      img_x.push_back(th.x);
+      img_y.push_back(th.y);
+    }
+    img_offset[i+1]=img_x.size();
+  }
+};
+
+///Newton continuation of binary lens images.
+///After the generic Newton update, we check whether a new pair of images may have appeared.  With three
+///images known, we divide them out of the Witt-Mao quintic and test the two remaining roots against the lens
+///map; if either (nearly) passes then the source may have crossed into a caustic and we fall back on the full
+///solve.  In the wide-binary and planetary domains we always defer to invmap, which has its own (cheap) iterative
+///schemes there.
+bool GLensBinary::newton_track_images(const Point &p, Images &thetas){
+  if(testWide(p,1.0) or (planetary_inversion and testPlanetary(p)) or !GLens::newton_track_images(p,thetas))return false;
+  int ni=thetas.size();
+  if(ni==NimageMax)return true;
+  if(ni!=NimageMin)return false;
+  complex<double> c[7];
+  bool z1scaled=WittMao_coeffs(p.x,p.y,c);
+  double z1=z1scaled?sL/2:1;
+  double c_lower=0;
+  for(int k=0;k<5;k++)c_lower+=abs(real(c[k]))+abs(imag(c[k]));
+  if((abs(real(c[5]))+abs(imag(c[5])))/c_lower<=LEADTOL)return false;//effectively lower order; leave this to invmap
+  complex<double> rem;
+  int degree=5;
+  for(int k=0;k<ni;k++,degree--)divide_poly_1(c,rem,complex<double>(thetas[k].x/z1,thetas[k].y/z1),c,degree);
+  complex<double> roots[2];
+  solve_quadratic_eq(roots[0],roots[1],c);
+  const double TOL=LEADTOL*LEADTOL;
+  for(int i=0;i<2;i++){
+    int parity;
+    double err=image_residual(Point(real(roots[i])*z1,imag(roots[i])*z1),p,parity);
+    if(!(err>100*TOL))return false;//a candidate image, or a numerical problem
+  }
+  return true;
+};
+
+///Test a candidate image th of source p against the lens equation.
+///Returns the squared residual of the lens map, weighted by 1/(1+c1+c2) to account for propagation of
+///the error in th through the map, and sets the parity (sign of the Jacobian determinant, -1 on the
+///critical curve).  This uses the same lens distances for both, so there is no separate call to map or mag.
+double GLensBinary::image_residual(const Point &th, const Point &p, int &parity)const{
+  require_time_dependent_values();
+  double x=th.x,y=th.y,y2=y*y,x1=x-sL/2,x2=x+sL/2,r1sq=x1*x1+y2,r2sq=x2*x2+y2;
+  double c1=(1-nu)/r1sq,c2=nu/r2sq;
+  double dx=x-(x1*c1+x2*c2)-p.x,dy=y-y*(c1+c2)-p.y;
+  //det J * r1sq*r2sq, as in mag
+  double cosr2=x1*x2+y2,dc=c1-c2;
+  double detr4=r1sq*r2sq*(1-dc*dc)-4*c1*c2*cosr2*cosr2;
+  parity=(detr4>0?1:-1);
+  return (dx*dx+dy*dy)/(1+c1+c2);
+};
+
+///Solve the Witt-Mao polynomial with coefficients c for the images of p, and test them against the forward map.
+///If polished is given, it holds roots already polished in double precision (by invmap_batch), which stand in
+///for the first solve when the polynomial is a full quintic.
+Images GLensBinary::invmapWittMao_roots(const Point &p, complex<double> c[7], bool z1scaled, bool no_check, const complex<double> *polished){
+  bool test_images=true;
+  const complex<double> cplx_1=1;
+  double z1=sL/2;
+  complex<double> roots[6];
+  int nroots=5;
   //Test for effectively lower order; 
   //If the leading order polynomial coefficients are effectively zero, then the solve will fail.
   double c_lower=0;
@@ -3132,15 +4542,16 @@ vector<Point> GLensBinary::invmapWittMao(const Point &p,bool no_check){
   }
   //Debug
   if(debug){
-    cout<<"nu="<<nu<<" z1="<<z1<<" M="<<M<<" DM="<<DM<<" B= "<<B<<" u="<<u<<" w="<<w<<" v="<<v<<endl;
     cout<<"nroots="<<nroots<<endl;
     for( int i=0;i<=5;i++)
       cout<<"c["<<i<<"]="<<c[i]<<(i>nroots?"**":"")<<endl;
   }
 
-  bool roots_changed =true;//(this isn't used but compiler may be concerned about an uninitialized value) 
   bool polish_only = false;
-  if(nroots==5 and save_thetas_poly and have_saved_soln and theta_save.size()==5){
+  bool have_polished = (polished and nroots==5 and WittMao_base_precision==0);
+  if(have_polished){
+    for(int i=0;i<5;i++)roots[i]=polished[i];
+  } else if(nroots==5 and save_thetas_poly and have_saved_soln and theta_save.size()==5){
     //for(int i=0;i<5;i++)roots[i]=saved_roots[i];
     for(int i=0;i<5;i++)roots[i]=complex<double>(theta_save[i].x,theta_save[i].y);
     polish_only=true;
@@ -3150,100 +4561,130 @@ vector<Point> GLensBinary::invmapWittMao(const Point &p,bool no_check){
     }
   } else if(save_thetas_poly and verbose) cout<<"   no saved roots: p=("<<p.x<<","<<p.y<<")"<<endl;
 
-  if(nroots==5)cmplx_roots_5(roots, roots_changed, c, polish_only);
-  else cmplx_roots_gen(roots, c, nroots,true,false);
-  if(save_thetas_poly and nroots==5){
-    theta_save.resize(5);
-    for(int i=0;i<5;i++)theta_save[i]=Point(real(roots[i]),imag(roots[i]));
-    have_saved_soln=true;
-  } else {
-    have_saved_soln=false;
-  }
-  
-  if(nroots==4&&fix_nr4_roots){//try to make linear correction to root values
-    for( int i=0;i<nroots;i++){
-      complex<__float128> dP4=0.0;
-      complex<__float128> z=roots[i];
-      for(int k=1;k<=4;k++){
-	dP4+=c[k]*(double)k;
-	dP4/=z;
-      };
-      //Result is dP4 = dP/dz(z_k) / z_k^4
-      //dP4=((((c1/z+2*c2)/z+3*c3)/z+4*c4)/z
-      //   =(c1+2*c2*z+3*c3*z^2+4*z4+z^4)/z^4
-      complex<double> double_dP4;double_dP4=dP4;
-      complex<double> delta=-c[5]/double_dP4;
-      if(debug)cout<<"dP4="<<double_dP4<<" delta="<<delta<<endl;
-      ///We can derive this following expression by setting P5(x+eps)-P4(x)=0, then solve liniarly for eps
-      ///For abs(delta)<<0.2 and abs(delta)>>0.2 the result approximates that in the comment above, but all values other than
-      ///delta=-0.2 are allowed.  In this case, the 0.2 arises because n=5, not arbitrarily.
-      roots[i]*=(1.0+cplx_1/(5.0+cplx_1/delta));
-    }
-  }
-  //For debugging, test the results;
-  if(debug){
-    cout<<"complex poly test:"<<endl;
-    for( int i=0;i<nroots;i++){
-      complex<__float128> res=0.0;
-      complex<__float128> z=roots[i];
-      for(int k=5;k>=0;k--){
-	res*=z;
-	res+=c[k];
-      }
-      complex<long double> lres,lz;
-      lres=res;lz=z;
-      cout<<i<<": "<<lz<<"->"<<lres<<endl;
-    }
-  }
-  
-  vector<Point> result;
+  Images result;
   const double TOL=LEADTOL*LEADTOL;
   double maxerr=0;
-  int imaxerr=-1;
   double minerrfail=INFINITY;
   int iminerrfail=-1;
+  double errs[6];
+  int parities[6];
+  int npos=0,nneg=0;
 
-  for(int i=0;i<nroots;i++){
-    Point newp=Point(0,0);
-    if(z1scaled)
-      newp=Point(real(roots[i])*z1,imag(roots[i])*z1);
-    else 
-      newp=Point(real(roots[i]),imag(roots[i]));
-    if(no_check) result.push_back(newp);
-    else{
-      //Test solutions: Could also try keeping those with err/(1+B*Bb)<TOL say
-      Point btheta=map(newp);
-      double dx=btheta.x-p.x,dy=btheta.y-p.y;
-      double err=dx*dx+dy*dy;
-      //double dbx=newp.x-p.x,dby=newp.y-p.y;
-      double x=newp.x,y=newp.y,x1=x-sL/2,x2=x+sL/2,r1sq=x1*x1+y*y,r2sq=x2*x2+y*y;
-      double c1=(1-nu)/r1sq,c2=nu/r2sq;
-      err/=(1+c1+c2);
-      if(debug ){
-	cout<<"testing: "<<roots[i]<<" -> |("<<btheta.x<<"-"<<p.x<<","<<btheta.y<<"-"<<p.y<<")|="<<sqrt(dx*dx+dy*dy)<<" "<<(dx*dx+dy*dy<TOL*(1+c1+c2)?" < ":"!< ")<<LEADTOL*sqrt(1+c1+c2)<<"="<<LEADTOL<<"*√(1+"<<c1<<"+"<<c2<<")"<<endl;
-      }
-      if(err<TOL){     //RHS is squared estimate in propagating error of LEADTOL in root through map()
-	result.push_back(newp);
-	if(err>maxerr){
-	  maxerr=err;
-	  imaxerr=result.size()-1;
-	}
-      } else {
-	if(err<minerrfail){
-	  minerrfail=err;
-	  iminerrfail=i;
+  ///We first solve in the base precision (double, or quad with USE_KIND_16).  If the resulting image
+  ///count is inconsistent with NimageMin/NimageMax, or the parities are inconsistent (one more negative than
+  ///positive image), or two roots coincide, or the classification confidence is below WittMao_min_confidence, then we re-solve
+  ///the polynomial from scratch at the next higher precision, up to quad where available, before applying
+  ///the image-set fixes below.
+  long *counts=precision_counts();
+  for(int prec=WittMao_base_precision;;prec++){
+    if(not have_polished or prec>WittMao_base_precision)WittMao_solve(prec, roots, c, nroots, polish_only);
+    counts[prec]++;
+    if(save_thetas_poly and nroots==5){
+      theta_save.resize(5);
+      for(int i=0;i<5;i++)theta_save[i]=Point(real(roots[i]),imag(roots[i]));
+      have_saved_soln=true;
+    } else {
+      have_saved_soln=false;
+    }
+  
+    if(nroots==4&&fix_nr4_roots){//try to make linear correction to root values
+      for( int i=0;i<nroots;i++){
+	complex<double> dP4=0.0;
+	complex<double> z=roots[i];
+	for(int k=1;k<=4;k++){
+	  dP4+=c[k]*(double)k;
+	  dP4/=z;
+	};
+	//Result is dP4 = dP/dz(z_k) / z_k^4
+	//dP4=((((c1/z+2*c2)/z+3*c3)/z+4*c4)/z
+	//   =(c1+2*c2*z+3*c3*z^2+4*z4+z^4)/z^4
+	complex<double> delta=-c[5]/dP4;
+	if(debug)cout<<"dP4="<<dP4<<" delta="<<delta<<endl;
+	///We can derive this following expression by setting P5(x+eps)-P4(x)=0, then solve liniarly for eps
+	///For abs(delta)<<0.2 and abs(delta)>>0.2 the result approximates that in the comment above, but all values other than
+	///delta=-0.2 are allowed.  In this case, the 0.2 arises because n=5, not arbitrarily.
+	roots[i]*=(1.0+cplx_1/(5.0+cplx_1/delta));
+      }
+    }
+    //For debugging, test the results;
+    if(debug){
+      cout<<"complex poly test:"<<endl;
+      for( int i=0;i<nroots;i++){
+	complex<ldouble> res=0.0;
+	complex<ldouble> z=roots[i];
+	for(int k=5;k>=0;k--){
+	  res*=z;
+	  res+=c[k];
 	}
+	complex<long double> lres(real(res),imag(res)),lz(real(z),imag(z));
+	cout<<i<<": "<<lz<<"->"<<lres<<endl;
       }
-      //For now we just adopt the ordering from the SG code.  Might change to something else if needed...
-    };
+    }
+  
+    result.clear();
+    maxerr=0;
+    minerrfail=INFINITY;
+    iminerrfail=-1;
+    npos=nneg=0;
+    int ndup=0;
+    for(int i=0;i<nroots;i++){
+      Point newp=Point(0,0);
+      if(z1scaled)
+	newp=Point(real(roots[i])*z1,imag(roots[i])*z1);
+      else 
+	newp=Point(real(roots[i]),imag(roots[i]));
+      if(no_check) result.push_back(newp);
+      else{
+	//Test solutions against the lens equation, getting the parity in the same pass
+	double err=image_residual(newp,p,parities[i]);
+	errs[i]=err;
+	if(debug ){
+	  cout<<"testing: "<<roots[i]<<" -> err="<<err<<(err<TOL?" < ":"!< ")<<TOL<<" parity="<<parities[i]<<endl;
+	}
+	if(err<TOL){     //RHS is squared estimate in propagating error of LEADTOL in root through map()
+	  bool dup=false;//polishing from saved roots can converge two roots onto one image
+	  for(const Point &im : result){
+	    double dx=newp.x-im.x,dy=newp.y-im.y;
+	    if(dx*dx+dy*dy<dThTol*dThTol*(1+newp.x*newp.x+newp.y*newp.y))dup=true;
+	  }
+	  if(dup){
+	    ndup++;
+	    errs[i]=INFINITY;
+	    continue;
+	  }
+	  result.push_back(newp);
+	  if(parities[i]>0)npos++;
+	  else nneg++;
+	  if(err>maxerr){
+	    maxerr=err;
+	  }
+	} else {
+	  if(err<minerrfail){
+	    minerrfail=err;
+	    iminerrfail=i;
+	  }
+	}
+	//For now we just adopt the ordering from the SG code.  Might change to something else if needed...
+      };
+    }
+    int ni=result.size();
+    if(no_check or not escalate_precision or prec>=WittMao_max_precision)break;
+    ///The confidence of the classification is the factor by which the roots nearest the tolerance (on either
+    ///side) clear it.
+    double confidence=min(minerrfail/TOL,(maxerr>0?TOL/maxerr:INFINITY));
+    if(ni >= NimageMin and ni <= NimageMax and (ni-NimageMin)%2==0 and nneg==npos+1
+       and confidence>=WittMao_min_confidence and ndup==0)break;
+    if(debug)cout<<"invmapWittMao: "<<ni<<" images ("<<npos<<"+,"<<nneg<<"-) with confidence "<<confidence<<" at precision level "<<prec<<", escalating."<<endl;
+    polish_only=false;
   }
   if(test_images){
     ///After first pass application of the lens map test to each images we apply checks on the
     ///overall set of images.  There should be at least NimageMin and no fewer than NimageMax
-    ///images and the count of any images in excess of NimageMin should be even.
-    ///If there are too many images, then we discard the one which most-marginally passed the map
-    ///test.  If there is one too few, then we add back a candidate image which moderately failed the map test (within a factor of 100), if present.  We could potentially do better by checking
-    ///the parities of the images to be added or deleted.
+    ///images and the count of any images in excess of NimageMin should be even.  For the binary lens there
+    ///is also one more negative than positive parity image.
+    ///If there is one image too many, then we discard the most-marginally passing image among those of the
+    ///parity in excess.  If there is one too few, then we add back the candidate image which least failed
+    ///the map test (within a factor of 100), if it has the missing parity.
     ///Note, that later, for finite source cases, we may add back more images deemed to be
     ///missing extremely near the lens points.  That logic could be applied here as well.
     int ni=result.size();
@@ -3252,8 +4693,19 @@ vector<Point> GLensBinary::invmapWittMao(const Point &p,bool no_check){
     bool pass3=( (ni-NimageMin)%2==0 );
     if(not (pass1 and pass2 and pass3)){
       if(pass1 and not pass3){//This is something we can try to fix:
-	//cout<<"erasing a candidate image "<<imaxerr<<endl;
-	result.erase(result.begin()+imaxerr);
+	int excess=(nneg>npos+1?-1:1);
+	double maxerr_excess=-1;
+	int ierase=-1;
+	for(int i=0,j=0;i<nroots;i++){
+	  if(!(errs[i]<TOL))continue;
+	  if(parities[i]==excess and errs[i]>maxerr_excess){
+	    maxerr_excess=errs[i];
+	    ierase=j;
+	  }
+	  j++;
+	}
+	//cout<<"erasing a candidate image "<<ierase<<endl;
+	if(ierase>=0)result.erase(result.begin()+ierase);
       } else if(ni+1==NimageMin and minerrfail<TOL*100){//Looks like we missed an image near one of the lenses, but can see it with related TOL
 	Point newp=Point(0,0);
 	int i=iminerrfail;
@@ -3261,8 +4713,8 @@ vector<Point> GLensBinary::invmapWittMao(const Point &p,bool no_check){
 	  newp=Point(real(roots[i])*z1,imag(roots[i])*z1);
 	else 
 	  newp=Point(real(roots[i]),imag(roots[i]));
-	double mg=mag(newp);
-	if(mg<0)result.push_back(newp);
+	int missing=(nneg>npos?1:-1);
+	if(parities[i]==missing)result.push_back(newp);
       } else if(false and NimageMin==ni+1){
 	//Seem to be missing one of the near-point-lens images.
 	//First we compute image polarizations, listing the odd images
@@ -3308,73 +4760,6 @@ vector<Point> GLensBinary::invmapWittMao(const Point &p,bool no_check){
   return result;
 };
 
-/*
-int GLensBinary::poly_root_integration_func_vec (double t, const double theta[], double thetadot[], void *instance){
-  require_time_dependent_values();
-  //This is similar to the image point integration func, but we integrate the roots of the poly to be directly
-  //We use notation beta.x + i beta.y -> w and theta.x + i theta.y -> z
-  //
-  //Another change is that we have here written this function explicitly for sepcific derived GLens class
-  //
-  GLensBinary *thisobj = static_cast<GLensBinary *>(instance);
-  const Trajectory *traj=thisobj->trajectory;
-  Point beta0=thisobj->get_obs_pos(*traj,t);
-  Point betadot=thisobj->get_obs_vel(*traj,t);
-  complex<double> wdot(betadot.x,betadot.y);
-  bool fail=false;
-  for(int k=0;k<2*thisobj->NimageMax;k++)thetadot[k]=0;
-  //cout<<"beta0=("<<beta0.x<<","<<beta0.y<<")"<<endl;
-  for(int image =0; image<NimageMax;image++){
-    //Point p(theta[image*2+0],theta[image*2+1]);
-    complex<double> z(theta[image*2+0],theta[image*2+1]);
-    //double j00i,j10i,j01i,j11i,invJ = thisobj->invjac(p,j00i,j01i,j10i,j11i);
-    /*
-    //This block was provides contraint-driving in the original formulation
-    //It seems possible, but perhaps complicated to do this in the poly_root case
-    //The issue is that there is no explict inverse transform w(z) with the polynomial
-    //because that polynomial includes up to cubic-order combinations of w and w*.
-    //Using the original map equation w(z), as before, is not appropriate here since
-    //The polynomial has solutions which are inconsistent with that map function.
-    //A plausible way to implement this is to assume that the error in w is small
-    //then solve the w(z),w*(z) system in the small dw limit.  The resulting expression
-    //is a little bit complicated, so we don't yet implement that.
-    Point beta=thisobj->map(p);
-    double dx=beta.x-beta0.x,dy=beta.y-beta0.y;
-    double adjbetadot[2];
-    //double rscale=thisobj->estimate_scale(Point(theta[0],theta[1]));
-    //if our image is near one of the lenses, then we need to tread carefully
-    double rk=thisobj->kappa;//*rscale;
-    adjbetadot[0] = betadot.x;
-    adjbetadot[1] = betadot.y;
-    if(isfinite(dx))adjbetadot[0] += -rk*dx;
-    if(isfinite(dy))adjbetadot[1] += -rk*dy;
-    * /
-    //Next we compute derivative, which previously looked like:
-    //
-    //if(isfinite(invJ)){
-    //thetadot[2*image]   = (j00i*adjbetadot[0]+j01i*adjbetadot[1]);
-    //thetadot[2*image+1] = (j10i*adjbetadot[0]+j11i*adjbetadot[1]);
-    //}
-    //
-    //In the complex notation, the effective invjacobian is simpler
-    // zdot = ( wdot + Ecc*wdotcc) * mu
-    // where E = nu1/z1^2 + nu2/z2^2, cc indicates conjugate and
-    // the magnification mu = 1 / (1 - E*Ecc) 
-    complex<double> c1((thisobj->sL)/2,0), z1=z-c1, z2=z+c1;
-    complex<double> E = (1-nu)/z1/z1 + nu/z2/z2;
-    complex<double> zdotinvmu =  wdot +conj(E*wdot) ;
-    double invmu = 1-norm(E);
-    if(invmu==0){
-      //here we panic and rather than return NAN, we evolve as if the lensing effect is unit scale
-      //this is wrong, but it will move use past the point where
-      invmu=1;
-    }
-    thetadot[2*image]   = zdotinvmu.real()/invmu;
-    thetadot[2*image+1] = zdotinvmu.imag()/invmu;
-  }
-
-  return !fail?GSL_SUCCESS:3210124;
-}*/
 
 double GLensBinary::mag(const Point &p){
   require_time_dependent_values();
@@ -3423,19 +4808,165 @@ double GLensBinary::invjac(const Point &p,double &ij00,double &ij01,double &ij10
   return mu;
 };
 
+///Integration step for the images with the binary map and inverse Jacobian inlined
+bool GLensBinary::evolve_images(double &t, double t1, double &h, double theta[]){
+  ImageFlow<GLensBinary> flow(this);
+  return integrator.evolve(flow,2*Ntheta,t,t1,h,theta);
+};
+
+///Derivative of the Witt-Mao polynomial roots for evolve_roots.
+///
+///Each root z of the polynomial pairs with zt=conj(w)+sum_k m_k/(z-z_k), which is conj(z) for an image, such
+///that w=z-sum_k m_k/(zt-z_k).  Differentiating this pair of equations gives
+///  zdot = (wdot - Et*conj(wdot)) / (1 - E*Et)
+///with E=sum_k m_k/(z-z_k)^2 and Et the same for zt.  For images this is the inverse Jacobian of the map, and
+///for ghost roots it is the exact motion of the root.  For the constraint-driving term we take the residual dw
+///of the first equation to be small and drive it with the linear correction -kappa*dw/(1-E*Et), which for
+///images matches the driving term of ImageFlow.
+struct GLensBinary::RootFlow {
+  GLensBinary *lens;
+  int nroots;
+  RootFlow(GLensBinary *lens,int nroots):lens(lens),nroots(nroots){};
+  bool operator()(double t, const double theta[], double thetadot[]){
+    const Trajectory *traj=lens->trajectory;
+    Point beta0=lens->get_obs_pos(*traj,t);
+    Point betadot=lens->get_obs_vel(*traj,t);
+    complex<double> w(beta0.x,beta0.y),wdot(betadot.x,betadot.y);
+    double z1=lens->sL/2,m1=1-lens->nu,m2=lens->nu,rk=lens->kappa;
+    for(int k=0;k<nroots;k++){
+      complex<double> z(theta[2*k],theta[2*k+1]);
+      complex<double> d1=1.0/(z-z1),d2=1.0/(z+z1);
+      complex<double> zt=conj(w)+m1*d1+m2*d2;
+      complex<double> dt1=1.0/(zt-z1),dt2=1.0/(zt+z1);
+      complex<double> E=m1*d1*d1+m2*d2*d2, Et=m1*dt1*dt1+m2*dt2*dt2;
+      complex<double> dw=z-m1*dt1-m2*dt2-w;
+      complex<double> zdot=(wdot-rk*dw-Et*conj(wdot))/(1.0-E*Et);
+      if(!(isfinite(real(zdot)) and isfinite(imag(zdot))))return false;//at a lens point or a root merger
+      thetadot[2*k]=real(zdot);
+      thetadot[2*k+1]=imag(zdot);
+    }
+    return true;
+  };
+};
+
+///All the roots of the Witt-Mao polynomial, for the root-integration engine.
+///Not in the planetary domain, where the polynomial is poorly conditioned, and only where the polynomial is
+///effectively of full order.
+int GLensBinary::poly_roots(const Point &p, double theta[]){
+  if(planetary_inversion and testPlanetary(p))return 0;
+  Images roots=invmapWittMao(p,true);
+  if(roots.size()!=NimageMax)return 0;
+  for(int k=0;k<roots.size();k++){
+    theta[2*k]=roots[k].x;
+    theta[2*k+1]=roots[k].y;
+  }
+  return roots.size();
+};
+
+bool GLensBinary::evolve_roots(double &t, double t1, double &h, double theta[], int nroots){
+  RootFlow flow(this,nroots);
+  return integrator.evolve(flow,2*nroots,t,t1,h,theta);
+};
+
+///Select the images among the polynomial roots by the map test of invmapWittMao.  The return value is the
+///least distance of any root from a caustic-crossing merger: for images the separation from the nearest
+///other image (image pairs merge on leaving a caustic), and for ghost roots the distance |zt-conj(z)| from
+///being an image, with zt as in RootFlow (ghost pairs become image pairs on entering a caustic).
+double GLensBinary::root_images(const Point &p, const double theta[], int nroots, Images &thetas){
+  const double TOL=LEADTOL*LEADTOL;
+  double z1=sL/2,m1=1-nu,m2=nu;
+  complex<double> w(p.x,p.y);
+  thetas.clear();
+  double gap=INFINITY;
+  for(int k=0;k<nroots;k++){
+    Point th(theta[2*k],theta[2*k+1]);
+    int parity;
+    if(image_residual(th,p,parity)<TOL){
+      for(const Point &im : thetas)gap=min(gap,sqrt((th.x-im.x)*(th.x-im.x)+(th.y-im.y)*(th.y-im.y)));
+      thetas.push_back(th);
+    } else {
+      complex<double> z(th.x,th.y);
+      complex<double> zt=conj(w)+m1/(z-z1)+m2/(z+z1);
+      gap=min(gap,abs(zt-conj(z)));
+    }
+  }
+  return gap;
+};
+
+///Critical curves of the binary lens.
+///
+///On the critical curves the shear has unit modulus, sum_i m_i/(z-z_i)^2 = exp(i*phi), which for each phi is
+///a quartic in z.  We step phi around the circle, polishing the previous roots, and match the new roots to
+///the previous ones so that each of the four roots traces a continuous branch.  At phi=2pi the branches
+///return to the starting roots, possibly permuted, and following that permutation closes the curves
+///(one curve for resonant, two for wide, three for close binaries).
+void GLensBinary::find_critical_curves(int n){
+  require_time_dependent_values();
+  const int nr=4;
+  const double za=sL/2,zb=-sL/2,ma=1-nu,mb=nu;
+  //ma*(z-zb)^2 + mb*(z-za)^2 - exp(i*phi)*(z-za)^2*(z-zb)^2 = 0
+  const double sum=za+zb,prod=za*zb;
+  const double cquart[nr+1]={prod*prod,-2*prod*sum,sum*sum+2*prod,-2*sum,1};
+  const double cquad[3]={ma*zb*zb+mb*za*za,-2*(ma*zb+mb*za),ma+mb};
+  vector<vector<Point> > branches(nr,vector<Point>(n));
+  complex<double> roots[nr],poly[nr+1];
+  //Generic starting points; the default start at z=0 fails when the quartic is even (q=1).
+  for(int k=0;k<nr;k++)roots[k]=polar(1.0,0.5+k*M_PI/2);
+  for(int j=0;j<=n;j++){
+    //Half-step offset avoids phi=0,pi where the curves touch at the topology transitions
+    complex<double> w=polar(1.0,2*M_PI*(j+0.5)/n),last[nr];
+    for(int k=0;k<=nr;k++)poly[k]=-w*cquart[k]+(k<3?cquad[k]:0);
+    for(int k=0;k<nr;k++)last[k]=roots[k];
+    cmplx_roots_gen<double>(roots,poly,nr,true,true);
+    if(j>0){
+      //Order the new roots to best match the previous step
+      int perm[nr]={0,1,2,3},best[nr]={0,1,2,3};
+      double dbest=INFINITY;
+      do {
+	double d=0;
+	for(int k=0;k<nr;k++)d+=norm(roots[perm[k]]-last[k]);
+	if(d<dbest){
+	  dbest=d;
+	  copy(perm,perm+nr,best);
+	}
+      } while(next_permutation(perm,perm+nr));
+      for(int k=0;k<nr;k++)last[k]=roots[best[k]];
+      copy(last,last+nr,roots);
+    }
+    if(j<n)for(int k=0;k<nr;k++)branches[k][j]=Point(real(roots[k]),imag(roots[k]));
+  }
+  //Join the branches into closed curves; each branch continues from its end onto the branch starting nearest there.
+  critical_curves.clear();
+  bool joined[nr]={false,false,false,false};
+  for(int k=0;k<nr;k++){
+    if(joined[k])continue;
+    vector<Point> curve;
+    for(int b=k;not joined[b];){
+      joined[b]=true;
+      curve.insert(curve.end(),branches[b].begin(),branches[b].end());
+      int next=0;
+      for(int l=1;l<nr;l++)
+	if(norm(roots[b]-complex<double>(branches[l][0].x,branches[l][0].y))<norm(roots[b]-complex<double>(branches[next][0].x,branches[next][0].y)))next=l;
+      b=next;
+    }
+    critical_curves.push_back(curve);
+  }
+};
+
 ///Compute the complex lens shear, and some number of its derivatives
 /// gamma = \sum_i^N nu_i / (zc*zc)   =  dbetac/dz
-vector<complex<double> > GLensBinary::compute_shear(const Point &p, int nder)const{
+ShearDerivs GLensBinary::compute_shear(const Point &p, int nder)const{
   require_time_dependent_values();
   double x=p.x,y=p.y,x1=x-sL/2,x2=x+sL/2;
   complex<double> z1(x1,y), z2(x2,y);
-  vector<complex<double> >gammas;   
+  ShearDerivs gammas;   
+  if(nder>=(int)gammas.size()){cout<<"GLensBinary::compute_shear: Only up to "<<gammas.size()-1<<" derivatives are available."<<endl;exit(1);}
   complex<double> dNgamma1=(1-nu)/z1/z1, dNgamma2=nu/z2/z2;
-  gammas.push_back(dNgamma1+dNgamma2);
+  gammas[0]=dNgamma1+dNgamma2;
   for(int n=0;n<nder;n++){
     dNgamma1 *=-(n+2.0)/z1;
     dNgamma2 *=-(n+2.0)/z2;
-    gammas.push_back(dNgamma1+dNgamma2);
+    gammas[n+1]=dNgamma1+dNgamma2;
   }
   return gammas;
 }
@@ -10,7 +10,10 @@
 #include <iomanip>
 #include "bayesian.hh"
 #include "trajectory.hh"
+#include "dormand_prince.hh"
 #include <complex>
+#include <array>
+#include <typeinfo>
 
 using namespace std;
 extern bool debug;
@@ -29,6 +32,197 @@ extern bool debug;
 ///polynomial root-finding problem.  Generically, we can grid the lens plane and
 ///apply brute force. This would need to be done only once per set of lens params (masses,separation).
 
+///Fixed-capacity container for the set of images of a single source point.
+///
+///None of our lens models have more than a handful of images (NimageMax<=5 for a binary),
+///so the images are held inline rather than on the heap.  This provides the subset of the
+///std::vector interface used for image lists, and converts to vector<Point> where a lasting
+///copy is wanted (e.g. the thetas_series output of compute_trajectory).
+template<int N> class ImageSet {
+  Point pts[N];
+  int n;
+public:
+  static const int capacity=N;
+  ImageSet():n(0){};
+  explicit ImageSet(int size,const Point &p=Point()):n(0){resize(size,p);};
+  ImageSet(const vector<Point> &v):n(0){for(const Point &p : v)push_back(p);};
+  int size()const{return n;};
+  bool empty()const{return n==0;};
+  void clear(){n=0;};
+  void resize(int size,const Point &p=Point()){
+    if(size>N){cout<<"ImageSet::resize: Requested size "<<size<<" exceeds capacity "<<N<<"."<<endl;exit(1);}
+    for(int i=n;i<size;i++)pts[i]=p;
+    n=size;
+  };
+  void push_back(const Point &p){
+    if(n>=N){cout<<"ImageSet::push_back: Capacity "<<N<<" exceeded."<<endl;exit(1);}
+    pts[n++]=p;
+  };
+  Point *erase(Point *it){
+    for(Point *jt=it;jt+1<pts+n;jt++)*jt=*(jt+1);
+    n--;
+    return it;
+  };
+  Point &operator[](int i){return pts[i];};
+  const Point &operator[](int i)const{return pts[i];};
+  Point *begin(){return pts;};
+  Point *end(){return pts+n;};
+  const Point *begin()const{return pts;};
+  const Point *end()const{return pts+n;};
+  operator vector<Point>()const{return vector<Point>(pts,pts+n);};
+};
+///Image set type returned by invmap, with room for the largest number of images of any lens here.
+typedef ImageSet<5> Images;
+///Shear and its first two derivatives, as returned by compute_shear
+typedef array<complex<double>,3> ShearDerivs;
+
+///Flat (structure-of-arrays) results of a light-curve computation by GLens::compute_trajectory.
+///
+///Sample k is at time t[k] with magnification mag[k] and its uncertainty dmag[k] (zero for point sources).
+///Its images are the entries img_offset[k]<=j<img_offset[k+1] of img_x, img_y and img_mu, the last being
+///the signed magnification of each image.  The integrator may record samples between the trajectory's
+///times, so index[i] gives the sample for trajectory time i.  For finite sources each sample has a single
+///"image", the offset of the image centroid from the source, with the total magnification.  clear() keeps
+///the storage, so a result reused across calls stops allocating once it has grown to size.
+class TrajectoryResult {
+public:
+  vector<double> t,mag,dmag;
+  vector<int> img_offset;
+  vector<double> img_x,img_y,img_mu;
+  vector<int> index;
+  TrajectoryResult(){clear();};
+  void clear(){
+    t.clear();mag.clear();dmag.clear();
+    img_offset.assign(1,0);
+    img_x.clear();img_y.clear();img_mu.clear();
+    index.clear();
+  };
+  int size()const{return t.size();};
+  int nimages(int k)const{return img_offset[k+1]-img_offset[k];};
+  Point image(int k,int j)const{int l=img_offset[k]+j;return Point(img_x[l],img_y[l]);};
+  Images images(int k)const{
+    Images thetas;
+    for(int l=img_offset[k];l<img_offset[k+1];l++)thetas.push_back(Point(img_x[l],img_y[l]));
+    return thetas;
+  };
+  ///Append a sample, with the images thetas having magnifications mus
+  void push_back(double time, double mg, double dmg, const Images &thetas, const double *mus){
+    t.push_back(time);
+    mag.push_back(mg);
+    dmag.push_back(dmg);
+    for(int j=0;j<thetas.size();j++){
+      img_x.push_back(thetas[j].x);
+      img_y.push_back(thetas[j].y);
+      img_mu.push_back(mus[j]);
+    }
+    img_offset.push_back(img_x.size());
+  };
+  ///Append the samples of another result, as for the next part of the same trajectory
+  void append(const TrajectoryResult &other){
+    int koff=t.size(),joff=img_x.size();
+    t.insert(t.end(),other.t.begin(),other.t.end());
+    mag.insert(mag.end(),other.mag.begin(),other.mag.end());
+    dmag.insert(dmag.end(),other.dmag.begin(),other.dmag.end());
+    img_x.insert(img_x.end(),other.img_x.begin(),other.img_x.end());
+    img_y.insert(img_y.end(),other.img_y.begin(),other.img_y.end());
+    img_mu.insert(img_mu.end(),other.img_mu.begin(),other.img_mu.end());
+    for(size_t k=1;k<other.img_offset.size();k++)img_offset.push_back(other.img_offset[k]+joff);
+    for(int k : other.index)index.push_back(k+koff);
+  };
+};
+
+///Source-polygon vertices and their (checked) images from an image_area_mag pass.
+///
+///Vertex i of an N-gon is at angle 2*pi*i/N, so when the polygon order is raised by an integer factor at the same
+///epoch, every old vertex is also a vertex of the new polygon and its images can be reused instead of inverted again.
+struct PolygonVertexCache {
+  Point p;
+  double radius;
+  int N;
+  vector<Point> curve;
+  vector<vector<Point> > image_points;
+  vector<vector<double> > image_point_mags;
+  vector<double> vertex_mags;
+  PolygonVertexCache(){clear();};
+  void clear(){N=0;radius=0;curve.clear();image_points.clear();image_point_mags.clear();vertex_mags.clear();};
+  ///Stride by which the vertices of an n-gon about p with this radius advance through the cached ones, or 0 if none match
+  int stride(const Point &p_, double radius_, int n)const{
+    if(N==0 or n%N!=0 or radius_!=radius or p_.x!=p.x or p_.y!=p.y)return 0;
+    return n/N;
+  };
+  ///Images of the cached vertex nearest in angle to phi, as starting points for a concentric polygon of another radius
+  const vector<Point> *seed(const Point &p_, double radius_, double phi)const{
+    if(N==0 or radius_==radius or p_.x!=p.x or p_.y!=p.y)return NULL;
+    int i=(int)floor(phi*N/(2*M_PI)+0.5);
+    return &image_points[(i%N+N)%N];
+  };
+};
+
+///Source-plane bins for inverse ray shooting (see GLens::shoot_rays), in the lens frame.
+///
+///distance() is a lower bound on the distance of a point from the binned region (0 within it), and max_radius() an
+///upper bound on the distance from the origin of any point in it.  These let the ray shooting skip lens-plane tiles
+///whose image cannot reach the region.
+struct RayBins {
+  virtual ~RayBins(){};
+  virtual int size()const=0;
+  virtual double distance(const Point &b)const=0;
+  virtual double max_radius()const=0;
+  ///Set cells[i] to the bin containing (bx[i],by[i]), or -1 if there is none
+  virtual void bin(const double *bx, const double *by, int n, int *cells)const=0;
+};
+
+///A grid of nx by ny cells of size dx by dy, with lower-left corner LL, for magnification maps.
+///The grid is laid out in the frame with the given origin and x-axis direction (c,s) in the lens frame, as for
+///the trajectory frame.  Cell (i,j) is bin j*nx+i.
+struct RectRayBins : public RayBins {
+  Point LL,origin;
+  double dx,dy,c,s;
+  int nx,ny;
+  RectRayBins(const Point &LL, double dx, double dy, int nx, int ny, const Point &origin=Point(0,0), double c=1, double s=0):LL(LL),origin(origin),dx(dx),dy(dy),c(c),s(s),nx(nx),ny(ny){};
+  int size()const{return nx*ny;};
+  double distance(const Point &b)const{
+    double u=(b.x-origin.x)*c+(b.y-origin.y)*s-LL.x,v=(b.y-origin.y)*c-(b.x-origin.x)*s-LL.y;
+    double du=fmax(fmax(-u,u-nx*dx),0.0),dv=fmax(fmax(-v,v-ny*dy),0.0);
+    return sqrt(du*du+dv*dv);
+  };
+  double max_radius()const{
+    double r=0;
+    for(int k=0;k<4;k++){
+      double u=LL.x+(k%2)*nx*dx,v=LL.y+(k/2)*ny*dy;
+      r=fmax(r,hypot(origin.x+u*c-v*s,origin.y+u*s+v*c));
+    }
+    return r;
+  };
+  void bin(const double *bx, const double *by, int n, int *cells)const{
+    for(int i=0;i<n;i++){
+      double u=((bx[i]-origin.x)*c+(by[i]-origin.y)*s-LL.x)/dx,v=((by[i]-origin.y)*c-(bx[i]-origin.x)*s-LL.y)/dy;
+      cells[i]=-1;
+      if(u>=0 and u<nx and v>=0 and v<ny)cells[i]=(int)v*nx+(int)u;//fails for NaN rays too
+    }
+  };
+};
+
+///Annuli of a source disk, equally spaced in mu=sqrt(1-r^2/radius^2), for limb-darkened finite sources.
+///Bin 0 is the central disk, bin n-1 the annulus at the limb.
+struct DiskRayBins : public RayBins {
+  Point center;
+  double radius;
+  int n;
+  DiskRayBins(const Point &center, double radius, int n):center(center),radius(radius),n(n){};
+  int size()const{return n;};
+  double distance(const Point &b)const{return fmax(0.0,hypot(b.x-center.x,b.y-center.y)-radius);};
+  double max_radius()const{return hypot(center.x,center.y)+radius;};
+  void bin(const double *bx, const double *by, int nb, int *cells)const{
+    const double rinv2=1/radius/radius;
+    for(int i=0;i<nb;i++){
+      double dx=bx[i]-center.x,dy=by[i]-center.y,x=(dx*dx+dy*dy)*rinv2;
+      cells[i]=-1;
+      if(x<1)cells[i]=min((int)((1-sqrt(1-x))*n),n-1);
+    }
+  };
+};
+
 ///This is a generic (abstract) base class for thin gravitational lens objects.
 class GLens :public bayes_component{
 protected:
@@ -41,11 +235,28 @@ protected:
   int finite_source_Npoly_max;
   int idx_log_rho_star;
   double source_radius;
+  ///limb darkening law (0 uniform, 1 linear, 2 quadratic) in mu=sqrt(1-r^2), I(mu)/I(1)=1-a(1-mu)-b(1-mu)^2,
+  ///with the maximum number of annuli for the polygon/contour methods and the parameter indices if the coefficients are fit.
+  ///The quadratic law is fit in q1=(a+b)^2, q2=a/(2(a+b)) (Kipping 2013), for which the unit square maps onto the
+  ///coefficients with the brightness positive and decreasing toward the limb.
+  int source_LD_law;
+  int source_LD_annuli;
+  bool fit_source_LD;
+  int idx_LD_a,idx_LD_b;
+  double source_LD_a,source_LD_b;
   double source_var;
   double finite_source_refine_limit;
   double finite_source_tol;
   double finite_source_decimate_dtmin;
   ofstream *finite_source_image_ofstream;
+  ///Number of OpenMP threads over which finite_source_compute_trajectory schedules the epochs, and whether the
+  ///saved roots are reset at each epoch so that results don't depend on the order (e.g. for regression tests)
+  int finite_source_threads;
+  bool finite_source_deterministic;
+  ///Number of OpenMP threads for inverse ray shooting, and the number of rays per pixel (in the absence of lensing)
+  ///with which writeMagMap makes ray-shot maps (0 for point-source maps)
+  int ray_threads;
+  int magmap_rays;
   //StateSpace and Prior
   stateSpace GLSpace;
   bool time_dependent,have_time_dependent_values;
@@ -57,8 +268,32 @@ protected:
   virtual Point traj2lens(const Point tp)const {return tp;};
   virtual Point lens2traj(const Point tp)const {return tp;};
   virtual Point traj2lensdot(const Point tv, const Point tp)const {return tv;};//Derivative of linear traj2lens transform
+  ///traj2lens applied in place to n points, at the current time-dependent values
+  virtual void traj2lens_batch(size_t n, double *x, double *y)const{
+    for(size_t i=0;i<n;i++){
+      Point p=traj2lens(Point(x[i],y[i]));
+      x[i]=p.x;
+      y[i]=p.y;
+    }
+  };
 public:
   virtual Point get_obs_pos(const Trajectory & traj,const double time)const{return traj2lens(traj.get_obs_pos(time));};//time=(t-tpass)/tE is relevant only with time-varying lens
+  ///Batch form of get_obs_pos for n times.  The whole observer path is computed in one pass of the trajectory, then
+  ///transformed to the lens frame.  For a time-dependent lens, the time-dependent values are left unset after.
+  void get_obs_pos_batch(const Trajectory & traj, const double *t, size_t n, double *x, double *y){
+    traj.get_obs_pos_batch(t,n,x,y);
+    if(not time_dependent){
+      traj2lens_batch(n,x,y);
+      return;
+    }
+    for(size_t i=0;i<n;i++){
+      set_time_dependent_values(t[i]);
+      Point p=traj2lens(Point(x[i],y[i]));
+      x[i]=p.x;
+      y[i]=p.y;
+    }
+    unset_time_dependent_values();
+  };
   ///Call this function before anything which may be time dependent
   virtual void set_time_dependent_values(const double time){have_time_dependent_values=true;};
   virtual void require_time_dependent_values()const{if(not have_time_dependent_values)cout<<"GLens:Error time depended values required but not set"<<this->print_info()<<endl;};
@@ -68,22 +303,87 @@ public:
 protected:
   ///static access for use with non-member GSL integration routines
   static int GSL_integration_func (double t, const double theta[], double thetadot[], void *instance);
-  static int GSL_integration_func_vec (double t, const double theta[], double thetadot[], void *instance);
-  virtual int poly_root_integration_func_vec (double t, const double theta[], double thetadot[], void *instance){
-    cout<<"GLens::poly_root_integration_func:  Not defined!"<<endl;exit(1);};
+  ///In-tree integration of the image positions, used by compute_trajectory in integrate mode.
+  ///evolve_images takes one step as gsl_odeiv2_evolve_apply did, returning false on failure.  The derivative
+  ///is ImageFlow<Lens>, which calls Lens's map and invjac non-virtually, so derived classes with their own
+  ///map/invjac override evolve_images with their own instance.
+  DormandPrince<2*Images::capacity> integrator;
+  template<class Lens> struct ImageFlow;
+  virtual bool evolve_images(double &t, double t1, double &h, double theta[]);
+  ///For the root-integration engine (compute_trajectory_integrate_roots).  poly_roots fills theta with all the
+  ///roots of the lens polynomial for source p, including the ghost roots which are not images, and returns their
+  ///number (zero where the lens has no suitable polynomial).  evolve_roots steps nroots roots as evolve_images
+  ///does the images.  root_images selects the images among the roots, returning how near the roots are to a
+  ///caustic-crossing merger.
+  virtual int poly_roots(const Point &p, double theta[]){return 0;};
+  virtual bool evolve_roots(double &t, double t1, double &h, double theta[], int nroots){return false;};
+  virtual double root_images(const Point &p, const double theta[], int nroots, Images &thetas){thetas.clear();return 0;};
   //static Point get_obs_pos(const GLens* instance, const Trajectory & traj,double time){return instance->get_obs_pos(traj,time);};
   //static Point get_obs_vel(const GLens* instance, const Trajectory & traj,double time){return instance->get_obs_vel(traj,time);};
   ///For use with GSL integration
   double kappa=.1;
   int Ntheta;
   bool use_integrate,have_integrate,do_verbose_write;
+  ///Newton continuation of images between trajectory samples
+  bool use_newton;
+  ///Integrate all the polynomial roots rather than the images, switching to the polynomial where a pair of
+  ///roots is within int_roots_gap of merging
+  bool use_int_roots;
+  double int_roots_gap;
   double GL_int_tol,GL_int_mag_limit;
+  ///Source-plane half-width of the windows around caustic crossings where the polynomial is solved at every
+  ///sample (and finite-source methods are applied); zero for no caustic-crossing segmentation.
+  double caustic_window;
+  vector<double> caustic_crossings;
+  ///Number of chunks of the time samples computed in parallel by compute_trajectory, and the least number of samples per chunk
+  int trajectory_chunks;
+  static const int min_chunk_samples=64;
+  ///Working copies of the lens for parallel chunks, kept between calls, so that a call only copies the current
+  ///lens into them rather than cloning and deleting.  A copy of a lens starts with no working copies of its own.
+  struct work_lens_pool{
+    vector<GLens*> lenses;
+    work_lens_pool(){};
+    work_lens_pool(const work_lens_pool &){};
+    work_lens_pool &operator=(const work_lens_pool &){return *this;};
+    ~work_lens_pool(){for(GLens *l : lenses)delete l;};
+  };
+  work_lens_pool work_lenses;
+  ///Bring the first n working copies up to date with this lens, before entering a parallel region
+  void prepare_work_lenses(int n);
+  ///Copy this lens into other, which is a clone of a lens of the same type.  Each class copies only if it is the
+  ///most derived type, and otherwise returns false, so that the caller clones afresh.
+  virtual bool assign_to(GLens *other)const{
+    if(typeid(*this)!=typeid(GLens) or typeid(*other)!=typeid(GLens))return false;
+    *other=*this;
+    return true;
+  };
+  void prepare_caustic_crossings(const Trajectory &traj, vector<double> &crossing_dt);
+  double image_mags(const Images &thetas, double *mus);
+  void compute_trajectory_range(const Trajectory &traj, int i0, int i1, bool integrate, const vector<double> &crossing_dt, TrajectoryResult &res, double *mags_out=nullptr);
+  ///Relative magnification tolerance for adaptive sampling of light curves (zero to evaluate every sample),
+  ///and the spacing of the initial coarse samples
+  double adaptive_tol;
+  static const int adaptive_stride=32;
+  void compute_trajectory_adaptive(const Trajectory &traj, int i0, int i1, const vector<double> &crossing_dt, TrajectoryResult &res, double *mags_out=nullptr);
+  void compute_trajectory_integrate_roots(const Trajectory &traj, int i0, int i1, const vector<double> &crossing_dt, TrajectoryResult &res, double *mags_out=nullptr);
+  double refine_caustic_crossing(const Trajectory &traj, double ta, double tb, double tguess, int n);
   virtual bool testWide(const Point & p,double scale)const{return false;};//test conditions to revert to perturbative inversion
   //Utility for allowing incremental update of nearby solutions.
   bool have_saved_soln;
+  ///Cached critical curves and caustics (lens frame), with the sampling and lens state they were computed for
+  vector<vector<Point> > critical_curves,caustic_curves;
+  ///Bounding boxes (xmin,xmax,ymin,ymax) of each block of caustic_block_size edges of each caustic
+  vector<vector<array<double,4> > > caustic_bboxes;
+  static const int caustic_block_size=16;
+  int caustics_nsamp;
+  array<double,2> caustics_key;
+  ///Parameters which determine the critical curves in the lens frame (q and s for a binary)
+  virtual array<double,2> caustic_state()const{return {{0,0}};};
+  ///Fill critical_curves with the closed critical curves, sampled with n points per branch
+  virtual void find_critical_curves(int n);
 public:
   virtual ~GLens(){};//Need virtual destructor to allow derived class objects to be deleted from pointer to base.
-  GLens(){typestring="GLens";option_name="SingleLens";option_info="Single point-mass lens";have_integrate=false;do_verbose_write=false;have_saved_soln=false;NimageMax=2;NimageMin=2;do_finite_source=false;idx_log_rho_star=-1;source_var=0;finite_source_image_ofstream=NULL;time_dependent=false;set_time_dependent_values(0);};
+  GLens(){typestring="GLens";option_name="SingleLens";option_info="Single point-mass lens";have_integrate=false;use_newton=false;use_int_roots=false;int_roots_gap=0.01;caustic_window=0;trajectory_chunks=1;adaptive_tol=0;do_verbose_write=false;have_saved_soln=false;caustics_nsamp=0;NimageMax=2;NimageMin=2;do_finite_source=false;idx_log_rho_star=-1;source_LD_law=0;source_LD_annuli=1;fit_source_LD=false;idx_LD_a=idx_LD_b=-1;source_LD_a=source_LD_b=0;source_var=0;finite_source_image_ofstream=NULL;finite_source_threads=1;finite_source_deterministic=false;ray_threads=1;magmap_rays=0;time_dependent=false;set_time_dependent_values(0);};
   virtual GLens* clone(){return new GLens(*this);};
   ///Lens map: map returns a point in the observer plane from a point in the lens plane.
   virtual Point map(const Point &p){
@@ -91,11 +391,25 @@ public:
     //cout<<"map: x,y,c"<<x<<", "<<y<<", "<<c<<endl;
     return Point(x*c,y*c);
   };
+  ///Lens map of n points in the lens plane at once, (bx[i],by[i])=map((x[i],y[i]))
+  virtual void map_batch(const double *x, const double *y, int n, double *bx, double *by){
+    for(int i=0;i<n;i++){
+      Point b=map(Point(x[i],y[i]));
+      bx[i]=b.x;
+      by[i]=b.y;
+    }
+  };
+  ///Upper bound on |map(th)-map(c)| for th in the square of half-width s centered on c (infinite if it holds a lens)
+  virtual double map_variation_bound(const Point &c, double s)const;
+  ///Radius about the lens-frame origin within which lie all images of points within bmax of the origin
+  virtual double image_radius_bound(double bmax)const{return (bmax+sqrt(bmax*bmax+4))/2;};
+  ///Inverse ray shooting into bins, with ray spacing h, optionally jittered; returns the number of rays shot
+  long shoot_rays(const RayBins &bins, double h, bool jitter, vector<double> &area, vector<Point> *moment=NULL);
   ///Inverse sens map: invmap returns a set of points in the lens plane which map to some point in the observer plane.  Generally multivalued;
-  virtual vector<Point> invmap(const Point &p){
+  virtual Images invmap(const Point &p){
     long double x=p.x,y=p.y,rsq=x*x+y*y,c0=sqrt(1.0L+4.0L/rsq);
     //cout<<"map: x,y,r2"<<x<<", "<<y<<", "<<rsq<<endl;
-    vector<Point> thetas(2);
+    Images thetas(2);
     double c=(1.0L+c0)/2.0L;
     thetas[0]=Point(x*c,y*c);
     //cout<<"c0="<<c<<endl;
@@ -104,43 +418,112 @@ public:
     thetas[1]=Point(x*c,y*c);
     return thetas;
   };
+  ///Update images for a new source position p by Newton iteration on the lens equation, starting from the
+  ///images of a nearby source position.  Returns false if the set of images may no longer be complete or
+  ///correct, in which case the caller should fall back on invmap.
+  virtual bool newton_track_images(const Point &p, Images &thetas);
+  ///Batched inverse map for n observer-plane points (bx[i],by[i]).
+  ///Images are returned in structure-of-arrays form: the images of point i are (img_x[k],img_y[k])
+  ///for img_offset[i]<=k<img_offset[i+1], with img_offset of length n+1.
+  ///Points are inverted in order, so saved-solution polishing carries along a trajectory as with invmap.
+  virtual void invmap_batch(const double *bx, const double *by, size_t n, vector<int> &img_offset, vector<double> &img_x, vector<double> &img_y);
   ///Given a point in the lens plane, return the magnitude
   virtual double mag(const Point &p){
     long double x=p.x,y=p.y,rsq=x*x+y*y,r4=rsq*rsq;
     return 1.0L/(1.0L-r4);
   };
   ///Given a set of points in the lens plane, return the combined magnitude
-  virtual double mag(const vector<Point> &plist){
+  virtual double mag(const Images &plist){
     double m=0;
-    for(Point p : plist){
+    for(const Point &p : plist){
       m+=abs(mag(p));//syntax is C++11
       if(debug)cout<<"    ("<<p.x<<","<<p.y<<") --> mg="<<m<<endl;
     }
     if(plist.size()==0)return 1; // to more gracefully fail in trivial regions
     return m;
   };
+  virtual double mag(const vector<Point> &plist){
+    double m=0;
+    for(const Point &p : plist){
+      m+=abs(mag(p));
+      if(debug)cout<<"    ("<<p.x<<","<<p.y<<") --> mg="<<m<<endl;
+    }
+    if(plist.size()==0)return 1; // to more gracefully fail in trivial regions
+    return m;
+  };
   ///returns J=det(d(map(p))/dp)^-1, sets, j_ik = d(map(pi))/dpk
-  virtual double jac(const Point &p,double &j00,double &j01,double &j10,double &j11){cout<<"GLens::jac: This should be a single lens of unit mass. It's a simple function: place it here if you need it."<<endl;exit(1);};
+  virtual double jac(const Point &p,double &j00,double &j01,double &j10,double &j11){
+    double x=p.x,y=p.y,rsq=x*x+y*y,r4=rsq*rsq,a=1-1/rsq;
+    j00=a+2*x*x/r4;
+    j11=a+2*y*y/r4;
+    j01=j10=2*x*y/r4;
+    return 1/(1-1/r4);
+  };
   ///returns J=det(d(map(p))/dp))^-1, sets, j_ik = (d(map(pi))/dpk)^-1
-  virtual double invjac(const Point &p,double &j00,double &j01,double &j10,double &j11){cout<<"GLens::invjac: This should be a single lens of unit mass. It's a simple function: place it here if you need it."<<endl;exit(1);};;
+  virtual double invjac(const Point &p,double &j00,double &j01,double &j10,double &j11){
+    double x=p.x,y=p.y,rsq=x*x+y*y,r4=rsq*rsq,a=1-1/rsq;
+    double mu=1/(1-1/r4);
+    j00=(a+2*y*y/r4)*mu;
+    j11=(a+2*x*x/r4)*mu;
+    j01=j10=-2*x*y/r4*mu;
+    return mu;
+  };
   ///Compute the Laplacian of the local image magnification explicitly
   virtual double Laplacian_mu(const Point &p)const;
-  ///Compute the complex lens shear, and some number of its derivatives  
-  virtual vector<complex<double> > compute_shear(const Point &p, int nder)const;
+  ///Compute the complex lens shear, and some number (up to 2) of its derivatives  
+  virtual ShearDerivs compute_shear(const Point &p, int nder)const;
+  ///Time derivative of the total magnification of the images thetas, for source velocity beta_dot
+  double mag_rate(const Images &thetas, const Point &beta_dot)const;
+  ///Critical curves and caustics as closed polygons in the lens frame, with n samples per branch.
+  ///These are cached, and recomputed only when n or the lens state (see caustic_state) changes.
+  const vector<vector<Point> > &compute_critical_curves(int n=256);
+  const vector<vector<Point> > &compute_caustics(int n=256);
+  ///Distance from the (lens frame) source point p to the nearest caustic
+  double caustic_distance(const Point &p,int n=256);
+  ///Number of images of the (lens frame) source point p, according to its winding number about the caustics
+  int caustic_image_count(const Point &p,int n=256);
+  ///Whether p may be inside a caustic: inside one of the caustic polygons, or too near a caustic to tell
+  bool caustic_inside_test(const Point &p,int n=256);
+  ///Find the times, between the first and last samples of the trajectory, at which it crosses a caustic
+  void find_caustic_crossings(const Trajectory &traj, vector<double> &crossing_times, int n=256);
+  ///Caustic crossing times found by the last compute_trajectory (point source, with GL_caustic_window or GL_adaptive_tol set)
+  const vector<double> &get_caustic_crossings()const{return caustic_crossings;};
   ///compute images and magnitudes along some trajectory
   static vector<double> _compute_trajectory_dummy_dmag;
+  void compute_trajectory (const Trajectory &traj, TrajectoryResult &res, bool integrate=false);
   void compute_trajectory (const Trajectory &traj, vector<double> &time_series, vector<vector<Point> > &thetas_series, vector<int> &index_series,vector<double>&mag_series, vector<double> &dmag=_compute_trajectory_dummy_dmag, bool integrate=false);
-  virtual void finite_source_compute_trajectory (const Trajectory &traj, vector<double> &time_series, vector<vector<Point> > &thetas_series, vector<double>&mag_series, vector<double> &dmag=_compute_trajectory_dummy_dmag, ostream *out=NULL);
+  ///Magnifications only, written to caller buffers aligned with the trajectory samples
+  void compute_magnification(const Trajectory &traj, double *mags_out, double *dmag_out=nullptr);
+  virtual void finite_source_compute_trajectory (const Trajectory &traj, TrajectoryResult &res, ostream *out=NULL, double *mags_out=nullptr, double *dmag_out=nullptr);
+  int finite_source_mag(const Trajectory &traj, double tgrid, double &mag_out, double &dmag_out, Point &centroid, ostream *out=NULL);
   virtual void set_finite_source_image_ofstream(ofstream *out){finite_source_image_ofstream=out;};
   void inv_map_curve(const vector<Point> &curve, vector<vector<Point> > &curves_images, vector<vector<double>> &curve_mags);
   //Note that the centroid is returned in p, and the variance is returned in var
   static double _image_area_mag_dummy_variance;
   int brute_force_circle_mag(const Point &p, const double radius, const double tol, double &magnification);
-  int brute_force_map_mag(const Point &p, const double radius, double &magnification);
+  int brute_force_map_mag(const Point &p, const double radius, double &magnification, Point &centroid);
   int brute_force_area_mag(const Point &p, const double radius, double &magnification);
   void compute_image_curves(const vector<Point> &polygon, const double maxlen, const double refine_limit, int & N, vector<vector<Point>> &closed_curves);
-  void image_area_mag(Point &p, double radius, int & N, double &magnification, double &var=_image_area_mag_dummy_variance, ostream *out=NULL,vector<vector<Point> > *curves=NULL);
+  void image_area_mag(Point &p, double radius, int & N, double &magnification, double &var=_image_area_mag_dummy_variance, ostream *out=NULL,vector<vector<Point> > *curves=NULL, PolygonVertexCache *vcache=NULL);
+  ///Adaptive contour integration alternative to image_area_mag, with the same argument conventions; N is the initial
+  ///number of limb samples.  Returns false if the tolerance could not be met.
+  bool contour_area_mag(Point &p, double radius, int & N, double &magnification, double &var=_image_area_mag_dummy_variance, PolygonVertexCache *vcache=NULL);
+  ///Images of beta by Newton tracking from seed images (see newton_track_images), or else by invmap
+  Images seeded_invmap(const Point &beta, const vector<Point> *seed);
+  ///Source brightness relative to the center, integrated over x=r^2 (in units of the source radius) from 0 to x
+  double source_LD_flux(double x)const;
+  ///Limb-darkened source brightness at mu=sqrt(1-r^2), relative to the center
+  double source_LD_brightness(double mu)const{return 1-source_LD_a*(1-mu)-source_LD_b*(1-mu)*(1-mu);};
+  ///Brightness-weighted mean of r^2 over the source, 1/2 for uniform brightness
+  double source_LD_mean_r2()const{return (0.5-7*source_LD_a/30.0-2*source_LD_b/15.0)/source_LD_flux(1);};
   void set_integrate(bool integrate_or_not){use_integrate=integrate_or_not;have_integrate=true;}
+  void set_newton(bool newton_or_not){use_newton=newton_or_not;if(use_newton)set_integrate(false);}
+  void set_int_roots(bool int_roots_or_not){use_int_roots=int_roots_or_not;if(use_int_roots)set_integrate(true);}
+  void set_trajectory_chunks(int n){trajectory_chunks=max(n,1);}
+  void set_finite_source_threads(int n, bool deterministic=false){finite_source_threads=max(n,1);finite_source_deterministic=deterministic;}
+  void set_ray_threads(int n){ray_threads=max(n,1);}
+  void set_magmap_rays(int n){magmap_rays=n;}
+  void set_adaptive_tol(double tol){adaptive_tol=tol;}
   //For the Optioned interface:
   virtual void addOptions(Options &opt,const string &prefix="");
   /*
@@ -157,12 +540,23 @@ public:
   //For stateSpaceInterface
   virtual void defWorkingStateSpace(const stateSpace &sp){
     if(do_finite_source)idx_log_rho_star=sp.requireIndex("log_rho_star");
+    if(do_finite_source and fit_source_LD){
+      if(source_LD_law==2){
+	idx_LD_a=sp.requireIndex("LD_q1");
+	idx_LD_b=sp.requireIndex("LD_q2");
+      } else idx_LD_a=sp.requireIndex("LD_a");
+    }
     haveWorkingStateSpace();
   };
   virtual void setState(const state &st){
     bayes_component::setState(st);
     //cout<<"idx_log_rho_star="<<idx_log_rho_star<<endl;
     if(do_finite_source)source_radius=pow(10.0,st.get_param(idx_log_rho_star));
+    if(idx_LD_b>=0){
+      double sq1=sqrt(st.get_param(idx_LD_a)),q2=st.get_param(idx_LD_b);
+      source_LD_a=2*sq1*q2;
+      source_LD_b=sq1*(1-2*q2);
+    } else if(idx_LD_a>=0)source_LD_a=st.get_param(idx_LD_a);
     //cout<<"source_radius="<<source_radius<<endl;
   };
   //getCenter provides *trajectory frame* coordinates for the center. Except for with -2, which give the lens frame CM. 
@@ -174,6 +568,10 @@ public:
   //Points in this function and its arguments are in *trajectory frame* coordinates 
   virtual void writeMagMap(ostream &out, const Point &LLcorner,const Point &URcorner,int samples){//,bool output_nimg=false){
     cout<<"GLens::writeMagMap from ("<<LLcorner.x<<","<<LLcorner.y<<") to ("<<URcorner.x<<","<<URcorner.y<<")"<<endl;
+    if(magmap_rays>0){
+      writeRayMagMap(out,LLcorner,URcorner,samples);
+      return;
+    }
     double dx=(URcorner.x-LLcorner.x)/(samples-1);    
     double dy=(URcorner.y-LLcorner.y)/(samples-1);    
     //cout<<"mag-map ranges from: ("<<x0<<","<<y0<<") to ("<<x0+width<<","<<y0+width<<") stepping by: "<<dx<<endl;
@@ -182,22 +580,20 @@ public:
     //cout<<"writeMagMap:output_precision="<<output_precision<<endl;
     double ten2prec=pow(10,output_precision-2);
     out<<"#x  y  magnification"<<endl;
+    TrajectoryResult res;//reused for each row
     for(double y=LLcorner.y;y<=URcorner.y;y+=dy){
       Trajectory traj(Point(LLcorner.x,y), Point(1,0), URcorner.x-LLcorner.x, dx);
-      vector<int> indices;
-      vector<double> times,mags;
-      vector<vector<Point> >thetas;
-      compute_trajectory(traj,times,thetas,indices,mags);
-      for(int i : indices){
-	Point b=traj.get_obs_pos(times[i]);//we want the result in traj frame, to match the dump_trajectory output
-	double mtruc=floor(mags[i]*ten2prec)/ten2prec;
+      compute_trajectory(traj,res);
+      for(int i : res.index){
+	Point b=traj.get_obs_pos(res.t[i]);//we want the result in traj frame, to match the dump_trajectory output
+	double mtruc=floor(res.mag[i]*ten2prec)/ten2prec;
 	//out.precision(output_precision);
 	out<<b.x<<" "<<b.y<<" "<<setiosflags(ios::scientific)<<mtruc<<resetiosflags(flags);
 	if(do_verbose_write){
-	  out<<" "<<thetas[i].size();
+	  out<<" "<<res.nimages(i);
 	  if(true){
-	    for(int j=0;j<thetas[i].size();j++){
-	      out<<" "<<thetas[i][j].x<<" "<<thetas[i][j].y;
+	    for(int j=res.img_offset[i];j<res.img_offset[i+1];j++){
+	      out<<" "<<res.img_x[j]<<" "<<res.img_y[j];
 	    }	
 	  }
 	}
@@ -207,6 +603,8 @@ public:
       out<<endl;
     }	  
   };   
+  ///As writeMagMap, but giving the magnification averaged over each pixel, by inverse ray shooting
+  void writeRayMagMap(ostream &out, const Point &LLcorner,const Point &URcorner,int samples);
   void verboseWrite(bool state=true){do_verbose_write=state;};
   
 };
@@ -224,12 +622,20 @@ class GLensBinary : public GLens{
   Point cm;//center of mass in lens frame
   //mass fractions
   double nu;
-  vector<Point> invmapAsaka(const Point &p);
-  vector<Point> invmapWittMao(const Point &p,bool no_check=false);
-  //virtual int poly_root_integration_func_vec (double t, const double theta[], double thetadot[], void *instance);
+  Images invmapAsaka(const Point &p);
+  Images invmapWittMao(const Point &p,bool no_check=false);
+  bool WittMao_coeffs(double bx, double by, complex<double> c[7])const;
+  Images invmapWittMao_roots(const Point &p, complex<double> c[7], bool z1scaled, bool no_check=false, const complex<double> *polished=nullptr);
+  double image_residual(const Point &th, const Point &p, int &parity)const;
+  ///Counts of Witt-Mao polynomial solves at each precision level (double, long double, quad) for the calling
+  ///thread.  Each thread counts separately, avoiding shared-counter traffic in the inversion; precision_report sums them.
+  static long *precision_counts();
+  static vector<long*> precision_count_list;
+  struct RootFlow;
   //complex<double> saved_roots[6];
-  vector<Point> theta_save;
+  Images theta_save;
   double rWide;
+  double qPlanet;
   //parameter handling
   double q_ref;
   bool do_remap_q;
@@ -244,6 +650,15 @@ class GLensBinary : public GLens{
     require_time_dependent_values();
     return Point(cm.x+tp.x*cos_phit-tp.y*sin_phit,cm.y+tp.x*sin_phit+tp.y*cos_phit);
   };
+  void traj2lens_batch(size_t n, double *x, double *y)const override{
+    require_time_dependent_values();
+    const double c=cos_phit,s=sin_phit;
+    for(size_t i=0;i<n;i++){
+      double tx=x[i],ty=y[i];
+      x[i]=cm.x+tx*c-ty*s;
+      y[i]=cm.y+tx*s+ty*c;
+    }
+  };
   virtual Point lens2traj(const Point tp)const {
     require_time_dependent_values();
     return Point((tp.x-cm.x)*cos_phit+(tp.y-cm.y)*sin_phit,-(tp.x-cm.x)*sin_phit+(tp.y-cm.y)*cos_phit);;
@@ -258,6 +673,8 @@ class GLensBinary : public GLens{
     }
     return dp;
   };
+  array<double,2> caustic_state()const{require_time_dependent_values();return {{q,sL}};};
+  void find_critical_curves(int n);
   ///test conditions to revert to perturbative inversion
   bool testWide(const Point & p,double scale)const{
     require_time_dependent_values();
@@ -268,26 +685,50 @@ class GLensBinary : public GLens{
     //return L>rs||r2>rs*rs;
     return sL>rs||r2>rs*rs||(q+1/q)>2*rs*rs;
   };  
+  ///test conditions to apply the perturbative planetary inversion (takes precedence over testWide, except far out)
+  bool testPlanetary(const Point & p)const{
+    require_time_dependent_values();
+    double rs=rWide,r2=p.x*p.x+p.y*p.y;
+    return min(q,1/q)<qPlanet and not (rs>0 and (sL>rs||r2>rs*rs));
+  };
 public:
   GLensBinary(double q=1,double L=1,double phi0=0);
   virtual GLensBinary* clone(){
     return new GLensBinary(*this);
   };
+  virtual bool assign_to(GLens *other)const{
+    if(typeid(*this)!=typeid(GLensBinary) or typeid(*other)!=typeid(GLensBinary))return false;
+    *static_cast<GLensBinary*>(other)=*this;
+    return true;
+  };
   virtual void setup();
   Point map(const Point &p);
+  void map_batch(const double *x, const double *y, int n, double *bx, double *by);
+  double map_variation_bound(const Point &c, double s)const;
+  double image_radius_bound(double bmax)const;
   //For the GLens interface:
-  vector<Point> invmap(const Point &p);
-  vector<Point> invmapWideBinary(const Point &p);
+  Images invmap(const Point &p);
+  void invmap_batch(const double *bx, const double *by, size_t n, vector<int> &img_offset, vector<double> &img_x, vector<double> &img_y);
+  bool newton_track_images(const Point &p, Images &thetas);
+  Images invmapWideBinary(const Point &p);
+  Images invmapPlanetary(const Point &p);
   double mag(const Point &p);
   using  GLens::mag;
   ///returns J=det(d(map(p))/dp)^-1, sets, j_ik = d(map(pi))/dpk
   double jac(const Point &p,double &j00,double &j01,double &j10,double &j11);
   double invjac(const Point &p,double &j00,double &j01,double &j10,double &j11);
-  vector<complex<double> > compute_shear(const Point &p, int nder)const;
+  ShearDerivs compute_shear(const Point &p, int nder)const;
+  bool evolve_images(double &t, double t1, double &h, double theta[]);
+  int poly_roots(const Point &p, double theta[]);
+  bool evolve_roots(double &t, double t1, double &h, double theta[], int nroots);
+  double root_images(const Point &p, const double theta[], int nroots, Images &thetas);
   //specific to this class:
   double get_q(){return q;};
   double get_s(){return sL;};
-  double set_WideBinaryR(double r){rWide=r;};
+  double set_WideBinaryR(double r){rWide=r;return rWide;};
+  double set_PlanetaryQ(double qp){qPlanet=qp;return qPlanet;};
+  ///Report how often polynomial solves were escalated to higher precision
+  static string precision_report();
   virtual string print_info(int prec=-1)const{ostringstream s;if(prec>0)s.precision(prec);s<<"GLensBinary(q="<<q<<",s="<<sL<<")"<<(have_integrate?(string("\nintegrate=")+(use_integrate?"true":"false")):"")<<endl;return s.str();};
 
   ///From StateSpaceInterface (via bayes_component)
@@ -314,6 +755,7 @@ public:
     addOption("q0","Prior max in q (with q>1) with remapped q0. Default=1e4/","1e5");
     addOption("GLB_gauss_q","Set to assume Gaussian (not flat) prior for log-q"); 
     addOption("GLB_rWide","Binary width/distance cuttoff for applying perturbed signle lens treatment (Einstein units). Default=5","5"); 
+    addOption("GLB_qPlanet","Mass ratio (or inverse) below which to apply perturbative planetary lens inversion (0 to disable). Default=1e-4","1e-4"); 
   };
   ///Set state parameters
   ///
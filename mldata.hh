@@ -4,6 +4,7 @@
 #ifndef MLDATA_HH
 #define MLDATA_HH
 //#include "glens.hh"
+#include "trajectory.hh"
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -25,6 +26,7 @@ protected:
   bool have_time0;
   bayes_frame *time_frame;
   bool have_time_frame, do_extra_noise;
+  time_grid time_grid_shared;
 public:
   ///We relabel the generic bayes_data names as times/mags/etc...
   ML_photometry_data():bayes_data(),times(labels),mags(values),dmags(dvalues),time0(label0){
@@ -59,6 +61,10 @@ public:
     }
     return times[ipk];
     };
+  ///Shared, immutable copy of the data times, for trajectories evaluated on the data epochs.
+  time_grid getTimeGrid()const{
+    return time_grid_shared;
+  };
   ///Crop out some early data.
   ///
   ///Permanently remove early portion of data
@@ -190,6 +196,8 @@ protected:
     double tcut;
     *optValue("tcut")>>tcut;
     cropBefore(tcut);
+    //The epochs are fixed from here on, so we can share one grid of them
+    time_grid_shared=make_shared<const vector<double> >(times);
     haveSetup();
   };
 };
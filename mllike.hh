@@ -103,6 +103,7 @@ public:
     haveWorkingStateSpace();
     checkPointers();
     signal->defWorkingStateSpace(sp);
+    signal->set_data_times(data->getTimeGrid());
     //backward compatible hack    
     //idx_I0=sp.requireIndex("I0");
     //cout<<"do_additive_noise="<<(do_additive_noise?"true":"false")<<endl;
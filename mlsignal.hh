@@ -11,6 +11,7 @@
 #include <iomanip>
 #include <valarray>
 #include "bayesian.hh"
+#include "omp.h"
 
 using namespace std;
 extern bool debug_signal;
@@ -46,7 +47,42 @@ class ML_photometry_signal : public bayes_signal{
   int nsmear;
   double dtsmear_save;
   double smear_unk;
+  bool smear_caustics;
   bool vary_dtsm;
+  time_grid data_times;
+  ///Working copies of the lens and trajectory for each OpenMP thread.  Each thread makes its own on first use
+  ///and keeps them for later calls, which only need setState, so there is no locking and no clone/delete per call.
+  struct workspace{
+    GLens *lens;
+    Trajectory *traj;
+  };
+  mutable vector<workspace> workspaces;
+  void clear_workspaces(){
+    for(auto &ws : workspaces){
+      delete ws.lens;
+      delete ws.traj;
+      ws.lens=nullptr;
+      ws.traj=nullptr;
+    }
+  };
+  ///Get this thread's working lens and trajectory.  Returns false if the thread has no slot in the pool (as
+  ///in a nested parallel region), in which case they are fresh clones for the caller to delete.
+  bool get_workspace(GLens *&worklens, Trajectory *&worktraj)const{
+    int ith=omp_get_thread_num();
+    if(omp_get_level()>1 or ith>=(int)workspaces.size()){
+      worklens=lens->clone();
+      worktraj=traj->clone();
+      return false;
+    }
+    workspace &ws=workspaces[ith];
+    if(not ws.lens){
+      ws.lens=lens->clone();
+      ws.traj=traj->clone();
+    }
+    worklens=ws.lens;
+    worktraj=ws.traj;
+    return true;
+  };
 public:
   ML_photometry_signal(Trajectory *traj_,GLens *lens_):lens(lens_),traj(traj_){
     //have_variances=false;
@@ -54,7 +90,31 @@ public:
     localPrior=nullptr;
     vary_dtsm=false;
   };
-  ~ML_photometry_signal(){};
+  ~ML_photometry_signal(){clear_workspaces();};
+  ///The workspaces own their lens and trajectory copies, so the signal is not copyable
+  ML_photometry_signal(const ML_photometry_signal &)=delete;
+  ML_photometry_signal &operator=(const ML_photometry_signal &)=delete;
+  ///Flag the (sorted, physical) times which have a caustic crossing of the trajectory within dtmax (days)
+  ///of them.  The trajectory is left with its times reset to the span searched.
+  static vector<bool> caustic_crossing_mask(GLens &lens, Trajectory &traj, const vector<double> &times, double dtmax){
+    int nt=times.size();
+    vector<bool> mask(nt,false);
+    if(nt==0)return mask;
+    vector<double> ctimes(times),crossings;
+    ctimes.insert(ctimes.begin(),times.front()-dtmax);
+    ctimes.push_back(times.back()+dtmax);
+    traj.set_times(ctimes);
+    lens.find_caustic_crossings(traj,crossings);
+    //The crossings come in frame time
+    for(double &tc:crossings)tc=traj.get_phys_time(tc);
+    for(int i=0;i<nt;i++){
+      auto it=lower_bound(crossings.begin(),crossings.end(),times[i]-dtmax);
+      mask[i]=(it!=crossings.end() and *it<=times[i]+dtmax);
+    }
+    return mask;
+  };
+  ///Provide the data epochs.  When the model is requested on these times, the trajectories share this grid.
+  void set_data_times(const time_grid &grid){data_times=grid;};
   //Produce the signal model
   vector<double> get_model_signal(const state &st, const vector<double> &times, vector<double> &variances)const override{
     //Caution!  Global/Member variables should not change or there will be problems with openmp
@@ -67,14 +127,12 @@ public:
     if(vary_dtsm) dtsmear=pow(10.0,st.get_param(idx_dtsm));
     else dtsmear=dtsmear_save;
     vector<double> xtimes,model,modelmags;
-    vector<vector<Point> > thetas;
-    vector<int> indices;
 
-    //cout<<"cloning"<<endl;
-    //We need to clone lens/traj before working with them so that each omp thread is working with different copies of the objects.
-    GLens *worklens=lens->clone();
+    //Each omp thread needs to work with its own copies of the lens/traj objects.
+    GLens *worklens;
+    Trajectory *worktraj;
+    bool pooled=get_workspace(worklens,worktraj);
     worklens->setState(st);
-    Trajectory *worktraj=traj->clone();
     worktraj->setState(st);
 
     //If specified, implement smearing across a small time band
@@ -98,24 +156,36 @@ public:
 	//cout<<deltas[j]<<" ";	  
       }
       //cout<<endl;
+      //Optionally smear only where a caustic crossing falls within the smearing window; elsewhere the light
+      //curve is smooth on the smearing scale, and we evaluate only at the data time (with smear index -1).
+      vector<bool> smear_here(nt,true);
+      if(smear_caustics and nt>0){
+	double dtmax=max(abs(deltas.front()),abs(deltas.back()));
+	smear_here=caustic_crossing_mask(*worklens,*worktraj,times,dtmax);
+      }
       typedef pair< pair<int,int>,double > entry;
       vector< entry > table;
-      for(int i=0;i<nt;i++)
-	for(int j=0;j<nsmear;j++)
-	  table.push_back(make_pair(make_pair(i,j),times[i]+deltas[j]));
+      for(int i=0;i<nt;i++){
+	if(smear_here[i])
+	  for(int j=0;j<nsmear;j++)
+	    table.push_back(make_pair(make_pair(i,j),times[i]+deltas[j]));
+	else table.push_back(make_pair(make_pair(i,-1),times[i]));
+      }
+      int nx=table.size();
       //cout<<"before: ";for(int i=0;i<20 and i<nsmear*nt;i++)cout<<table[i].second<<" ";cout<<endl;
       //cout<<"      : ";for(int i=0;i<20 and i<nsmear*nt;i++)cout<<"("<<table[i].first.first<<","<<table[i].first.second<<") ";cout<<endl;
       sort(table.begin(),table.end(),
 	   [](entry left,entry right){return left.second<right.second;});
       //cout<<"after: ";for(int i=0;i<20 and i<nsmear*nt;i++)cout<<table[i].second<<" ";cout<<endl;
       //cout<<"      : ";for(int i=0;i<20 and i<nsmear*nt;i++)cout<<"("<<table[i].first.first<<","<<table[i].first.second<<") ";cout<<endl;
-      xtimes.resize(nt*nsmear);
-      for(int i=0;i<nt*nsmear;i++)xtimes[i]=table[i].second;
+      xtimes.resize(nx);
+      for(int i=0;i<nx;i++)xtimes[i]=table[i].second;
 
       //compute the magnifications
       worktraj->set_times(xtimes);
-      variances.resize(0);
-      worklens->compute_trajectory(*worktraj,xtimes,thetas,indices,modelmags,variances);
+      modelmags.resize(nx);
+      variances.resize(nx);
+      worklens->compute_magnification(*worktraj,modelmags.data(),variances.data());
 
       //Variables for the averaging
       vector<double>sum(nt);
@@ -125,30 +195,33 @@ public:
       vector< vector<double> >dmagsarray(nt,vector<double>(nsmear));
       
       //conduct averaging to get results for original time grid
-      for(int i=0;i<nt*nsmear;i++){
-	double val=modelmags[indices[i]];
+      for(int i=0;i<nx;i++){
+	double val=modelmags[i];
 	int idata=table[i].first.first;
 	int ismear=table[i].first.second;
 	sum[idata]+=val;
 	sum2[idata]+=val*val;
 	//sum[idata]+=val*weight[ismear];
 	//sum2[idata]+=val*val*weight[ismear];
-	magsarray[idata][ismear]=val;
+	if(ismear>=0)magsarray[idata][ismear]=val;
       }
-      if(variances.size()>0){
-	for(int i=0;i<nt*nsmear;i++){
-	  double val=variances[indices[i]];
-	  int idata=table[i].first.first;
-	  int ismear=table[i].first.second;
-	  vsum[idata]+=val;
-	  dmagsarray[idata][ismear]=val;
-	}
+      for(int i=0;i<nx;i++){
+	double val=variances[i];
+	int idata=table[i].first.first;
+	int ismear=table[i].first.second;
+	vsum[idata]+=val;
+	if(ismear>=0)dmagsarray[idata][ismear]=val;
       }
       modelmags.resize(nt);
       variances.resize(nt);
 
       //cout<<"vals/t,avg,var:"<<endl;
       for(int i=0;i<nt;i++){
+	if(not smear_here[i]){
+	  modelmags[i]=sum[i];
+	  variances[i]=vsum[i];
+	  continue;
+	}
 	double avg = sum[i]/nsmear;
 	double var = vsum[i]/nsmear + ( sum2[i] - nsmear*avg*avg)/(nsmear-1.0);
 	if(smear_trim_level>0){
@@ -201,41 +274,45 @@ public:
       //Prepare the magnitude results
       //cout<<"t,Ival,var:"<<endl;
       for(int i=0;i<times.size();i++ ){
-	double mu=modelmags[indices[i]];
+	double mu=modelmags[i];
 	double Ival = I0 - 2.5*log10(Fs*mu+1-Fs);
 	model.push_back(Ival);
 	double fac=2.5/(mu-1+1/Fs)*smear_unk;
 	variances[i]*=fac*fac;
 	//cout<<times[i]<<", "<<Ival<<", "<<variances[i]<<endl;
 	if(!isfinite(Ival)&&!burped){
-	  cout<<"get_model_signal(smear): model infinite: modelmags="<<modelmags[indices[i]]<<" at state="<<st.show()<<endl;
+	  cout<<"get_model_signal(smear): model infinite: modelmags="<<modelmags[i]<<" at state="<<st.show()<<endl;
 	  burped=true;
 	}
       }
     } else {//no smearing
       //cout<<"not smearing"<<endl;
-      worktraj->set_times(times);
-      vector<double>dmags;
+      if(data_times and times==*data_times)worktraj->set_times(data_times);
+      else worktraj->set_times(times);
+      modelmags.resize(times.size());
+      vector<double>dmags(times.size());
       //cout<<"calling compute traj"<<endl;
-      worklens->compute_trajectory(*worktraj,xtimes,thetas,indices,modelmags,dmags);
+      worklens->compute_magnification(*worktraj,modelmags.data(),dmags.data());
       //cout<<"prep variance"<<endl;
       variances.resize(times.size());
       bool burped=false;
       for(int i=0;i<times.size();i++ ){
-	double mu=modelmags[indices[i]];
+	double mu=modelmags[i];
 	double Ival = I0 - 2.5*log10(Fs*mu+1-Fs);
 	model.push_back(Ival);
 	if(!isfinite(Ival)&&!burped){
-	  cout<<"get_model_signal: model infinite: modelmags="<<modelmags[indices[i]]<<" at t="<<times[i]<<" state="<<st.get_string()<<endl;
+	  cout<<"get_model_signal: model infinite: modelmags="<<modelmags[i]<<" at t="<<times[i]<<" state="<<st.get_string()<<endl;
 	  burped=true;
 	}
-	if(dmags.size()>0)variances[i]=dmags[indices[i]]*dmags[indices[i]];
+	variances[i]=dmags[i]*dmags[i];
 	//cout<<i<<" var="<<variances[i]<<endl;
       }
     }
       
-    delete worktraj;
-    delete worklens;
+    if(not pooled){
+      delete worktraj;
+      delete worklens;
+    }
     return model;
   };
   
@@ -263,6 +340,7 @@ public:
     //cout<<"signal::defWSS: about to def lens"<<endl;
     lens->defWorkingStateSpace(sp);
     traj->defWorkingStateSpace(sp);
+    clear_workspaces();//the working copies must be cloned again with the new parameter indices
   };
   
   void addOptions(Options &opt,const string &prefix=""){
@@ -271,14 +349,18 @@ public:
     addOption("MLPsig_dtsmear","Time-width (tE units) over which to smear the magnification model or prior center if free parameter. (Default=0.001)","0.001");
     addOption("MLPsig_dtsm_range","Time-width log10-Gaussian prior width. (Default=-1,fixed)","-1");
     addOption("MLPsig_smear_unk","Uncertainty factor for time smearing.","0.1");
+    addOption("MLPsig_smear_caustics","Smear only data points with a caustic crossing within the smearing window.");
   };
   void setup(){
     haveSetup();
+    clear_workspaces();
+    workspaces.resize(omp_get_max_threads(),workspace{nullptr,nullptr});
     double dtsmear_range;
     *optValue("MLPsig_nsmear")>>nsmear;
     *optValue("MLPsig_dtsmear")>>dtsmear_save;
     *optValue("MLPsig_dtsm_range")>>dtsmear_range;
     *optValue("MLPsig_smear_unk")>>smear_unk;
+    smear_caustics=optSet("MLPsig_smear_caustics");
     nsmear=abs(nsmear);
     smearing=(nsmear>1);
     vary_dtsm = ( dtsmear_range>0 and smearing );
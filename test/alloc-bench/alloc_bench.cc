@@ -0,0 +1,79 @@
+//Heap allocation benchmark for the binary-lens light-curve computation
+//
+//Counts calls to the global operator new made while computing point-source
+//binary-lens light curves with GLens::compute_trajectory into a reused
+//TrajectoryResult, and with GLens::compute_magnification, which is the lens
+//part of each likelihood evaluation.  Build with "make alloc_bench" from the top directory and run
+//with no arguments.
+
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <chrono>
+#include "glens.hh"
+
+bool debug = false;
+bool debugint = false;
+bool debug_signal = false;
+
+static atomic<long> alloc_count(0);
+
+void* operator new(size_t size){
+  alloc_count++;
+  void *p=malloc(size);
+  if(!p)throw bad_alloc();
+  return p;
+}
+void operator delete(void *p)noexcept{free(p);}
+void operator delete(void *p,size_t)noexcept{free(p);}
+
+int main(int argc, char*argv[]){
+  const int Ncurves=100;
+  const double width=4, cadence=0.002;
+  //A resonant binary with a planetary mass ratio, so that the trajectories cross the caustics.
+  GLensBinary lens(1e-3,1.0,0.3);
+  cout<<"Lens: "<<lens.print_info();
+
+  long total_allocs=0, total_samples=0;
+  double total_mag=0;
+  TrajectoryResult res;//reused across the light curves
+  auto start=chrono::steady_clock::now();
+  for(int ic=0;ic<Ncurves;ic++){
+    double y0=-0.2+0.4*ic/(Ncurves-1.0);
+    Trajectory traj(Point(-width/2,y0), Point(1,0), width, cadence);
+    long count0=alloc_count;
+    lens.compute_trajectory(traj,res);
+    total_allocs+=alloc_count-count0;
+    total_samples+=res.index.size();
+    for(int i : res.index)total_mag+=res.mag[i];
+  }
+  double secs=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+
+  //The same light curves, magnifications only
+  long mag_allocs=0;
+  double mag_total=0;
+  vector<double> magbuf;
+  start=chrono::steady_clock::now();
+  for(int ic=0;ic<Ncurves;ic++){
+    double y0=-0.2+0.4*ic/(Ncurves-1.0);
+    Trajectory traj(Point(-width/2,y0), Point(1,0), width, cadence);
+    magbuf.resize(traj.Nsamples());
+    long count0=alloc_count;
+    lens.compute_magnification(traj,magbuf.data());
+    mag_allocs+=alloc_count-count0;
+    for(double m : magbuf)mag_total+=m;
+  }
+  double mag_secs=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+
+  cout<<"light curves:             "<<Ncurves<<endl;
+  cout<<"samples per curve:        "<<total_samples/Ncurves<<endl;
+  cout<<"allocations per curve:    "<<total_allocs/(double)Ncurves<<endl;
+  cout<<"allocations per sample:   "<<total_allocs/(double)total_samples<<endl;
+  cout<<"microseconds per sample:  "<<secs*1e6/total_samples<<endl;
+  cout<<"(checksum: mean mag = "<<total_mag/total_samples<<")"<<endl;
+  cout<<"magnification only:"<<endl;
+  cout<<"allocations per curve:    "<<mag_allocs/(double)Ncurves<<endl;
+  cout<<"microseconds per sample:  "<<mag_secs*1e6/total_samples<<endl;
+  cout<<"(checksum: mean mag = "<<mag_total/total_samples<<")"<<endl;
+  return 0;
+}
@@ -0,0 +1,75 @@
+//Accuracy test for the tabled EMB ephemeris
+//
+//Compares EMB_ephemeris::posvel, which ParallaxTrajectory uses for the observer
+//position and velocity offsets, with the exact EMB_ephemeris::position and a fine
+//central difference of it, over epochs spanning several decades, including the
+//segment boundaries.  The batch positions (EMB_ephemeris::position_batch) are
+//checked against posvel.  Build with "make ephem_test" from the top directory and run
+//with no arguments.  Exits nonzero if the tolerances are not met.
+
+#include <chrono>
+#include "trajectory.hh"
+
+bool debug = false;
+
+int main(int argc, char*argv[]){
+  const double pos_tol=1e-10;//AU
+  const double vel_tol=1e-10;//AU/day
+  const double h=1e-3;//days, step for the reference velocity
+  const int N=200000;
+  //TT days since J2000, 1990 to 2040
+  const double tmin=-3652.5, tmax=14610;
+
+  vector<double> times;
+  for(int i=0;i<N;i++)times.push_back(tmin+(tmax-tmin)*(i+0.5)/N);
+  for(double t=tmin;t<tmax;t+=EMB_ephemeris::seg_days*37)times.push_back(floor(t/EMB_ephemeris::seg_days)*EMB_ephemeris::seg_days);
+
+  double pos_err=0,vel_err=0;
+  for(double t : times){
+    double pos[3],vel[3],x[3],xp[3],xm[3];
+    EMB_ephemeris::posvel(t,pos,vel);
+    EMB_ephemeris::position(t,x[0],x[1],x[2]);
+    EMB_ephemeris::position(t+h,xp[0],xp[1],xp[2]);
+    EMB_ephemeris::position(t-h,xm[0],xm[1],xm[2]);
+    for(int i=0;i<3;i++){
+      pos_err=max(pos_err,abs(pos[i]-x[i]));
+      vel_err=max(vel_err,abs(vel[i]-(xp[i]-xm[i])/(2*h)));
+    }
+  }
+  //The batch positions should repeat posvel's (the times are sorted, but for the boundary epochs at the end)
+  size_t n=times.size();
+  vector<double> bx(n),by(n),bz(n);
+  EMB_ephemeris::position_batch(times.data(),n,bx.data(),by.data(),bz.data());
+  double batch_err=0;
+  for(size_t i=0;i<n;i++){
+    double pos[3],vel[3];
+    EMB_ephemeris::posvel(times[i],pos,vel);
+    batch_err=max(batch_err,max(abs(bx[i]-pos[0]),max(abs(by[i]-pos[1]),abs(bz[i]-pos[2]))));
+  }
+  cout<<"epochs checked:           "<<times.size()<<endl;
+  cout<<"max position error (AU):  "<<pos_err<<endl;
+  cout<<"max velocity error (AU/d): "<<vel_err<<endl;
+  cout<<"max batch difference (AU): "<<batch_err<<endl;
+
+  //timing, with the table filled
+  double sum=0;
+  auto start=chrono::steady_clock::now();
+  for(double t : times){double pos[3],vel[3];EMB_ephemeris::posvel(t,pos,vel);sum+=pos[0]+vel[0];}
+  auto mid=chrono::steady_clock::now();
+  for(double t : times){double x,y,z;EMB_ephemeris::position(t,x,y,z);sum+=x;}
+  auto end=chrono::steady_clock::now();
+  EMB_ephemeris::position_batch(times.data(),n,bx.data(),by.data(),bz.data());
+  auto batch_end=chrono::steady_clock::now();
+  sum+=bx[0];
+  cout<<"ns per tabled pos+vel:    "<<chrono::duration<double,nano>(mid-start).count()/times.size()<<endl;
+  cout<<"ns per exact pos:         "<<chrono::duration<double,nano>(end-mid).count()/times.size()<<endl;
+  cout<<"ns per batch pos:         "<<chrono::duration<double,nano>(batch_end-end).count()/times.size()<<endl;
+  cout<<"(checksum: "<<sum<<")"<<endl;
+
+  if(pos_err>pos_tol or vel_err>vel_tol or not(batch_err<1e-14)){
+    cout<<"FAILED"<<endl;
+    return 1;
+  }
+  cout<<"PASSED"<<endl;
+  return 0;
+}
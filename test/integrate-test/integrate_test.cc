@@ -0,0 +1,78 @@
+//Test for the image integration mode of GLens::compute_trajectory near a fold
+//
+//With GL_int_mag_limit raised to 10, the integrated images of this binary-lens trajectory run onto a fold
+//caustic, where the step size control drives the step toward zero.  The integrator must then give up, so
+//that compute_trajectory falls back on the polynomial, rather than stall.  We check that the light curve
+//is finished within a time limit, and that with caustic-crossing segmentation (GL_caustic_window) it
+//agrees with the polynomial solution.  Build with "make integrate_test" from the top directory and run
+//with no arguments.  Exits nonzero on failure.
+
+#include <csignal>
+#include <unistd.h>
+#include "glens.hh"
+
+bool debug = false;
+bool debugint = false;
+
+///A binary lens with the integration controls set directly
+class TestLens : public GLensBinary {
+public:
+  TestLens(double window):GLensBinary(0.1,1.0,0.0){
+    GL_int_tol=1e-10;
+    GL_int_mag_limit=10;
+    caustic_window=window;
+  };
+};
+
+void timed_out(int sig){
+  cout<<"Timed out: the integration is stalled"<<endl;
+  cout<<"FAILED"<<endl;
+  _exit(1);
+};
+
+int main(int argc, char*argv[]){
+  const int timeout=60;//seconds
+  const double tol=1e-6;
+  signal(SIGALRM,timed_out);
+  alarm(timeout);
+
+  Trajectory traj(Point(-0.12*sin(1.0),0.12*cos(1.0)),Point(cos(1.0),sin(1.0)));
+  vector<double> times;
+  for(int i=0;i<=4000;i++)times.push_back(-2+i*0.001);
+  traj.set_times(times);
+
+  TestLens poly_lens(0);
+  TrajectoryResult ref;
+  poly_lens.compute_trajectory(traj,ref,false);
+
+  int nfail=0;
+  for(double window : {0.0,0.01}){
+    TestLens lens(window);
+    lens.set_integrate(true);
+    TrajectoryResult res;
+    lens.compute_trajectory(traj,res,true);
+    if(res.index.size()!=times.size()){
+      cout<<"window="<<window<<": "<<res.index.size()<<" of "<<times.size()<<" samples returned"<<endl;
+      nfail++;
+      continue;
+    }
+    double maxerr=0;
+    for(size_t i=0;i<times.size();i++){
+      double mg=res.mag[res.index[i]],mg_ref=ref.mag[ref.index[i]];
+      if(not isfinite(mg)){
+	cout<<"window="<<window<<": magnification "<<mg<<" at t="<<times[i]<<endl;
+	nfail++;
+      }
+      maxerr=max(maxerr,abs(mg-mg_ref)/mg_ref);
+    }
+    cout<<"window="<<window<<": max relative difference from the polynomial "<<maxerr<<endl;
+    //Without segmentation the integration may miss the new images inside the caustic
+    if(window>0 and not(maxerr<tol))nfail++;
+  }
+  if(nfail>0){
+    cout<<"FAILED"<<endl;
+    return 1;
+  }
+  cout<<"PASSED"<<endl;
+  return 0;
+}
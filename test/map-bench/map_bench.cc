@@ -0,0 +1,102 @@
+//Accuracy and speed benchmark for the binary-lens forward map
+//
+//Compares GLensBinary::map (double precision) with the same map evaluated
+//in long double, on square grids of image-plane points around each of the
+//lens configurations in a test set file (by default the magmap regression
+//set script/full_glens_test_set).  Each line of that file gives the magmap
+//center (-1,0,1), width, log10(q) and log10(s).  The images found by
+//invmap for grid points taken as sources are compared too, since those are
+//the points where the map tests in invmapWittMao are made.  Build with
+//"make map_bench" from the top directory and run from there.
+
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cfloat>
+#include "glens.hh"
+
+bool debug = false;
+bool debugint = false;
+bool debug_signal = false;
+
+//The map as it was computed before, in long double.
+static Point map_ld(const Point &p, double q, double sL){
+  long double nu=1/(1+q);
+  long double x=p.x,y=p.y,x1=x-(long double)sL/2.0L,x2=x+(long double)sL/2.0L,r1sq=x1*x1+y*y,r2sq=x2*x2+y*y;
+  long double c1=(1.0L-nu)/r1sq,c2=nu/r2sq;
+  return Point(x-x1*c1-x2*c2,y-y*(c1+c2));
+}
+
+//Error of map relative to the size of the terms it sums, in units of DBL_EPSILON.
+static double map_err(GLensBinary &lens, const Point &p, double &abserr){
+  double q=lens.get_q(),sL=lens.get_s();
+  Point b=lens.map(p),bref=map_ld(p,q,sL);
+  double dx=b.x-bref.x,dy=b.y-bref.y;
+  abserr=sqrt(dx*dx+dy*dy);
+  //The deflections by the two lenses can nearly cancel, so we measure against each separately.
+  double nu=1/(1+q),r1=sqrt((p.x-sL/2)*(p.x-sL/2)+p.y*p.y),r2=sqrt((p.x+sL/2)*(p.x+sL/2)+p.y*p.y);
+  double scale=sqrt(p.x*p.x+p.y*p.y)+(1-nu)/r1+nu/r2;
+  return abserr/scale/DBL_EPSILON;
+}
+
+int main(int argc, char*argv[]){
+  string fname="script/full_glens_test_set";
+  if(argc>1)fname=argv[1];
+  const int ngrid=100, nrep=20;
+  ifstream in(fname);
+  if(!in){
+    cout<<"Could not open test set file '"<<fname<<"'"<<endl;
+    exit(1);
+  }
+  double max_ulps=0, max_abserr=0, max_img_abserr=0;
+  long npts=0, nimgs=0;
+  double t_double=0, t_ld=0, sum=0;
+  string line;
+  while(getline(in,line)){
+    if(line.size()==0 or line[0]=='#')continue;
+    istringstream ss(line);
+    int center;
+    double width,logq,logs;
+    if(!(ss>>center>>width>>logq>>logs))continue;
+    double q=pow(10.0,logq),sL=pow(10.0,logs);
+    GLensBinary lens(q,sL,0);
+    //Lens frame: the lens at +s/2 has mass fraction q/(1+q).
+    double nu=1/(1+q);
+    double x0=(center==0?(1-2*nu)*sL/2:center*sL/2);
+    vector<Point> pts;
+    for(int i=0;i<ngrid;i++)for(int j=0;j<ngrid;j++)
+      pts.push_back(Point(x0+width*((i+0.5)/ngrid-0.5),width*((j+0.5)/ngrid-0.5)));
+    double case_ulps=0;
+    for(auto &p : pts){
+      double abserr, ulps=map_err(lens,p,abserr);
+      case_ulps=max(case_ulps,ulps);
+      max_abserr=max(max_abserr,abserr);
+      npts++;
+      //The images of p as a source
+      Images imgs=lens.invmap(p);
+      for(auto &th : imgs){
+	ulps=map_err(lens,th,abserr);
+	case_ulps=max(case_ulps,ulps);
+	max_img_abserr=max(max_img_abserr,abserr);
+	nimgs++;
+      }
+    }
+    max_ulps=max(max_ulps,case_ulps);
+    auto start=chrono::steady_clock::now();
+    for(int k=0;k<nrep;k++)for(auto &p : pts){Point b=lens.map(p);sum+=b.x+b.y;}
+    t_double+=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+    start=chrono::steady_clock::now();
+    for(int k=0;k<nrep;k++)for(auto &p : pts){Point b=map_ld(p,q,sL);sum+=b.x+b.y;}
+    t_ld+=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+    cout<<"center="<<center<<" width="<<width<<" log_q="<<logq<<" log_s="<<logs<<" : max error "<<case_ulps<<" eps"<<endl;
+  }
+  cout<<"grid points:                  "<<npts<<endl;
+  cout<<"images:                       "<<nimgs<<endl;
+  cout<<"max relative error (eps):     "<<max_ulps<<endl;
+  cout<<"max abs error, grid:          "<<max_abserr<<endl;
+  cout<<"max abs error, images:        "<<max_img_abserr<<endl;
+  cout<<"ns per map, double:           "<<t_double*1e9/npts/nrep<<endl;
+  cout<<"ns per map, long double:      "<<t_ld*1e9/npts/nrep<<endl;
+  cout<<"(checksum: "<<sum<<")"<<endl;
+  return 0;
+}
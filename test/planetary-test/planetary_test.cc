@@ -0,0 +1,127 @@
+//Regression test for the perturbative planetary inversion, GLensBinary::invmapPlanetary
+//
+//Inside the caustics of a planetary lens the approximate (Chang-Refsdal) images from which invmapPlanetary
+//starts can miss a pair of images, so this test concentrates on points there.  The program is built twice.
+//Built with -DUSE_KIND_16 it selects points inside the caustics of several planetary lenses, and writes them
+//with reference image counts and magnifications from the quad-precision build.  The Witt-Mao coefficients
+//are formed in double, which for q<<1 costs some accuracy, so the reference images are polished by Newton
+//iteration on the lens equation in quad precision.  Built normally it reads these from stdin and checks the
+//default (planetary) inversion against them.  Build and run with "make planetary_test" from the top
+//directory.  Exits nonzero on failure.
+
+#include "glens.hh"
+
+bool debug = false;
+bool debugint = false;
+
+#ifdef USE_KIND_16
+
+#include <quadmath.h>
+
+typedef complex<__float128> cquad;
+
+///Polish an image by Newton iteration in quad precision, returning the signed magnification
+__float128 polish_image(double q, double s, const Point &p, Point &image){
+  //The lens at -s/2 has mass 1/(1+q), the lens at +s/2 has mass q/(1+q)
+  __float128 m1=1/(1+(__float128)q), m2=1-m1;
+  cquad z1(-(__float128)s/2,0), z2((__float128)s/2,0), beta(p.x,p.y), z(image.x,image.y);
+  __float128 G2=0;
+  for(int iter=0;iter<50;iter++){
+    cquad r1=(__float128)1/conj(z-z1), r2=(__float128)1/conj(z-z2);
+    cquad f=z-m1*r1-m2*r2-beta, G=m1*r1*r1+m2*r2*r2;
+    G2=norm(G);
+    z+=(G*conj(f)-f)/(1-G2);
+  }
+  image=Point((double)real(z),(double)imag(z));
+  return 1/(1-G2);
+};
+
+int main(int argc, char*argv[]){
+  const int npts=12;//per caustic
+  const double q_s[][2]={{1e-5,0.8},{1e-5,1.25},{5e-5,1.0},{3e-5,0.6}};
+  unsigned long seed=12345;
+  auto rand01=[&seed](){
+    seed=(seed*6364136223846793005UL+1442695040888963407UL);
+    return (seed>>11)*(1.0/9007199254740992.0);
+  };
+  cout.precision(17);
+  auto reference=[&](double q, double s, const Point &p){
+    GLensBinary lens(q,s,0.0);
+    lens.set_PlanetaryQ(0);
+    lens.set_WideBinaryR(1e6);
+    Images images=lens.invmap(p);
+    //Very near a cusp even the quad build may lose images
+    if(images.size()!=5)return false;
+    __float128 mag=0;
+    for(Point &im : images)mag+=fabsq(polish_image(q,s,p,im));
+    //Polishing should not merge images
+    for(int i=0;i<images.size();i++)for(int j=0;j<i;j++)
+      if(abs(images[i].x-images[j].x)+abs(images[i].y-images[j].y)<1e-12)return false;
+    cout<<q<<" "<<s<<" "<<p.x<<" "<<p.y<<" "<<images.size()<<" "<<(double)mag<<endl;
+    return true;
+  };
+  //The case reported for the original Chang-Refsdal root selection
+  reference(1e-5,0.8,Point(-0.84997987930725238,-0.0061707106098573437));
+  for(auto qs : q_s){
+    GLensBinary lens(qs[0],qs[1],0.0);
+    lens.set_WideBinaryR(1e6);
+    const vector<vector<Point> > &caustics=lens.compute_caustics();
+    for(const vector<Point> &caustic : caustics){
+      double xmin=INFINITY,xmax=-INFINITY,ymin=INFINITY,ymax=-INFINITY;
+      for(const Point &c : caustic){
+	xmin=min(xmin,c.x);
+	xmax=max(xmax,c.x);
+	ymin=min(ymin,c.y);
+	ymax=max(ymax,c.y);
+      }
+      int n=0;
+      for(int itry=0;itry<100*npts and n<npts;itry++){
+	Point p(xmin+(xmax-xmin)*rand01(),ymin+(ymax-ymin)*rand01());
+	if(lens.caustic_image_count(p)!=5)continue;//inside a caustic
+	if(reference(qs[0],qs[1],p))n++;
+      }
+    }
+  }
+  return 0;
+}
+
+#else
+
+int main(int argc, char*argv[]){
+  const double tol=1e-6;
+  double q,s,x,y,mag_ref;
+  int nref;
+  int npts=0,nfail=0;
+  cout.precision(15);
+  while(cin>>q>>s>>x>>y>>nref>>mag_ref){
+    npts++;
+    Point p(x,y);
+    GLensBinary lens(q,s,0.0);
+    lens.set_WideBinaryR(1e6);
+    //invmapPlanetary may decline (and invmap then falls back on Witt-Mao), but should not return wrong images
+    Images thP=lens.invmapPlanetary(p);
+    Images images=lens.invmap(p);
+    double mag=lens.mag(images);
+    bool fail=false;
+    if(thP.size()>0 and (thP.size()!=nref or abs(lens.mag(thP)-mag_ref)>tol*mag_ref)){
+      cout<<"invmapPlanetary found "<<thP.size()<<" images, mag="<<lens.mag(thP);
+      fail=true;
+    } else if(images.size()!=nref or abs(mag-mag_ref)>tol*mag_ref){
+      cout<<"invmap found "<<images.size()<<" images, mag="<<mag;
+      fail=true;
+    }
+    if(fail){
+      cout<<" at ("<<x<<","<<y<<") for q="<<q<<" s="<<s<<", expected "<<nref<<" images, mag="<<mag_ref<<endl;
+      nfail++;
+    }
+  }
+  cout<<nfail<<" failures at "<<npts<<" points inside planetary caustics"<<endl;
+  if(npts==0 or nfail>0){
+    cout<<"FAILED"<<endl;
+    return 1;
+  }
+  cout<<"PASSED"<<endl;
+  return 0;
+}
+
+#endif
@@ -0,0 +1,103 @@
+//Test for the caustic-restricted time smearing in ML_photometry_signal
+//
+//With smear_caustics set, only data points with a caustic crossing within the smearing window are
+//smeared.  Here we locate the crossings of a binary-lens trajectory independently, by bisecting on changes
+//in the image count along a fine scan in physical time, and check that the points flagged by
+//ML_photometry_signal::caustic_crossing_mask are exactly those whose smearing window brackets one of them.
+//The trajectory has tE and tpass far from the frame values, so that a mix-up of frame and physical time
+//shows.  Build with "make smear_test" from the top directory and run with no arguments.  Exits nonzero
+//on failure.
+
+#include "mlsignal.hh"
+
+bool debug = false;
+bool debugint = false;
+bool debug_signal = false;
+
+///A linear trajectory with the Einstein time and time of closest approach set directly
+class TestTrajectory : public Trajectory {
+public:
+  TestTrajectory(Point pos0, Point vel0, double tE_days, double tpass_days):Trajectory(pos0,vel0){
+    tE=tE_days;
+    tpass=tpass_days;
+  };
+};
+
+int main(int argc, char*argv[]){
+  const double tE=25.0, tpass=7345.5;//days
+  const double dtmax=0.15;//days, half-width of the smearing window
+  const double cadence=0.1;//days; less than 2*dtmax, so every crossing has data nearby
+  const double tol=1e-6;//days
+  GLensBinary lens(0.2,1.1,0.0);
+  TestTrajectory traj(Point(0.05,-0.02),Point(1,0.3),tE,tpass);
+
+  vector<double> times;
+  for(double t=tpass-1.5*tE;t<=tpass+1.5*tE;t+=cadence)times.push_back(t);
+  traj.set_times(times);
+
+  //Reference crossings in physical time
+  auto nimages=[&](double t){
+    lens.set_time_dependent_values(traj.get_frame_time(t));
+    int n=lens.invmap(lens.get_obs_pos(traj,traj.get_frame_time(t))).size();
+    lens.unset_time_dependent_values();
+    return n;
+  };
+  vector<double> crossings;
+  const double dt=1e-3;
+  double ta=times.front()-dtmax;
+  int na=nimages(ta);
+  for(double tb=ta+dt;tb<=times.back()+dtmax;tb+=dt){
+    int nb=nimages(tb);
+    if(nb!=na){
+      double t0=tb-dt,t1=tb;
+      while(t1-t0>tol){
+	double tm=(t0+t1)/2;
+	if(nimages(tm)==na)t0=tm;
+	else t1=tm;
+      }
+      crossings.push_back((t0+t1)/2);
+    }
+    na=nb;
+  }
+  cout<<"Reference crossings at (days):";
+  for(double tc:crossings)cout<<" "<<tc;
+  cout<<endl;
+
+  vector<bool> mask=ML_photometry_signal::caustic_crossing_mask(lens,traj,times,dtmax);
+
+  int nfail=0,nsmeared=0;
+  for(size_t i=0;i<times.size();i++){
+    bool near=false,marginal=false;
+    for(double tc:crossings){
+      double d=abs(times[i]-tc);
+      if(d<=dtmax+tol)near=true;
+      if(abs(d-dtmax)<=tol)marginal=true;
+    }
+    if(mask[i])nsmeared++;
+    if(mask[i]!=near and not marginal){
+      cout<<"Data point at t="<<times[i]<<" is "<<(mask[i]?"":"not ")<<"smeared, but the smearing window "
+	  <<(near?"brackets a":"misses every")<<" crossing"<<endl;
+      nfail++;
+    }
+  }
+  //Every crossing should fall in the window of some smeared point
+  for(double tc:crossings){
+    bool covered=false;
+    for(size_t i=0;i<times.size();i++)if(mask[i] and abs(times[i]-tc)<=dtmax)covered=true;
+    if(not covered){
+      cout<<"No smeared data point brackets the crossing at t="<<tc<<endl;
+      nfail++;
+    }
+  }
+  cout<<nsmeared<<" of "<<times.size()<<" data points smeared, around "<<crossings.size()<<" crossings"<<endl;
+  if(crossings.size()==0){
+    cout<<"Test trajectory crosses no caustics"<<endl;
+    nfail++;
+  }
+  if(nfail>0){
+    cout<<"FAILED"<<endl;
+    return 1;
+  }
+  cout<<"PASSED"<<endl;
+  return 0;
+}
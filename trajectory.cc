@@ -3,6 +3,7 @@
 
 //#include "glens.hh"
 #include "trajectory.hh"
+#include <typeinfo>
 using namespace std;
 
 bool Trajectory::verbose=false;
@@ -27,6 +28,22 @@ Point operator*(const Point &a, const double &val){return Point(a.x*val,a.y*val)
 // ParallaxTrajectory ***********************************************
 
 
+///Instantaneous EMB orbital elements at TT time t in days since J2000, from JPL's approximate current epoch
+///elements and their per-century rates of change.
+static inline void emb_elements(double t, double &a, double &e, double &I, double &L, double &lonp){
+  const double emax=0.99;//anyway this would be an extremely non-physical time...
+  const double degrad=180.0/M_PI;
+  const double a0=1.00000261,e0=0.01671123,I0=-0.00001531/degrad,
+    L0=100.46457166/degrad,lonp0=102.93768193/degrad;
+  const double adot=5.62e-6,edot=-43.92e-6,Idot=-0.01294668/degrad,
+    Ldot=35999.37244981/degrad,lonpdot=0.32327364/degrad;
+  //inst. values
+  double Tcen=t/36525.;
+  a=a0+adot*Tcen;e=e0+edot*Tcen;I=I0+Idot*Tcen;L=L0+Ldot*Tcen;lonp=lonp0+lonpdot*Tcen;
+  if(e<-emax)e=-emax;
+  if(e>emax)e=emax;
+};
+
 ///Define the observer trajectory position in SSB coordinates.
 ///
 ///We rely on the expression for the Earth-Moon barycenter (EMB) position from
@@ -40,8 +57,7 @@ Point operator*(const Point &a, const double &val){return Point(a.x*val,a.y*val)
 /// The results are returned in the argument in Cartesian SSB coords consistent
 /// with ecliptic sky coordinates.
 ///
-void ParallaxTrajectory::get_obs_pos_ssb(double t_frame, double & x, double &y, double &z)const{
-  double t=get_phys_time(t_frame)+phys_time0;
+void EMB_ephemeris::position(double t, double & x, double &y, double &z){
   ///We take t to be terrestrial time, TT, time in days since the beginning of 
   ///the J2000 epoch, meaning seconds since J2000 (ts) divided by 86400. 
   /// I.e. t=ts/86400.  Note that the J2000 epoch reference corresponds to 
@@ -54,18 +70,9 @@ void ParallaxTrajectory::get_obs_pos_ssb(double t_frame, double & x, double &y,
   ///Our position comes from JPL's approximate current epoch orbital elements 
   ///( semi-maj axis a, eccen. e, inclination I, mean long. L, long. at
   /// perihelion lonp and long. of ascending node (=0 for earth)) and their 
-  /// per-century rates of change. These are:
-  const double emax=0.99;//anyway this would be an extremely non-physical time...
-  const double degrad=180.0/M_PI;
-  const double a0=1.00000261,e0=0.01671123,I0=-0.00001531/degrad,
-    L0=100.46457166/degrad,lonp0=102.93768193/degrad;
-  const double adot=5.62e-6,edot=-43.92e-6,Idot=-0.01294668/degrad,
-    Ldot=35999.37244981/degrad,lonpdot=0.32327364/degrad;
-  //inst. values
-  double Tcen=t/36525.;
-  double a=a0+adot*Tcen,e=e0+edot*Tcen,I=I0+Idot*Tcen,L=L0+Ldot*Tcen,lonp=lonp0+lonpdot*Tcen;
-  if(e<-emax)e=-emax;
-  if(e>emax)e=emax;
+  /// per-century rates of change, see emb_elements.
+  double a,e,I,L,lonp;
+  emb_elements(t,a,e,I,L,lonp);
   //argument of perihelion argp=lonp here
   //mean anomaly M (in range -pi<=M<PI, eccentric anom. E (solves M=E-e*sin(E),
   double M=L-lonp-floor(((L-lonp)/M_PI+1)/2.0)*M_PI*2,E=M+e*sin(M),Eold=0;
@@ -79,33 +86,132 @@ void ParallaxTrajectory::get_obs_pos_ssb(double t_frame, double & x, double &y,
   double rhoyz=(sp*xper+cp*yper);
   y=rhoyz*cI;
   z=rhoyz*sI;
-  if(verbose)
+  if(Trajectory::verbose)
 #pragma omp critical 
     {
-      cout<<"ParallaxTrajectory::get_obs_pos_ssb: cp,xper,sp,yper,E,Eold:"<<cp<<", "<<xper<<", "<<sp<<", "<<yper<<", "<<E<<", "<<Eold<<endl;
+      cout<<"EMB_ephemeris::position: cp,xper,sp,yper,E,Eold:"<<cp<<", "<<xper<<", "<<sp<<", "<<yper<<", "<<E<<", "<<Eold<<endl;
       cout<<"L,e,M,a:"<<L<<", "<<e<<", "<<M<<", "<<a<<endl;
-      cout<<"t_frame="<<t_frame<<" phys_time0="<<phys_time0<<" tE"<<tE<<" t="<<t<<" yr="<<2000+t/365.25<<endl;
-      cout<<"(x,y,z) = ("<<x<<", "<<y<<", "<<z<<")"<<endl;
     }
 };
 
-///Here we just compute the second order numerical derivative.  That is probably good enough...but we could do analytic..
-///It is not hard to write down an analytic version of this to be computed along-with the position computation. Basically
-///you can certainly treat a and e as constant, and you can probably also treat the other elements except for M,E as constant
-///in taking the derivatives.  The trouble is you have to do this computation more or less along with the position computation.
-///We could just copy the above computation here with the changes and recompute those derivs.  We could also compute and
-///save velocities along with the position computation, and then chack and don't recompute if the evaluation time is identical.
-///That would save up to a factor of almost 3 over this computation if velocity and position are always evals consequtively at
-///the same points, or a factor of 2 if not.
-void ParallaxTrajectory::get_obs_vel_ssb(double t, double & rdot, double &thdot, double &phdot)const{
-  double rp,thp,php,rm,thm,phm;
-  double delta=1.0; //1 day is small
-  get_obs_pos_ssb(t+delta,rp,thp,php);
-  get_obs_pos_ssb(t-delta,rm,thm,phm);
-  rdot=(rp-rm)/(2*delta);
-  thdot=(thp-thm)/(2*delta);
-  phdot=(php-phm)/(2*delta);
-}; 
+atomic<const EMB_ephemeris::segment*> EMB_ephemeris::table[EMB_ephemeris::max_segs];
+
+///Fit the segment starting at TT time t0, sampling the exact position at the Chebyshev nodes.
+void EMB_ephemeris::segment::fit(double t0){
+  const int n=order+1;
+  double f[3][n];
+  for(int j=0;j<n;j++){
+    double u=cos(M_PI*(j+0.5)/n);
+    position(t0+(u+1)*seg_days/2,f[0][j],f[1][j],f[2][j]);
+  }
+  for(int i=0;i<3;i++){
+    for(int k=0;k<n;k++){
+      double sum=0;
+      for(int j=0;j<n;j++)sum+=f[i][j]*cos(M_PI*k*(j+0.5)/n);
+      c[i][k]=2.0*sum/n;
+    }
+    //derivative series, with respect to u
+    double *d=c[i+3];
+    d[n-1]=0;
+    d[n-2]=2*(n-1)*c[i][n-1];
+    for(int k=n-3;k>=0;k--)d[k]=d[k+2]+2*(k+1)*c[i][k+1];
+  }
+};
+
+///Evaluate the series at scaled time u in [-1,1] (Clenshaw), with velocity per day.
+void EMB_ephemeris::segment::eval(double u, double pos[3], double vel[3])const{
+  for(int i=0;i<6;i++){
+    double b1=0,b2=0;
+    for(int k=order;k>0;k--){
+      double b0=2*u*b1-b2+c[i][k];
+      b2=b1;
+      b1=b0;
+    }
+    double val=u*b1-b2+c[i][0]/2;
+    if(i<3)pos[i]=val;
+    else vel[i-3]=val*2/seg_days;
+  }
+};
+
+void EMB_ephemeris::posvel(double t, double pos[3], double vel[3]){
+  double kseg=floor(t/seg_days);
+  double u=2*(t-kseg*seg_days)/seg_days-1;
+  long idx=(long)kseg+max_segs/2;
+  if(idx<0 or idx>=max_segs){
+    segment seg;
+    seg.fit(kseg*seg_days);
+    seg.eval(u,pos,vel);
+    return;
+  }
+  table_segment(idx,kseg)->eval(u,pos,vel);
+};
+
+///The tabled segment at index idx (for segment number kseg), fit now if no thread has done so yet.
+const EMB_ephemeris::segment *EMB_ephemeris::table_segment(long idx, double kseg){
+  const segment *seg=table[idx].load(memory_order_acquire);
+  if(not seg){
+    segment *newseg=new segment;
+    newseg->fit(kseg*seg_days);
+    const segment *expected=nullptr;
+    if(table[idx].compare_exchange_strong(expected,newseg,memory_order_acq_rel))seg=newseg;
+    else {//another thread got there first
+      delete newseg;
+      seg=expected;
+    }
+  }
+  return seg;
+};
+
+///The times are taken in runs that fall in the same segment (for sorted times, all those in a span of
+///seg_days), so that the loops over the times in a run have the same coefficients for every lane and no
+///branches.  Times beyond the table are done one at a time by posvel.
+void EMB_ephemeris::position_batch(const double *t, size_t n, double *x, double *y, double *z){
+  size_t i0=0;
+  while(i0<n){
+    double kseg=floor(t[i0]/seg_days),t0=kseg*seg_days;
+    long idx=(long)kseg+max_segs/2;
+    if(idx<0 or idx>=max_segs){
+      double pos[3],vel[3];
+      posvel(t[i0],pos,vel);
+      x[i0]=pos[0];
+      y[i0]=pos[1];
+      z[i0]=pos[2];
+      i0++;
+      continue;
+    }
+    size_t i1=i0+1;
+    while(i1<n and t[i1]>=t0 and t[i1]<t0+seg_days)i1++;
+    const double (*c)[order+1]=table_segment(idx,kseg)->c;
+    //As in segment::eval, for the positions only, in blocks with the loop over the times innermost
+    const int nblock=64;
+    double u[nblock],b1[3][nblock],b2[3][nblock];
+    for(size_t ib=i0;ib<i1;ib+=nblock){
+      int nb=min((size_t)nblock,i1-ib);
+#pragma omp simd
+      for(int i=0;i<nb;i++)u[i]=2*(t[ib+i]-t0)/seg_days-1;
+      for(int j=0;j<3;j++){
+	fill(b1[j],b1[j]+nb,0.0);
+	fill(b2[j],b2[j]+nb,0.0);
+      }
+      for(int k=order;k>0;k--)for(int j=0;j<3;j++){
+#pragma omp simd
+	for(int i=0;i<nb;i++){
+	  double b0=2*u[i]*b1[j][i]-b2[j][i]+c[j][k];
+	  b2[j][i]=b1[j][i];
+	  b1[j][i]=b0;
+	}
+      }
+#pragma omp simd
+      for(int i=0;i<nb;i++){
+	x[ib+i]=u[i]*b1[0][i]-b2[0][i]+c[0][0]/2;
+	y[ib+i]=u[i]*b1[1][i]-b2[1][i]+c[1][0]/2;
+	z[ib+i]=u[i]*b1[2][i]-b2[2][i]+c[2][0]/2;
+      }
+    }
+    i0=i1;
+  }
+};
+
   ///Using the approx location of the source, transform from ssb in source-lens line-of-sight frame.
 Point ParallaxTrajectory::ssb_los_transform(double x, double y, double z)const{
   ///Here we must assume some coordinate frame orientation for the observer plane. 
@@ -153,4 +259,37 @@ Point ParallaxTrajectory::ssb_los_transform(double x, double y, double z)const{
   return Point(xtraj,ytraj);
 };
 
-
+///Batch form of get_obs_pos, with ssb_los_transform inlined.  For this class the observer positions for each
+///block of times come from EMB_ephemeris::position_batch, and the transform is a loop over the block that the
+///compiler can vectorize.  A derived class may have another orbit (or time mapping), so there we take the
+///positions one at a time from get_obs_posvel_ssb.
+void ParallaxTrajectory::get_obs_pos_batch(const double *t, size_t n, double *x, double *y)const{
+  if(typeid(*this)==typeid(ParallaxTrajectory)){
+    const int nblock=64;
+    double tphys[nblock],px[nblock],py[nblock],pz[nblock];
+    for(size_t i0=0;i0<n;i0+=nblock){
+      int nb=min((size_t)nblock,n-i0);
+      for(int i=0;i<nb;i++)tphys[i]=Trajectory::get_phys_time(t[i0+i])+phys_time0;
+      EMB_ephemeris::position_batch(tphys,nb,px,py,pz);
+#pragma omp simd
+      for(int i=0;i<nb;i++){
+	double xnew = -py[i]*cos_source_lon + px[i]*sin_source_lon;
+	double ynew = -(px[i]*cos_source_lon + py[i]*sin_source_lon)*sin_source_lat + pz[i]*cos_source_lat;
+	double tl=t[i0+i]-toff;
+	x[i0+i] = p0.x+tl*v0.x + piE*(xnew * cos_dphi - ynew * sin_dphi);
+	y[i0+i] = p0.y+tl*v0.y + piE*(xnew * sin_dphi + ynew * cos_dphi);
+      }
+    }
+    return;
+  }
+  for(size_t i=0;i<n;i++){
+    double pos[3],vel[3];
+    get_obs_posvel_ssb(t[i],pos,vel);
+    //as in ssb_los_transform
+    double xnew = -pos[1]*cos_source_lon + pos[0]*sin_source_lon;
+    double ynew = -(pos[0]*cos_source_lon + pos[1]*sin_source_lon)*sin_source_lat + pos[2]*cos_source_lat;
+    double tl=t[i]-toff;
+    x[i] = p0.x+tl*v0.x + piE*(xnew * cos_dphi - ynew * sin_dphi);
+    y[i] = p0.y+tl*v0.y + piE*(xnew * sin_dphi + ynew * cos_dphi);
+  }
+};
@@ -4,6 +4,8 @@
 #ifndef TRAJECTORY_HH
 #define TRAJECTORY_HH
 #include <vector>
+#include <memory>
+#include <atomic>
 #include <iostream>
 #include <cmath>
 #include <sstream>
@@ -93,14 +95,14 @@ inline int pointInPolygon(const Point &p, const vector<Point>&verts){
     int inext=(i+1)%verts.size();
     if(verts[i].y <= p.y){ //case: segment does not begin in upper half plane 
       if(verts[inext].y > p.y){ // and segment crosses into upper half plane
-	if(getTwiceTriangleArea(verts[i],verts[i+1],p) > 0){
+	if(getTwiceTriangleArea(verts[i],verts[inext],p) > 0){
 	  //use triangle area orientation to determine if segment winds positive (CCW) from Q4 to Q1
 	  nwind++;
 	}
       }
     } else {  //alternative case segment does begin in upper half plane
       if(verts[inext].y <= p.y){ // and crosses into lower plane or midline;
-	if(getTwiceTriangleArea(verts[i],verts[i+1],p) < 0){
+	if(getTwiceTriangleArea(verts[i],verts[inext],p) < 0){
 	  //use triangle area orientation to determine if segment winds negative (CC) from Q1 to Q4
 	  nwind--;
 	}
@@ -110,6 +112,10 @@ inline int pointInPolygon(const Point &p, const vector<Point>&verts){
   return nwind;
 }
 	
+///An immutable, reference-counted grid of observation ("phys") times.  Data epochs are fixed once the data
+///are processed, so one grid can be shared by every trajectory clone and thread without copying.
+typedef shared_ptr<const vector<double> > time_grid;
+
 ///Next is a class for trajectories through the observer plane
 ///base class implements a straight-line trajectory
 class Trajectory : public bayes_component {
@@ -146,7 +152,8 @@ protected:
   double cad;
   double toff;
   bool have_times;
-  vector<double> times;
+  time_grid times;//phys times, converted to frame times on access
+  shared_ptr<vector<double> > own_times;//buffer behind times when we made the copy ourselves
   double tE,tpass;
   double r0,phi,r0_ref,tE_max;
   bool do_remap_r0, do_log_tE;
@@ -189,28 +196,40 @@ public:
     have_phys_time_ref=true;
   };
   ///Set the required eval times.  (Times are "phys" times, but "phys"=frame if tE=1,tpass=0)
-  virtual void set_times(vector<double> times,double toff=0){
-    vector<double>tEs=times;
-    for(double &t : tEs)t=get_frame_time(t);
-    this->times=tEs;
+  ///The grid is shared, not copied.  Conversion to frame time uses the trajectory state when the times are read,
+  ///so setState may be called before or after this.
+  virtual void set_times(const time_grid &times,double toff=0){
+    this->times=times;
     this->toff=toff;
-    ts=this->times[0];
-    tf=this->times.back();
     have_times=true;
   };
+  ///As above, copying the times.  Our own buffer is reused from the last call unless a clone still shares it.
+  virtual void set_times(const vector<double> &times,double toff=0){
+    if(not own_times or own_times.use_count()>(this->times==own_times?2:1))own_times=make_shared<vector<double> >();
+    *own_times=times;
+    set_times(time_grid(own_times),toff);
+  };
   ///Return start time. (Times are "frame" times, but "phys"=frame if tE=1,tpass=0)
-  virtual double t_start()const {return ts;};
+  virtual double t_start()const {if(have_times)return get_frame_time(times->front()); else return ts;};
   ///Return end time. (Times are "frame" times, but "phys"=frame if tE=1,tpass=0)
-  virtual double t_end()const {return tf;};
+  virtual double t_end()const {if(have_times)return get_frame_time(times->back()); else return tf;};
   virtual double tEinstein()const {return tE;};
-  virtual int Nsamples()const {if(have_times)return times.size(); else return (int)((t_end()-t_start())/cad)+1;};
+  virtual int Nsamples()const {if(have_times)return times->size(); else return (int)((t_end()-t_start())/cad)+1;};
   ///Return frame time of ith obs. 
-  virtual double get_obs_time(int ith)const {if(have_times)return times[ith]; else return ts-toff+cad*ith;};
+  virtual double get_obs_time(int ith)const {if(have_times)return get_frame_time((*times)[ith]); else return ts-toff+cad*ith;};
   virtual double get_phys_time(double frame_time)const{ return frame_time*tE+tpass;}//referenced to phys_time0;
   virtual double get_frame_time(double phys_time)const{return (phys_time-tpass)/tE;}
   ///Argument takes frame time below
   virtual Point get_obs_pos(double t)const {double x=p0.x+(t-toff)*v0.x,y=p0.y+(t-toff)*v0.y;return Point(x,y);};
   virtual Point get_obs_vel(double t)const {return v0;};
+  ///Positions for n frame times at once, written to x and y.  Derived classes with costly positions override this.
+  virtual void get_obs_pos_batch(const double *t, size_t n, double *x, double *y)const{
+    for(size_t i=0;i<n;i++){
+      Point p=get_obs_pos(t[i]);
+      x[i]=p.x;
+      y[i]=p.y;
+    }
+  };
   virtual string print_info()const {ostringstream s;s<<"Trajectory({"<<p0.x<<","<<p0.y<<"},{"<<v0.x<<","<<v0.y<<"})"<<endl;return s.str();};
   //For bayes_component/stateSpaceInterface
   virtual void defWorkingStateSpace(const stateSpace &sp){
@@ -336,6 +355,33 @@ public:
 /////////////////////////////////////////////////////////////////////////////////////////////////////
 
 
+///Process-wide table of the approximate Earth-Moon barycenter (EMB) ephemeris used by ParallaxTrajectory.
+///The SSB position depends only on physical time, so one table serves every trajectory, clone and thread.
+///Time (TT days since J2000) is split into segments of seg_days, each fit on first use by Chebyshev series
+///of degree order for the position and its time derivative.  Segments are published atomically, so lookups
+///take no lock.  Within a span of max_segs/2 segments either side of J2000 the segments are kept for the life
+///of the process; beyond that each lookup refits the segment.
+class EMB_ephemeris {
+public:
+  static const int order=10;
+  static const int max_segs=8192;
+  static constexpr double seg_days=16;
+  ///Exact (untabled) EMB position in AU at TT time t, from JPL's approximate orbital elements
+  static void position(double t, double &x, double &y, double &z);
+  ///Tabled EMB position (AU) and velocity (AU/day) at TT time t
+  static void posvel(double t, double pos[3], double vel[3]);
+  ///Tabled EMB positions (AU) at the n TT times t, evaluated in a loop over the times that the compiler can vectorize
+  static void position_batch(const double *t, size_t n, double *x, double *y, double *z);
+private:
+  struct segment{
+    double c[6][order+1];//Chebyshev coefficients for x,y,z and their derivatives, in the scaled time
+    void fit(double t0);
+    void eval(double u, double pos[3], double vel[3])const;
+  };
+  static atomic<const segment*> table[max_segs];
+  static const segment *table_segment(long idx, double kseg);
+};
+
 ///This is a ParallaxTrajectory class for when the observer motion relative to the Sun cannot be neglected.
 ///The nominal version of this class includes the Earth's trajectory accurate to
 ///1e4 km or about a few minutes motion.  The class is designed to be easily generalizable
@@ -390,25 +436,29 @@ public:
   //virtual void rotate(double pieE,double phimu){};
   Point get_obs_pos(double t)const override{return Trajectory::get_obs_pos(t)+get_obs_pos_offset(t);};
   Point get_obs_vel(double t)const {return Trajectory::get_obs_vel(t)+get_obs_vel_offset(t);};
+  void get_obs_pos_batch(const double *t, size_t n, double *x, double *y)const override;
   ///The following functions are to help with computing the parallax
   ///First we need to define the observer orbital motion in barycentric coordinates
   void get_barycentric_observer(double t, double &r, double &theta, double &phi){};
 protected:
   ///These are internal functions needed to realize the parallax
   ///First note that we will use time standardized to in JD since J2000
-  ///Define the observer trajectory position in SSB coordinates
-  ///First argument should be frame-time
-  virtual void get_obs_pos_ssb(double t, double &x, double &y, double &z)const;
-  ///Define the observer trajectory velocity in SSB coordinates
-  ///For this class we define an approx Earth-Moon barycenter trajectory but that can be overloaded.
-  virtual void get_obs_vel_ssb(double t, double &x, double &y, double &z)const;
   ///Using the approx location of the source, transform from ssb in source-lens line-of-sight frame.
   virtual Point ssb_los_transform(double x, double y, double z)const;
+  ///Define the observer trajectory position and velocity (per unit frame time) together in SSB coordinates.
+  ///First argument should be frame-time.
+  ///For this class we take the approx Earth-Moon barycenter trajectory from the EMB_ephemeris table, but that
+  ///can be overloaded for other orbits.
+  virtual void get_obs_posvel_ssb(double t, double pos[3], double vel[3])const{
+    EMB_ephemeris::posvel(get_phys_time(t)+phys_time0,pos,vel);
+    for(int i=0;i<3;i++)vel[i]*=tE;
+  };
   ///Compute observer position offset from ssb in source-lens line-of-sight frame.
   ///Argument takes frame-time
   virtual Point get_obs_pos_offset(double t)const{
-    double x=0,y=0,z=0;
-    get_obs_pos_ssb(t,x,y,z);
+    double pos[3],vel[3];
+    get_obs_posvel_ssb(t,pos,vel);
+    double x=pos[0],y=pos[1],z=pos[2];
     Point result=ssb_los_transform(x,y,z)*piE;
     if(verbose)
 #pragma omp critical 
@@ -422,9 +472,9 @@ protected:
   };
   ///Compute observer velocity offset from ssb in source-lens line-of-sight frame.
   virtual Point get_obs_vel_offset(double t)const{
-    double x,y,z;
-    get_obs_vel_ssb(t,x,y,z);
-    return ssb_los_transform(x,y,z)*piE;
+    double pos[3],vel[3];
+    get_obs_posvel_ssb(t,pos,vel);
+    return ssb_los_transform(vel[0],vel[1],vel[2])*piE;
   };
   ///approximately convert equatorial to ecliptic coordinates
   void equatorial2ecliptic(double source_ra, double source_dec, double &source_lat, double &source_lon){